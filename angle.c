@@ -0,0 +1,282 @@
+/*
+ * Fixed point angle conversion for Celestron NexStar hand control
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "angle.h"
+
+/*
+ * One circle in microseconds of time or arc is 86400e6 or 1296000e6.
+ * Both are 2^13 times an odd number, so scaling microseconds to binary
+ * angle units is (us << 19) / K and never leaves 64 bits.
+ */
+#define	CIRCLE_US_HOUR	86400000000ULL
+#define	CIRCLE_US_DEG	1296000000000ULL
+#define	CIRCLE_MS_HOUR	86400000ULL
+#define	CIRCLE_MS_DEG	1296000000ULL
+
+static const signed char hexval[256] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+};
+
+/* each byte as its two upper case hex digits, built by the compiler */
+#define	HEXDIGIT(n)	((n) < 10 ? '0' + (n) : 'A' + (n) - 10)
+#define	HEXPAIR(n)	{ HEXDIGIT((n) >> 4), HEXDIGIT((n) & 15) }
+#define	HEXPAIR4(n)		HEXPAIR(n), HEXPAIR(n+1), HEXPAIR(n+2), HEXPAIR(n+3)
+#define	HEXPAIR16(n)	HEXPAIR4(n), HEXPAIR4(n+4), HEXPAIR4(n+8), HEXPAIR4(n+12)
+#define	HEXPAIR64(n)	HEXPAIR16(n), HEXPAIR16(n+16), HEXPAIR16(n+32), HEXPAIR16(n+48)
+
+static const char hexpair[256][2] = {
+	HEXPAIR64(0), HEXPAIR64(64), HEXPAIR64(128), HEXPAIR64(192)
+};
+
+/*
+ * parse [+-]#+[dh]#+m#+[.#+]s into an angle and return
+ * individual components
+ * if next is not NULL *next returns pointer to next character in buffer after
+ * completion or last character seen on error.
+ * Seconds are returned in microseconds; finer fractions are dropped.
+ * On error, returns 0, *rerr is non-zero and contents of *dh, *min and
+ * *usec are undefined
+ */
+angle_t convert2angle(char *buf, char **next, int *dh, int *min, long *usec, int *rerr)
+{
+	char *bp = buf, c;
+	int sign = 1, state = 0, type = 0, done = 0;
+	int number1=0, number2=0, number3=0;
+	unsigned long long fraction=0, part=0, total, circle;
+
+	while((c = *bp++) != 0) {
+		switch(state) {
+		case 0: /* looking for #,  + or - ; ignore space */
+			if( isspace(c) )
+				continue;
+			if( c == '+' ) {
+				sign = 1;
+				state = 1;
+				continue;
+			}
+			if( c == '-' ) {
+				sign = -1;
+				state = 1;
+				continue;
+			}
+			state = 1;
+			/* fall through to numbers only */
+		case 1:
+			if( !(c >= '0' && c <= '9') )
+				goto err;
+			for(number1 = 0; c >= '0' && c <= '9'; c = *bp++)
+				number1 = number1*10 + (c - '0');
+			state = 2;
+			--bp; /* point back to char that broke the loop */
+			break;
+		case 2: /* must be one of 'd', 'D', 'H' or 'h' */
+			if( c == 'd' || c == 'D' )
+				type = 1;
+			else if (c == 'h' || c == 'H' )
+				type = 2;
+			else
+				goto err;
+			state = 3;
+			break;
+		case 3:
+			if( isspace(c))
+				continue;
+			state = 4;
+			/* fall through */
+		case 4:
+			if( !(c >= '0' && c <= '9') )
+				goto err;
+			for(number2 = 0; c >= '0' && c <= '9'; c = *bp++)
+				number2 = number2*10 + (c - '0');
+			state = 5;
+			--bp; /* point back to char that broke the loop */
+			break;
+		case 5: /* must be m or M */
+			if( c != 'm' && c != 'M' )
+				goto err;
+			state = 6;
+			break;
+		case 6:
+			if( isspace(c))
+				break;
+			state = 7;
+			/* fall through */
+		case 7:
+			if( !(c >= '0' && c <= '9') )
+				goto err;
+			for(number3 = 0; c >= '0' && c <= '9'; c = *bp++)
+				number3 = number3*10 + (c - '0');
+			state = 8;
+			--bp; /* point back to char that broke the loop */
+			break;
+		case 8: /* must be . s or S */
+			fraction = 0;
+			if( c == 's' || c == 'S' ) {
+				done = 1;
+				break;
+			}
+			if( c != '.' )
+				goto err;
+			state = 9;
+			break;
+		case 9: /* grab fraction in microseconds */
+			part = 100000;
+			fraction = 0;
+			while( c >= '0' && c <= '9' ) {
+				fraction += (c - '0')*part;
+				part /= 10;
+				c = *bp++;
+			}
+			if( c != 's' && c != 'S' )
+				goto err;
+			done = 1;
+			break;
+		}
+		if( done )
+			break;
+	}
+	if( !done )
+		goto err;
+	/* success! return values */
+	if( next )
+		*next = bp;
+	if( dh != NULL )
+		*dh = number1*sign;
+	if( min != NULL )
+		*min = number2*sign;
+	total = ((unsigned long long)number1*3600 + number2*60 + number3)*1000000 + fraction;
+	if( usec != NULL )
+		*usec = sign*(long)(total % 60000000);
+	circle = (type == 1) ? CIRCLE_US_DEG : CIRCLE_US_HOUR;
+	total %= circle;
+	circle >>= 13;
+	total = ((total << 19) + circle/2) / circle;
+	*rerr = 0;
+	return (sign < 0) ? -(angle_t)total : (angle_t)total;
+err:
+	if( next )
+		*next = bp;
+	/* process error here */
+	*rerr = state ? state : -1;
+	return 0;
+}
+
+/*
+ * convert hhmmss or ddmmss pair to binary angles.
+ * The unit of each value comes from its own 'h' or 'd' marker.
+ * Returns -1 if either value fails to parse.
+ */
+int convert2position(char *buf, int type, angle_t *rvalue1, angle_t *rvalue2)
+{
+	char *fmt;
+	int	dh1, min1, dh2, min2, err;
+	long usec1, usec2;
+
+	*rvalue1 = convert2angle(buf, &fmt, &dh1, &min1, &usec1, &err);
+	if( err != 0 )
+		return -1;
+	*rvalue2 = convert2angle(fmt, NULL, &dh2, &min2, &usec2, &err);
+	if( err != 0 )
+		return -1;
+ 	return 0;
+}
+
+/*
+ * Print an angle as hours (hour=1) or degrees (hour=0).
+ * With sign set values past half a circle print as negative, which is
+ * how declination and altitude come back from the hand control.
+ */
+void convert2hhmmss(char *buf, angle_t value, int hour, int sign)
+{
+	int dh, m, s, frac, minus = 0;
+	unsigned long long ms, circle;
+	char *ticks[2] = { "dms", "hms" };
+
+	if( sign && value > 0x80000000U ) {
+		minus = 1;
+		value = -value;
+	}
+	/* nearest millisecond, so 2h prints as 2h and not 1h59m59.999s */
+	circle = hour ? CIRCLE_MS_HOUR : CIRCLE_MS_DEG;
+	ms = ((unsigned long long)value * circle + 0x80000000ULL) >> 32;
+	if( ms == circle )
+		ms = 0;
+	frac = ms % 1000; ms /= 1000;
+	s    = ms % 60;   ms /= 60;
+	m    = ms % 60;
+	dh   = ms / 60;
+	sprintf(buf, "%c%03d%c %02d%c %02d.%03d%c", (minus == 0) ? '+' : '-',
+		dh, ticks[hour][0], m, ticks[hour][1], s, frac, ticks[hour][2]);
+}
+
+/*
+ * Read 4 or 8 hex digits as sent by the hand control.
+ * 16 bit values land in the top half of the angle.
+ */
+angle_t hex2angle(const char *buf, int digits)
+{
+	uint32_t v = 0;
+	int i, d;
+
+	for(i = 0; i < digits; i++) {
+		if( (d = hexval[(unsigned char)buf[i]]) == 0 )
+			break;
+		v = (v << 4) | (d - 1);
+	}
+	return v << ((32 - 4*i) % 32);
+}
+
+/*
+ * Write 4 or 8 upper case hex digits, no terminator, a byte at a time.
+ * 16 bit values are rounded to the nearest step rather than truncated.
+ * Returns pointer past the last digit.
+ */
+char *angle2hex(char *buf, angle_t value, int digits)
+{
+	int i;
+
+	if( digits == 4 )
+		value = (value + 0x8000) >> 16;
+	for(i = digits - 2; i >= 0; i -= 2) {
+		buf[i] = hexpair[value & 0xFF][0];
+		buf[i+1] = hexpair[value & 0xFF][1];
+		value >>= 8;
+	}
+	return buf + digits;
+}
+
+/* decode 16 or 32 bit positional in RA or ALTAZIMUTH */
+char *decode(char *buf, char cmd, angle_t *ab)
+{
+	static char rbuf[64];
+	char buf1[20], buf2[20];
+
+	switch(cmd) {
+	default:
+		return "unimplemented";
+	case 'E': case 'Z': /* 16 bit precision */
+		ab[0] = hex2angle(&buf[0], 4);
+		ab[1] = hex2angle(&buf[5], 4);
+		break;
+	case 'e': case 'z': /* 24 bit precision */
+		ab[0] = hex2angle(&buf[0], 8);
+		ab[1] = hex2angle(&buf[9], 8);
+		break;
+	}
+	convert2hhmmss(buf1, ab[0], (cmd == 'e' || cmd == 'E') ? ANGLE_HOUR : ANGLE_DEG, 0);
+	convert2hhmmss(buf2, ab[1], ANGLE_DEG, 1);
+	sprintf(rbuf, "%s %s", buf1, buf2);
+	return rbuf;
+}
@@ -0,0 +1,33 @@
+/*
+ * Fixed point angles for Celestron NexStar hand control
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef ANGLE_H
+#define ANGLE_H
+
+#include <stdint.h>
+
+/*
+ * Angles are held in binary angle units: a full circle is 2^32, exactly
+ * as the hand control sends them in the precise (32 bit) commands.
+ * The 16 bit commands use the top half of the same value.
+ * Arithmetic wraps at 360 degrees (24 hours) for free.
+ */
+typedef uint32_t angle_t;
+
+#define	ANGLE_FULL		4294967296.0	/* one circle, for the odd double */
+#define	ANGLE_DEG		0	/* ddd mm ss, full circle is 360 */
+#define	ANGLE_HOUR		1	/* hh mm ss, full circle is 24 */
+
+angle_t	convert2angle(char *buf, char **next, int *dh, int *min, long *usec, int *rerr);
+int		convert2position(char *buf, int type, angle_t *rvalue1, angle_t *rvalue2);
+void	convert2hhmmss(char *buf, angle_t value, int hour, int sign);
+angle_t	hex2angle(const char *buf, int digits);
+char	*angle2hex(char *buf, angle_t value, int digits);
+char	*decode(char *buf, char cmd, angle_t *ab);
+
+#endif /* ANGLE_H */
@@ -0,0 +1,61 @@
+/*
+ * Time and coordinate basics for planning and tracking
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Low precision on purpose: the hand control only points to a few
+ * arcminutes, so UT stands in for TT and there is no nutation.
+ */
+
+#include <math.h>
+
+#include "astro.h"
+
+double astro_jd(double unix_time)
+{
+	return unix_time / 86400.0 + 2440587.5;
+}
+
+double astro_unix(double jd)
+{
+	return (jd - 2440587.5) * 86400.0;
+}
+
+/* into [0, 2pi) */
+double astro_wrap(double a)
+{
+	a = fmod(a, 2*M_PI);
+	return (a < 0) ? a + 2*M_PI : a;
+}
+
+/* Greenwich mean sidereal time, IAU 1982 */
+double astro_gmst(double jd)
+{
+	double d = jd - ASTRO_J2000, t = d / 36525;
+
+	return astro_wrap(DEG2RAD(280.46061837 + 360.98564736629*d + t*t*(0.000387933 - t/38710000)));
+}
+
+/* apparent Sun, good to about 0.01 degree (Astronomical Almanac) */
+void astro_sun(double jd, double *ra, double *dec)
+{
+	double n = jd - ASTRO_J2000, l, g, lambda, eps;
+
+	l = DEG2RAD(280.460 + 0.9856474*n);
+	g = DEG2RAD(357.528 + 0.9856003*n);
+	lambda = l + DEG2RAD(1.915*sin(g) + 0.020*sin(2*g));
+	eps = DEG2RAD(23.439 - 0.0000004*n);
+	*ra = astro_wrap(atan2(cos(eps)*sin(lambda), cos(lambda)));
+	*dec = asin(sin(eps)*sin(lambda));
+}
+
+/* azimuth from north through east */
+void astro_altaz(double lst, double lat, double ra, double dec, double *alt, double *az)
+{
+	double h = lst - ra;
+
+	*alt = asin(sin(lat)*sin(dec) + cos(lat)*cos(dec)*cos(h));
+	*az = astro_wrap(atan2(-cos(dec)*sin(h), sin(dec)*cos(lat) - cos(dec)*sin(lat)*cos(h)));
+}
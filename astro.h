@@ -0,0 +1,25 @@
+/*
+ * Time and coordinate basics for planning and tracking
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef ASTRO_H
+#define ASTRO_H
+
+#define	ASTRO_J2000		2451545.0	/* JD of 2000 Jan 1.5 TT */
+#define	ASTRO_SIDEREAL	1.00273790935	/* sidereal days per solar day */
+#define	DEG2RAD(x)		((x) * (M_PI / 180))
+#define	RAD2DEG(x)		((x) * (180 / M_PI))
+
+/* angles in radians, times as Julian dates (UT) unless said otherwise */
+double	astro_jd(double unix_time);
+double	astro_unix(double jd);
+double	astro_gmst(double jd);
+double	astro_wrap(double a);
+void	astro_sun(double jd, double *ra, double *dec);
+void	astro_altaz(double lst, double lat, double ra, double dec, double *alt, double *az);
+
+#endif /* ASTRO_H */
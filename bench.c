@@ -0,0 +1,238 @@
+/*
+ * Microbenchmarks for scope-control codec paths
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Each benchmark is warmed up, then timed as a number of samples, each
+ * sample being a batch of calls sized to take roughly SAMPLE_NS.
+ * Results are written to stdout as JSON; per-op times are reported as
+ * median, min and median absolute deviation over the samples, which
+ * stay stable where a mean would be dragged about by the odd preemption.
+ */
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "angle.h"
+#include "frame.h"
+
+#define	WARMUP_NS	200000000LL	/* 200ms of warmup per benchmark */
+#define	SAMPLE_NS	10000000LL	/* aim for 10ms per sample */
+#define	SAMPLES		31
+
+/* results land here so the compiler cannot drop the work */
+volatile unsigned long sink;
+
+static char *positions[] = {
+	"12h30m00s +45d30m15.5s",
+	"05h55m10.3052s +07d24m25.426s",
+	"-01h02m03.456789s -89d59m59.999s",
+	"23h59m59.999s +00d00m00s",
+};
+#define	NPOSITIONS	(sizeof(positions)/sizeof(char *))
+
+static char *replies[] = {
+	"12AB0500,40000000#",
+	"85555555,DFA431A8#",
+	"FFFFFF00,80000100#",
+	"00000000,C0000000#",
+};
+#define	NREPLIES	(sizeof(replies)/sizeof(char *))
+
+static char *short_replies[] = {
+	"12AB,4000#",
+	"8555,DFA4#",
+};
+
+long long now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * benchmark bodies: run the operation n times
+ */
+
+void b_convert2angle(long n)
+{
+	long i;
+	int err;
+	long usec;
+
+	for(i = 0; i < n; i++)
+		sink += convert2angle(positions[i%NPOSITIONS], NULL, NULL, NULL, &usec, &err);
+}
+
+void b_convert2position(long n)
+{
+	long i;
+	angle_t a1, a2;
+
+	for(i = 0; i < n; i++) {
+		convert2position(positions[i%NPOSITIONS], ANGLE_HOUR, &a1, &a2);
+		sink += a1 ^ a2;
+	}
+}
+
+void b_convert2hhmmss(long n)
+{
+	long i;
+	char buf[32];
+
+	for(i = 0; i < n; i++) {
+		convert2hhmmss(buf, (angle_t)(i*0x9E3779B9UL), i&1, i&2);
+		sink += buf[5];
+	}
+}
+
+void b_decode_precise(long n)
+{
+	long i;
+	angle_t ab[2];
+
+	for(i = 0; i < n; i++)
+		sink += decode(replies[i%NREPLIES], (i&1) ? 'e' : 'z', ab)[3] + ab[0];
+}
+
+void b_decode(long n)
+{
+	long i;
+	angle_t ab[2];
+
+	for(i = 0; i < n; i++)
+		sink += decode(short_replies[i&1], (i&2) ? 'E' : 'Z', ab)[3] + ab[0];
+}
+
+void b_hex2angle(long n)
+{
+	long i;
+
+	for(i = 0; i < n; i++)
+		sink += hex2angle(replies[i%NREPLIES], 8);
+}
+
+void b_gotoposition_precise(long n)
+{
+	long i;
+	angle_t a1, a2;
+	char buf[32];
+
+	for(i = 0; i < n; i++) {
+		convert2position(positions[i%NPOSITIONS], ANGLE_HOUR, &a1, &a2);
+		sink += position_frame(buf, 'r', a1, a2) + buf[3];
+	}
+}
+
+void b_gotoposition(long n)
+{
+	long i;
+	angle_t a1, a2;
+	char buf[32];
+
+	for(i = 0; i < n; i++) {
+		convert2position(positions[i%NPOSITIONS], ANGLE_HOUR, &a1, &a2);
+		sink += position_frame(buf, 'R', a1, a2) + buf[3];
+	}
+}
+
+void b_sync_frame(long n)
+{
+	long i;
+	char buf[32];
+
+	for(i = 0; i < n; i++)
+		sink += position_frame(buf, 's', (angle_t)(i*0x9E3779B9UL), (angle_t)i) + buf[3];
+}
+
+void b_slew_frame(long n)
+{
+	long i;
+	char buf[8];
+
+	for(i = 0; i < n; i++)
+		sink += slew_frame(buf, i&1, (i>>1)&1, (int)(i%2001) - 1000) + buf[5];
+}
+
+struct bench {
+	char	*name;
+	void	(*fn)(long);
+} benches[] = {
+	{"convert2angle",			b_convert2angle},
+	{"convert2position",		b_convert2position},
+	{"convert2hhmmss",			b_convert2hhmmss},
+	{"decode_precise",			b_decode_precise},
+	{"decode",					b_decode},
+	{"hex2angle",				b_hex2angle},
+	{"gotoposition_precise",	b_gotoposition_precise},
+	{"gotoposition",			b_gotoposition},
+	{"sync_frame",				b_sync_frame},
+	{"slew_frame",				b_slew_frame},
+	{NULL,						NULL}
+};
+
+int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Warm up, pick a batch size that fills SAMPLE_NS, then time SAMPLES
+ * batches and report median/min/MAD in nanoseconds per call.
+ */
+void run_bench(struct bench *bp, int first)
+{
+	double t[SAMPLES], dev[SAMPLES], median, mad;
+	long long start;
+	long batch = 1;
+	int i;
+
+	start = now_ns();
+	while( now_ns() - start < WARMUP_NS ) {
+		long long t0 = now_ns();
+		bp->fn(batch);
+		if( now_ns() - t0 < SAMPLE_NS )
+			batch *= 2;
+	}
+	for(i = 0; i < SAMPLES; i++) {
+		long long t0 = now_ns();
+		bp->fn(batch);
+		t[i] = (double)(now_ns() - t0) / batch;
+	}
+	qsort(t, SAMPLES, sizeof(double), cmp_double);
+	median = t[SAMPLES/2];
+	for(i = 0; i < SAMPLES; i++)
+		dev[i] = t[i] > median ? t[i] - median : median - t[i];
+	qsort(dev, SAMPLES, sizeof(double), cmp_double);
+	mad = dev[SAMPLES/2];
+	printf("%s\n\t\t{\"name\": \"%s\", \"batch\": %ld, \"samples\": %d, "
+		"\"ns_per_op\": {\"median\": %.3f, \"min\": %.3f, \"max\": %.3f, \"mad\": %.3f}, "
+		"\"ops_per_sec\": %.0f}",
+		first ? "" : ",", bp->name, batch, SAMPLES,
+		median, t[0], t[SAMPLES-1], mad, 1e9/median);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench *bp;
+	int first = 1;
+
+	printf("{\n\t\"benchmarks\": [");
+	for(bp = benches; bp->name != NULL; bp++) {
+		if( argc > 1 && strstr(bp->name, argv[1]) == NULL )
+			continue;
+		run_bench(bp, first);
+		first = 0;
+		fflush(stdout);
+	}
+	printf("\n\t]\n}\n");
+	return 0;
+}
@@ -0,0 +1,249 @@
+/*
+ * TCP bridge: share one hand control between many clients
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Clients speak the raw NexStar serial protocol over TCP, as they would
+ * to a SkyPortal/SkyWire style adapter. Each client's byte stream is cut
+ * into frames using the known command lengths in frame.c; complete
+ * frames are taken from clients in turn, one each, run on the serial
+ * link and the reply sent back to whoever asked. Clients waiting on
+ * the same read-only query share one transaction (see coalesce.c).
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "scope-control.h"
+#include "frame.h"
+#include "metrics.h"
+#include "coalesce.h"
+#include "bridge.h"
+
+#define	BRIDGE_CLIENTS	16		/* concurrent clients */
+#define	BRIDGE_BUF		64		/* per client input, a few frames */
+#define	METRICS_PERIOD	10		/* seconds between metrics dumps */
+
+struct client {
+	int		fd;					/* -1 when slot free */
+	int		len;				/* bytes in buf */
+	char	buf[BRIDGE_BUF];
+	char	peer[32];
+};
+
+static struct client clients[BRIDGE_CLIENTS];
+static volatile sig_atomic_t bridge_stop = 0;
+
+static void bridge_signal(int sig)
+{
+	bridge_stop = 1;
+}
+
+/*
+ * Listening TCP socket on "port" or "address:port"; address defaults
+ * to loopback. name prefixes any error. Also used by guide.c.
+ */
+int tcp_listen(char *name, char *arg)
+{
+	struct sockaddr_in sa;
+	char addr[64], *cp;
+	int fd, on = 1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if( (cp = strrchr(arg, ':')) != NULL ) {
+		snprintf(addr, sizeof(addr), "%.*s", (int)(cp - arg), arg);
+		if( inet_pton(AF_INET, addr, &sa.sin_addr) != 1 ) {
+			errlog(9, "%s bad address %s", name, addr);
+			return -1;
+		}
+		arg = cp + 1;
+	}
+	sa.sin_port = htons(atoi(arg));
+	if( (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ) {
+		errlog(9, "%s socket: %s", name, strerror(errno));
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if( bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, 8) < 0 ) {
+		errlog(9, "%s cannot listen on %s: %s", name, arg, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void client_accept(int lfd)
+{
+	struct sockaddr_in sa;
+	socklen_t sl = sizeof(sa);
+	int fd, i, on = 1;
+
+	if( (fd = accept(lfd, (struct sockaddr *)&sa, &sl)) < 0 )
+		return;
+	for(i = 0; i < BRIDGE_CLIENTS && clients[i].fd >= 0; i++)
+		;
+	if( i == BRIDGE_CLIENTS ) {
+		fprintf(errfile, "bridge full, refusing client\n");
+		close(fd);
+		return;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	clients[i].fd = fd;
+	clients[i].len = 0;
+	snprintf(clients[i].peer, sizeof(clients[i].peer), "%s:%d",
+		inet_ntoa(sa.sin_addr), ntohs(sa.sin_port));
+	fprintf(outfile, "bridge client %d connected from %s\n", i, clients[i].peer);
+	fflush(outfile);
+}
+
+static void client_close(int i, char *why)
+{
+	fprintf(outfile, "bridge client %d %s %s\n", i, clients[i].peer, why);
+	fflush(outfile);
+	close(clients[i].fd);
+	clients[i].fd = -1;
+	clients[i].len = 0;
+}
+
+/*
+ * Length of the complete frame at the head of a client's buffer,
+ * 0 if more bytes are needed. Bytes that cannot start a command are
+ * dropped here so one bad byte does not wedge the client.
+ */
+static int client_frame(struct client *cp)
+{
+	const struct frame_desc *fp;
+
+	for(;;) {
+		if( cp->len == 0 )
+			return 0;
+		if( (fp = frame_lookup(cp->buf[0])) != NULL )
+			break;
+		memmove(cp->buf, cp->buf + 1, --cp->len);
+	}
+	return (cp->len < fp->wlen) ? 0 : fp->wlen;
+}
+
+static void client_consume(struct client *cp, int wlen)
+{
+	cp->len -= wlen;
+	memmove(cp->buf, cp->buf + wlen, cp->len);
+}
+
+/*
+ * Run one frame on the serial link, reply to the client and drop the
+ * frame from its buffer. A shareable query also answers every other
+ * client waiting on the same query. A frame the hand control did not
+ * answer costs only its own client; the others go on being served.
+ */
+static void client_serve(int i, int wlen)
+{
+	struct client *cp = &clients[i];
+	char reply[260], cmd = cp->buf[0];
+	int rlen, l, j;
+
+	rlen = frame_reply_len(cp->buf);
+	if( wlen == 1 && coalesce_able(cmd) )
+		l = coalesce_query(cmd, reply, rlen, NULL);
+	else
+		l = dev_transact(cp->buf, wlen, reply, rlen);
+	client_consume(cp, wlen);
+	if( l != rlen ) {
+		/* the link has been resynced but the client may be out of step; make it reconnect */
+		client_close(i, "dropped, no reply from hand control");
+		return;
+	}
+	if( send(cp->fd, reply, rlen, MSG_NOSIGNAL) != rlen )
+		client_close(i, "dropped, send failed");
+	if( wlen != 1 || !coalesce_able(cmd) )
+		return;
+	for(j = 0; j < BRIDGE_CLIENTS; j++) {
+		if( j == i || clients[j].fd < 0 || clients[j].len == 0 || clients[j].buf[0] != cmd )
+			continue;
+		client_consume(&clients[j], 1);
+		metrics_coalesced(cmd, 1);
+		if( send(clients[j].fd, reply, rlen, MSG_NOSIGNAL) != rlen )
+			client_close(j, "dropped, send failed");
+	}
+}
+
+/*
+ * Serve clients until SIGINT/SIGTERM. arg is "[address:]port".
+ */
+void cmd_bridge(char *arg)
+{
+	struct pollfd pfd[BRIDGE_CLIENTS+1];
+	struct sigaction old[2];
+	time_t last_dump = time(NULL);
+	int lfd, i, n, l, next = 0, busy;
+
+	if( (lfd = tcp_listen("bridge", arg)) < 0 )
+		return;
+	for(i = 0; i < BRIDGE_CLIENTS; i++)
+		clients[i].fd = -1;
+	bridge_stop = 0;
+	catch_stop(bridge_signal, old);
+	fprintf(outfile, "bridge listening on %s\n", arg);
+	fflush(outfile);
+	while( !bridge_stop ) {
+		/* serve one frame per client per turn while any are waiting */
+		for(busy = 0, n = 0; n < BRIDGE_CLIENTS; n++) {
+			i = (next + n) % BRIDGE_CLIENTS;
+			if( clients[i].fd < 0 || (l = client_frame(&clients[i])) == 0 )
+				continue;
+			client_serve(i, l);
+			next = (i + 1) % BRIDGE_CLIENTS;
+			busy = 1;
+			break;
+		}
+		pfd[0].fd = lfd;
+		pfd[0].events = POLLIN;
+		for(i = 0; i < BRIDGE_CLIENTS; i++) {
+			pfd[i+1].fd = clients[i].fd;
+			pfd[i+1].events = (clients[i].len < BRIDGE_BUF) ? POLLIN : 0;
+		}
+		if( poll(pfd, BRIDGE_CLIENTS+1, busy ? 0 : 1000) < 0 ) {
+			if( errno == EINTR )
+				continue;
+			errlog(9, "bridge poll: %s", strerror(errno));
+			break;
+		}
+		if( pfd[0].revents & POLLIN )
+			client_accept(lfd);
+		for(i = 0; i < BRIDGE_CLIENTS; i++) {
+			if( clients[i].fd < 0 || pfd[i+1].revents == 0 || clients[i].len == BRIDGE_BUF )
+				continue;
+			l = recv(clients[i].fd, clients[i].buf + clients[i].len,
+					BRIDGE_BUF - clients[i].len, 0);
+			if( l <= 0 )
+				client_close(i, "disconnected");
+			else
+				clients[i].len += l;
+		}
+		if( metrics_file != NULL && time(NULL) - last_dump >= METRICS_PERIOD ) {
+			metrics_dump(metrics_file);
+			last_dump = time(NULL);
+		}
+	}
+	for(i = 0; i < BRIDGE_CLIENTS; i++)
+		if( clients[i].fd >= 0 )
+			client_close(i, "closed, bridge stopping");
+	close(lfd);
+	restore_stop(old);
+	fprintf(outfile, "bridge stopped\n");
+}
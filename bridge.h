@@ -0,0 +1,15 @@
+/*
+ * TCP bridge: share one hand control between many clients
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef BRIDGE_H
+#define BRIDGE_H
+
+int		tcp_listen(char *name, char *arg);
+void	cmd_bridge(char *arg);
+
+#endif /* BRIDGE_H */
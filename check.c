@@ -0,0 +1,330 @@
+/*
+ * Round trip checks for scope-control codecs
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * `make check' runs each codec over a set of edge values and CHECK_RANDOM
+ * pseudo random ones, comparing it with a plain sprintf/long double
+ * reference and with its own inverse, decodes site bytes from every
+ * longitude, and writes a telemetry log and reads it back. The first few mismatches of each check are printed;
+ * the exit status is 1 if there were any.
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "scope-control.h"
+#include "angle.h"
+#include "frame.h"
+#include "tlog.h"
+
+#define	CHECK_RANDOM	1000000
+#define	CHECK_SHOW		5		/* mismatches printed per check */
+#define	CHECK_TLOG		(3*TLOG_ROWS + 123)	/* rows per telemetry run */
+
+/* what tlog.c wants of scope-control.c */
+FILE	*outfile, *errfile;
+int		syserr;
+
+void errlog(int type, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	fprintf(stderr, "Fail type=%d ", type);
+	vfprintf(stderr, format, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	syserr = 1;
+}
+
+static angle_t edges[] = {
+	0, 1, 0x7FFF, 0x8000, 0xFFFF, 0x10000, 0x7FFFFFFF, 0x80000000U,
+	0x80000001U, 0xFFFF7FFFU, 0xFFFF8000U, 0xFFFFFFFFU,
+	0x15555555, 0x2AAAAAAB, 0x12AB0500, 0xDFA431A8U,
+};
+#define	NEDGES	(sizeof(edges)/sizeof(angle_t))
+
+static unsigned long long rng = 0x9E3779B97F4A7C15ULL;
+static long fails;
+
+static uint32_t next_random(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng >> 32;
+}
+
+/* the i'th value to check: the edges first, then random */
+static angle_t value(long i)
+{
+	return (i < NEDGES) ? edges[i] : next_random();
+}
+
+/* count a wrong answer, printing the first few */
+static void mismatch(long *bad, char *name, char *fmt, ...)
+{
+	va_list ap;
+
+	if( (*bad)++ < CHECK_SHOW ) {
+		printf("%s: ", name);
+		va_start(ap, fmt);
+		vprintf(fmt, ap);
+		va_end(ap);
+		printf("\n");
+	}
+}
+
+static void report(char *name, long n, long bad)
+{
+	printf("%-16s %8ld values, %ld wrong\n", name, n, bad);
+	fails += bad;
+}
+
+/* angle2hex against %X, and hex2angle back in either case */
+static void check_hex(void)
+{
+	char buf[16], ref[16];
+	long i, n = NEDGES + CHECK_RANDOM, bad = 0;
+	angle_t v, top;
+
+	for(i = 0; i < n; i++) {
+		v = value(i);
+		*angle2hex(buf, v, 8) = '\0';
+		sprintf(ref, "%08X", v);
+		if( strcmp(buf, ref) != 0 )
+			mismatch(&bad, "angle2hex", "%08X gave %s", v, buf);
+		if( hex2angle(ref, 8) != v )
+			mismatch(&bad, "hex2angle", "%s gave %08X", ref, hex2angle(ref, 8));
+		sprintf(ref, "%08x", v);
+		if( hex2angle(ref, 8) != v )
+			mismatch(&bad, "hex2angle", "%s gave %08X", ref, hex2angle(ref, 8));
+		/* 16 bits: nearest step, wrapping to 0000 at the top */
+		top = (((unsigned long long)v + 0x8000) >> 16) & 0xFFFF;
+		*angle2hex(buf, v, 4) = '\0';
+		sprintf(ref, "%04X", top);
+		if( strcmp(buf, ref) != 0 )
+			mismatch(&bad, "angle2hex", "%08X to 4 digits gave %s", v, buf);
+		if( hex2angle(ref, 4) != top << 16 )
+			mismatch(&bad, "hex2angle", "%s gave %08X", ref, hex2angle(ref, 4));
+	}
+	report("hex", n, bad);
+}
+
+/*
+ * convert2hhmmss against a long double reference, then convert2angle
+ * back to within half a millisecond.
+ */
+static void check_hhmmss(void)
+{
+	char buf[32], ref[32], *ticks[2] = { "dms", "hms" };
+	long i, n = NEDGES + CHECK_RANDOM, bad = 0;
+	long double circle;
+	long long ms, slack;
+	angle_t v, a, back;
+	int hour, sign, minus, err;
+
+	for(i = 0; i < 4*n; i++) {
+		v = value(i / 4);
+		hour = i & 1;
+		sign = (i & 2) != 0;
+		circle = hour ? 86400000.0L : 1296000000.0L;
+		minus = sign && v > 0x80000000U;
+		a = minus ? -v : v;
+		ms = llroundl(a * circle / 4294967296.0L);
+		if( ms == (long long)circle )
+			ms = 0;
+		sprintf(ref, "%c%03lld%c %02lld%c %02lld.%03lld%c", minus ? '-' : '+',
+			ms / 3600000, ticks[hour][0], ms / 60000 % 60, ticks[hour][1],
+			ms / 1000 % 60, ms % 1000, ticks[hour][2]);
+		convert2hhmmss(buf, v, hour, sign);
+		if( strcmp(buf, ref) != 0 ) {
+			mismatch(&bad, "convert2hhmmss", "%08X %s gave %s, not %s", v,
+				hour ? "hours" : "degrees", buf, ref);
+			continue;
+		}
+		back = convert2angle(buf, NULL, NULL, NULL, NULL, &err);
+		slack = (long long)(4294967296.0L / circle / 2) + 1;
+		if( err != 0 || llabs((int32_t)(back - v)) > slack )
+			mismatch(&bad, "convert2angle", "%s gave %08X, err %d, from %08X",
+				buf, back, err, v);
+	}
+	report("hhmmss", 4*n, bad);
+}
+
+/* convert2angle of random fields against the rounded exact value */
+static void check_convert2angle(void)
+{
+	char buf[64];
+	long i, n = CHECK_RANDOM, bad = 0, usec, rusec;
+	unsigned long long total, circle;
+	int dh, m, s, us, hour, minus, rdh, rmin, err;
+	angle_t a, ref;
+
+	for(i = 0; i < n; i++) {
+		hour = i & 1;
+		minus = (i & 2) != 0;
+		dh = next_random() % (hour ? 48 : 720);
+		m = next_random() % 60;
+		s = next_random() % 60;
+		us = next_random() % 1000000;
+		sprintf(buf, "%c%d%c %02dm %02d.%06ds", minus ? '-' : '+', dh, hour ? 'h' : 'd', m, s, us);
+		circle = hour ? 86400000000ULL : 1296000000000ULL;
+		total = ((unsigned long long)dh*3600 + m*60 + s)*1000000 + us;
+		ref = (angle_t)((((unsigned __int128)(total % circle) << 32) + circle/2) / circle);
+		if( minus )
+			ref = -ref;
+		a = convert2angle(buf, NULL, &rdh, &rmin, &rusec, &err);
+		usec = (s*1000000L + us) * (minus ? -1 : 1);
+		if( err != 0 || a != ref || rdh != (minus ? -dh : dh) || rmin != (minus ? -m : m) || rusec != usec )
+			mismatch(&bad, "convert2angle", "%s gave %08X %d %d %ld, err %d, not %08X",
+				buf, a, rdh, rmin, rusec, err, ref);
+	}
+	report("convert2angle", n, bad);
+}
+
+/*
+ * Every site as --setlocation puts it in a 'W' frame, read back by
+ * location_decode() as the 'w' reply carrying the same bytes; whole
+ * degrees to 180 of longitude, so the bytes past 127 are covered.
+ */
+static void check_location(void)
+{
+	unsigned char v[8];
+	char frame[16];
+	long n = 0, bad = 0;
+	double lat, lon, want_lat, want_lon;
+	int d, m, s;
+
+	for(d = 0; d <= 180; d++) {
+		m = next_random() % 60;
+		s = next_random() % 60;
+		v[0] = d % 91;
+		v[1] = s;
+		v[2] = m;
+		v[3] = d & 1;
+		v[4] = d;
+		v[5] = m;
+		v[6] = s;
+		v[7] = (d >> 1) & 1;
+		settings_frame(frame, 'W', v);
+		location_decode(frame + 1, &lat, &lon);
+		want_lat = (v[0] + s/60.0 + m/3600.0) * (v[3] ? -1 : 1);
+		want_lon = (d + m/60.0 + s/3600.0) * (v[7] ? -1 : 1);
+		if( fabs(lat - want_lat) > 1e-9 || fabs(lon - want_lon) > 1e-9 )
+			mismatch(&bad, "location", "%dd %02dm %02ds %c gave %.6f, not %.6f",
+				d, m, s, v[7] ? 'W' : 'E', lon, want_lon);
+		n++;
+	}
+	report("location", n, bad);
+}
+
+/*
+ * A reply as the hand control would send it for tlog_reply(), and the
+ * row it should come back as.
+ */
+static int tlog_sample(char *reply, struct tlog_row *r)
+{
+	static char kinds[] = "eEzZtLJVwh";
+	int i, len, digits;
+
+	r->kind = kinds[next_random() % (sizeof(kinds) - 1)];
+	r->a = next_random();
+	r->b = next_random();
+	if( strchr("eEzZ", r->kind) != NULL ) {
+		digits = (r->kind == 'e' || r->kind == 'z') ? 8 : 4;
+		if( digits == 4 ) {
+			r->a &= 0xFFFF0000;
+			r->b &= 0xFFFF0000;
+		}
+		angle2hex(reply, r->a, digits);
+		reply[digits] = ',';
+		angle2hex(reply + digits + 1, r->b, digits);
+		len = 2*digits + 2;
+	} else {
+		/* 't', 'L' and 'J' answer one byte, 'V' two, 'w' and 'h' eight */
+		len = strchr("tLJ", r->kind) ? 2 : r->kind == 'V' ? 3 : 9;
+		if( len <= 5 )
+			r->b = 0;
+		r->a &= 0xFFFFFFFFU << (len <= 5 ? 8*(5 - len) : 0);
+		for(i = 0; i < len - 1; i++)
+			reply[i] = (i < 4 ? r->a >> (24 - 8*i) : r->b >> (56 - 8*i)) & 0xFF;
+	}
+	reply[len - 1] = '#';
+	return len;
+}
+
+/*
+ * Write CHECK_TLOG rows, append as many again in a second run, and see
+ * that tlog_load() gives back every row of both.
+ */
+static void check_tlog(void)
+{
+	struct tlog_row *want, *got;
+	struct timespec stamp;
+	char path[64], reply[32];
+	long i, n = 2*CHECK_TLOG, bad = 0;
+	int64_t t = 1445000000LL * 1000000;
+	int fd, len;
+
+	snprintf(path, sizeof(path), "/tmp/scope-check-XXXXXX");
+	if( (fd = mkstemp(path)) < 0 || (want = malloc(n * sizeof(*want))) == NULL ) {
+		mismatch(&bad, "tlog", "cannot make a scratch file");
+		report("tlog", 0, bad);
+		return;
+	}
+	close(fd);
+	for(i = 0; i < n; i++) {
+		if( (i == 0 || i == CHECK_TLOG) && tlog_open(path) < 0 )
+			break;
+		/* a few ms apart, now and then a little backwards */
+		t += (long)(next_random() % 20000) - 1000;
+		want[i].t = t;
+		stamp.tv_sec = t / 1000000;
+		stamp.tv_nsec = t % 1000000 * 1000;
+		len = tlog_sample(reply, &want[i]);
+		tlog_reply(want[i].kind, &stamp, reply, len);
+		if( i == CHECK_TLOG - 1 || i == n - 1 )
+			tlog_close();
+	}
+	if( i < n || syserr ) {
+		mismatch(&bad, "tlog", "writing %s failed", path);
+	} else if( (i = tlog_load(path, &got)) != n ) {
+		mismatch(&bad, "tlog", "%s gave %ld rows, not %ld", path, i, n);
+	} else {
+		for(i = 0; i < n; i++)
+			if( got[i].t != want[i].t || got[i].kind != want[i].kind ||
+					got[i].a != want[i].a || got[i].b != want[i].b )
+				mismatch(&bad, "tlog", "row %ld %lld %c %08X %08X came back as %lld %c %08X %08X",
+					i, (long long)want[i].t, want[i].kind, want[i].a, want[i].b,
+					(long long)got[i].t, got[i].kind, got[i].a, got[i].b);
+		free(got);
+	}
+	unlink(path);
+	free(want);
+	report("tlog", n, bad);
+}
+
+int main(int argc, char **argv)
+{
+	outfile = stdout;
+	errfile = stderr;
+	check_hex();
+	check_hhmmss();
+	check_convert2angle();
+	check_location();
+	check_tlog();
+	if( fails ) {
+		printf("%ld checks failed\n", fails);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
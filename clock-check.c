@@ -22,6 +22,10 @@
 #include <ctype.h>
 #include <libgen.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <netdb.h>
+
+#include "rt.h"
 
 #define	VERSION			((00<<16)|(95<<8)|(1))
 #define	VERSION_MAJOR	((VERSION>>16)&0xFF)
@@ -33,16 +37,34 @@
 #define	DEV_OPEN	0
 #define	DEV_CLOSE	1
 
+/* commands */
+#define	OPT_DEVICE		0x8002
+#define	OPT_GETTIME		0x8007
+#define	OPT_SETTIME		0x8008
+#define	OPT_MEASURE		0x8101
+#define	OPT_MONITOR		0x8102
+#define	OPT_INTERVAL	0x8103
+#define	OPT_THRESHOLD	0x8104
 /* non-celestron commands */
 #define	OPT_HELP		0x7000
 #define	OPT_VERSION		0x7001
 #define	OPT_COPYRIGHT	0x7002
+#define	OPT_REALTIME	0x7006
+
+/* monitor defaults */
+#define	MON_INTERVAL	60.0	/* seconds between samples, on average */
+#define	MON_THRESHOLD	2.0		/* seconds of predicted error before resync */
+#define	MON_MINSAMPLES	10		/* samples before the drift is trusted */
+#define	LINK_DELAY		0.010	/* 9 bytes at 9600 baud, 'H' in flight */
 
 
 char	*devname = "/dev/ttyUSB0";
 int		devfd;
 int		devstatus = -1;
+int		devsocket = 0;
 int		syserr = 0;
+double	mon_interval = MON_INTERVAL;
+double	mon_threshold = MON_THRESHOLD;
 struct termios termios_new, termios_original;
 
 /* standard file descriptors */
@@ -55,6 +77,14 @@ struct option long_options[] = {
 		{"version", no_argument, 0, OPT_VERSION},
 		{"copyright", no_argument, 0, OPT_COPYRIGHT},
 		{"help", no_argument, 0, OPT_HELP},
+		{"realtime", optional_argument, 0, OPT_REALTIME},
+		{"device",	required_argument,	0,	OPT_DEVICE},
+		{"gettime",		no_argument,	0,	OPT_GETTIME},
+		{"settime",		required_argument, 0,	OPT_SETTIME},
+		{"measure",		no_argument,	0,	OPT_MEASURE},
+		{"monitor",		no_argument,	0,	OPT_MONITOR},
+		{"interval",	required_argument,	0,	OPT_INTERVAL},
+		{"threshold",	required_argument,	0,	OPT_THRESHOLD},
 		{0,			0,					0,	0}
 };
 
@@ -107,12 +137,46 @@ void errlog(int type, const char *format, ...)
 	syserr = 1;
 }
 
+/*
+ * "host:port" is a scope-control --bridge; going through it lets the
+ * monitor share the hand control with whatever else is talking to it.
+ */
+int dev_connect(char *name)
+{
+	struct addrinfo hints, *ai;
+	char host[256], *cp;
+
+	cp = strrchr(name, ':');
+	snprintf(host, sizeof(host), "%.*s", (int)(cp - name), name);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if( getaddrinfo(host, cp + 1, &hints, &ai) != 0 ) {
+		errlog(0, "bridge %s not found", name);
+		return -1;
+	}
+	if( (devfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0 ||
+			connect(devfd, ai->ai_addr, ai->ai_addrlen) < 0 ) {
+		errlog(0, "bridge %s connect failed: %s", name, strerror(errno));
+		if( devfd >= 0 )
+			close(devfd);
+		freeaddrinfo(ai);
+		return -1;
+	}
+	freeaddrinfo(ai);
+	devsocket = 1;
+	devstatus = 0;
+	return 0;
+}
+
 int dev_control(int cmd, char *serial_device)
 {
 
 	if( cmd == DEV_OPEN ) {
 		if( devstatus != -1 )
 			return -1;
+		if( serial_device[0] != '/' && strchr(serial_device, ':') != NULL )
+			return dev_connect(serial_device);
 		if( (devfd = open(serial_device, O_RDWR|O_NOCTTY)) < 0 ) {
 			devstatus = -1;
 			errlog(0, "serial port open %s failed\n", serial_device);
@@ -146,7 +210,7 @@ int dev_control(int cmd, char *serial_device)
 	if( cmd == DEV_CLOSE ) {
 		if ( devstatus == -1 )
 			return -1;
-		if( tcsetattr(devfd, TCSAFLUSH, &termios_original) < 0) {
+		if( !devsocket && tcsetattr(devfd, TCSAFLUSH, &termios_original) < 0) {
 			/* don't care */
 		}
 		close(devfd);
@@ -164,13 +228,14 @@ int dev_write(const void *bufp, size_t len)
 
 int dev_read(void *bufp, size_t rlen)
 {
-	int l, len = 0, tlen=rlen;
+	int l, len = 0;
 
-	while((l = read(devfd, &((char*)bufp)[len], rlen)) != rlen) {
-		rlen -= l;
+	while( len < rlen ) {
+		if( (l = read(devfd, &((char*)bufp)[len], rlen - len)) <= 0 )
+			break;
 		len += l;
 	}
-	return tlen;
+	return len;
 }
 
 int read_clock(char *buf)
@@ -252,21 +317,180 @@ void cmd_settime(char *str)
 	fprintf(outfile, "cmd_settime set time/date %s\n", buf[0] == '#' ? "successfully" : "error");
 }
 
-int measure_clock()
+double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec/1e6;
+}
+
+/*
+ * Hand control time as seconds since the epoch (UTC). The clock keeps
+ * local time plus its GMT offset and summer time flag.
+ */
+double clock2time(char *buf)
 {
-	struct timeval t1, t2;
 	struct tm tm;
-	unsigned long diff;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_hour = buf[0];
+	tm.tm_min = buf[1];
+	tm.tm_sec = buf[2];
+	tm.tm_mon = buf[3] - 1;
+	tm.tm_mday = buf[4];
+	tm.tm_year = buf[5] + 100;
+	return (double)timegm(&tm) - ((signed char)buf[6] + buf[7])*3600.0;
+}
+
+/*
+ * One sample of the hand control clock.
+ * *when gets host time of the middle of the transaction, *offset the
+ * hand control clock minus host clock. The hand control only counts
+ * whole seconds, so half a second is added to centre the estimate; with
+ * samples at random phase the error averages out.
+ * Returns 1 on success, 0 on failure.
+ */
+int measure_clock(double *when, double *offset)
+{
+	double t1, t2;
 	char buf[9];
 	
-	if( gettimeofday(&t1, NULL) == 0 )
-		return 0;
-	if( read_clock(buf) == 0 )
+	t1 = now();
+	if( read_clock(buf) == 0 || buf[8] != '#' )
 		return 0;
-	if( gettimeofday(&t2, NULL) == 0 )
+	t2 = now();
+	*when = (t1 + t2)/2;
+	*offset = clock2time(buf) + 0.5 - *when;
+	return 1;
+}
+
+void cmd_measure()
+{
+	double when, offset;
+
+	if( measure_clock(&when, &offset) == 0 ) {
+		errlog(2, "measure_clock failed");
+		return;
+	}
+	fprintf(outfile, "clock offset %+.1fs (+/-0.5s)\n", offset);
+}
+
+/*
+ * Set the hand control to host time, sent so that it lands just as the
+ * host clock ticks over to the second it carries.
+ */
+int set_clock()
+{
+	extern long timezone;
+	struct tm *tm;
+	time_t t;
+	double wait;
+	char buf[9];
+
+	wait = ceil(now() + LINK_DELAY) - LINK_DELAY - now();
+	rt_sleep(wait*1e9);
+	t = (time_t)(now() + LINK_DELAY + 0.5);
+	tm = localtime(&t);
+	buf[0] = 'H';
+	buf[1] = tm->tm_hour;
+	buf[2] = tm->tm_min;
+	buf[3] = tm->tm_sec;
+	buf[4] = tm->tm_mon + 1;
+	buf[5] = tm->tm_mday;
+	buf[6] = tm->tm_year % 100;
+	buf[7] = -(timezone / 3600);
+	buf[8] = tm->tm_isdst > 0;
+	if( dev_write(buf, 9) != 9 || dev_read(buf, 1) != 1 || buf[0] != '#' )
 		return 0;
-	diff = ((t2.tv_sec%86400)*1000000 + t2.tv_usec) -
-				((t1.tv_sec%86400)*1000000 + t1.tv_usec);
+	return 1;
+}
+
+/*
+ * Running least squares line through (time, offset) samples, O(1) per
+ * sample. Centred sums (Welford) so decades of epoch seconds do not
+ * swamp the fit.
+ */
+struct drift {
+	long	n;
+	double	mx, my;		/* means */
+	double	sxx, sxy;	/* centred sums */
+};
+
+void drift_add(struct drift *d, double x, double y)
+{
+	double dx = x - d->mx;
+
+	d->n++;
+	d->mx += dx / d->n;
+	d->my += (y - d->my) / d->n;
+	d->sxx += dx * (x - d->mx);
+	d->sxy += dx * (y - d->my);
+}
+
+/* seconds gained per second */
+double drift_rate(struct drift *d)
+{
+	return (d->n > 1 && d->sxx > 0) ? d->sxy / d->sxx : 0.0;
+}
+
+double drift_predict(struct drift *d, double x)
+{
+	return d->my + drift_rate(d) * (x - d->mx);
+}
+
+/*
+ * Sample the clock every interval seconds (randomised by +/-50% to
+ * spread sample phase), log the fitted drift, and set the clock when
+ * the predicted error passes the threshold. Each sample is one 'h'
+ * transaction, so position traffic, direct or through a bridge, is
+ * never held up for longer than that.
+ */
+void cmd_monitor()
+{
+	struct drift d;
+	double when, offset, predicted, rate = 0.0, set_at = 0.0;
+	int resyncs = 0;
+
+	memset(&d, 0, sizeof(d));
+	srand(getpid() ^ time(NULL));
+	fprintf(outfile, "clock monitor interval %gs threshold %gs\n",
+		mon_interval, mon_threshold);
+	for(;;) {
+		if( measure_clock(&when, &offset) == 0 ) {
+			errlog(2, "clock monitor lost contact");
+			return;
+		}
+		drift_add(&d, when, offset);
+		if( d.n >= MON_MINSAMPLES )
+			rate = drift_rate(&d);
+		/*
+		 * Until the fit settles a single sample is only good to 0.5s.
+		 * After a resync the last slope carries on from the setting,
+		 * kept within that 0.5s of what was read.
+		 */
+		if( d.n >= MON_MINSAMPLES )
+			predicted = drift_predict(&d, when);
+		else if( resyncs > 0 )
+			predicted = fmin(fmax(rate * (when - set_at), offset - 0.5), offset + 0.5);
+		else
+			predicted = (offset > 0) ? fmax(offset - 0.5, 0) : fmin(offset + 0.5, 0);
+		fprintf(outfile, "%.0f offset %+.1fs predicted %+.3fs drift %+.2fppm %+.2fs/day n=%ld resyncs %d\n",
+			when, offset, predicted, rate*1e6, rate*86400, d.n, resyncs);
+		if( fabs(predicted) > mon_threshold ) {
+			if( set_clock() == 0 ) {
+				errlog(4, "clock monitor settime failed");
+				return;
+			}
+			resyncs++;
+			set_at = now();
+			fprintf(outfile, "%.0f clock set after %+.3fs error\n", set_at, predicted);
+			/* the line restarts; the last slope predicts until it settles */
+			memset(&d, 0, sizeof(d));
+		}
+		fflush(outfile);
+		usleep(mon_interval * (0.5 + (double)rand()/RAND_MAX) * 1e6);
+	}
 }
 
 
@@ -296,6 +520,39 @@ int main(int argc, char **argv)
 		case OPT_COPYRIGHT:
 			copyright(outfile);
 			break;
+		case OPT_REALTIME:
+			rt_enable(outfile, optarg);
+			break;
+		case OPT_DEVICE:
+			devname = optarg;
+			fprintf(outfile, "Communicating over port %s\n", devname);
+			dev_control(DEV_OPEN, devname);
+			break;
+		case OPT_GETTIME:
+			cmd_gettime();
+			break;
+		case OPT_SETTIME:
+			cmd_settime(optarg);
+			break;
+		case OPT_MEASURE:
+			cmd_measure();
+			break;
+		case OPT_INTERVAL:
+			mon_interval = atof(optarg);
+			break;
+		case OPT_THRESHOLD:
+			mon_threshold = atof(optarg);
+			break;
+		case OPT_MONITOR:
+			cmd_monitor();
+			break;
+		}
+		if( syserr != 0 ) {
+			dev_control(DEV_CLOSE, NULL);
+			rt_report(outfile);
+			exit(-1);
 		}
 	}
+	rt_report(outfile);
+	return dev_control(DEV_CLOSE, NULL);
 }
@@ -0,0 +1,99 @@
+/*
+ * Sharing of identical read-only queries
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Single byte queries with no side effects ('e', 'z', 'L', 't', ...)
+ * keep their last good reply. Asking again inside coalesce_window gets
+ * that reply, with the same timestamp, and costs no serial traffic.
+ * Anything sent that is not such a query may move the mount, so it
+ * throws the lot away (dev_write() sees to that).
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "scope-control.h"
+#include "frame.h"
+#include "metrics.h"
+#include "coalesce.h"
+
+struct coalesce_entry {
+	int				len;		/* 0 when empty */
+	uint64_t		mono_us;	/* when it was read, monotonic */
+	struct timespec	stamp;		/* middle of the transaction, wall clock */
+	char			reply[20];
+};
+
+long coalesce_window = 0;
+
+static struct coalesce_entry cache[128];
+
+static uint64_t mono_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+/* 1 if cmd is a single byte query whose reply may be shared */
+int coalesce_able(int cmd)
+{
+	const struct frame_desc *fp;
+
+	return (fp = frame_lookup(cmd)) != NULL && (fp->flags & FRAME_READ) &&
+			fp->wlen == 1 && fp->rlen <= sizeof(cache[0].reply);
+}
+
+void coalesce_invalidate()
+{
+	int i;
+
+	for(i = 0; i < 128; i++)
+		cache[i].len = 0;
+}
+
+/*
+ * Send single byte query cmd and read rlen bytes into buf, or hand back
+ * the cached reply if it is fresh enough. stamp, if not NULL, gets the
+ * wall clock time of the reply. A garbled reply is retried by
+ * dev_transact() and never cached.
+ * Returns rlen, -1 on failure.
+ */
+int coalesce_query(char cmd, char *buf, int rlen, struct timespec *stamp)
+{
+	struct coalesce_entry *ce = &cache[cmd & 127];
+	struct timespec t0, t1;
+	uint64_t now = mono_us();
+	long long ns;
+	int l;
+
+	if( coalesce_window > 0 && ce->len == rlen && now - ce->mono_us < coalesce_window ) {
+		memcpy(buf, ce->reply, rlen);
+		if( stamp )
+			*stamp = ce->stamp;
+		metrics_coalesced(cmd, 1);
+		return rlen;
+	}
+	clock_gettime(CLOCK_REALTIME, &t0);
+	if( (l = dev_transact(&cmd, 1, buf, rlen)) < 0 )
+		return -1;
+	clock_gettime(CLOCK_REALTIME, &t1);
+	/* the mount answered somewhere in between; call it the middle */
+	ns = ((long long)(t0.tv_sec + t1.tv_sec)*1000000000 + t0.tv_nsec + t1.tv_nsec)/2;
+	t1.tv_sec = ns / 1000000000;
+	t1.tv_nsec = ns % 1000000000;
+	ce->len = 0;
+	if( l != rlen || buf[rlen-1] != '#' || !coalesce_able(cmd) )
+		return l;
+	memcpy(ce->reply, buf, rlen);
+	ce->len = rlen;
+	ce->mono_us = now;
+	ce->stamp = t1;
+	if( stamp )
+		*stamp = t1;
+	return l;
+}
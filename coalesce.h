@@ -0,0 +1,20 @@
+/*
+ * Sharing of identical read-only queries
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <time.h>
+
+extern long coalesce_window;	/* microseconds a reply stays fresh, 0 = off */
+
+int		coalesce_able(int cmd);
+int		coalesce_query(char cmd, char *buf, int rlen, struct timespec *stamp);
+void	coalesce_invalidate();
+
+#endif /* COALESCE_H */
@@ -0,0 +1,109 @@
+/*
+ * Serial link cost model and dry runs
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * A transaction holds the link for its bytes both ways at FRAME_BAUD
+ * plus the time the hand control takes to answer. That second part is
+ * FRAME_TURNAROUND unless the --metrics-file left by an earlier run has
+ * latencies for the command; then it is the mean latency less the wire
+ * time. With --dry-run, --poll and --run-sequence print what they would
+ * cost and send nothing; main() refuses the other options that would
+ * use the hand control and dev_write() sends nothing at all.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "scope-control.h"
+#include "frame.h"
+#include "metrics.h"
+#include "cost.h"
+
+int		dry_run = 0;
+
+/* per command: measured latency sum (us) and count from the metrics file */
+static double lat_sum[128], lat_count[128];
+static int loaded = 0;
+
+/* "e" or "0x05" as metrics.c writes them */
+static int cost_label(char *label)
+{
+	if( strncmp(label, "0x", 2) == 0 )
+		return strtol(label + 2, NULL, 16) & 127;
+	return label[0] & 127;
+}
+
+static void cost_load(void)
+{
+	char line[256], label[16];
+	double v;
+	FILE *f;
+
+	loaded = 1;
+	if( metrics_file == NULL || (f = fopen(metrics_file, "r")) == NULL )
+		return;
+	while( fgets(line, sizeof(line), f) != NULL ) {
+		if( sscanf(line, "scope_control_command_latency_seconds_sum{cmd=\"%15[^\"]\"} %lf", label, &v) == 2 )
+			lat_sum[cost_label(label)] = v * 1e6;
+		else if( sscanf(line, "scope_control_command_latency_seconds_count{cmd=\"%15[^\"]\"} %lf", label, &v) == 2 )
+			lat_count[cost_label(label)] = v;
+	}
+	fclose(f);
+}
+
+/* bytes both ways for a complete frame, at FRAME_BAUD */
+long cost_wire_us(const char *frame)
+{
+	const struct frame_desc *fp = frame_lookup(frame[0]);
+
+	if( fp == NULL )
+		return 0;
+	return (fp->wlen + frame_reply_len(frame)) * 10 * 1000000L / FRAME_BAUD;
+}
+
+/*
+ * Microseconds the hand control takes to answer frame. *measured, if
+ * not NULL, is set to the number of samples behind it, 0 for the
+ * typical FRAME_TURNAROUND.
+ */
+long cost_answer_us(const char *frame, long *measured)
+{
+	int cmd = frame[0] & 127;
+	double us;
+
+	if( !loaded )
+		cost_load();
+	if( measured != NULL )
+		*measured = lat_count[cmd];
+	if( lat_count[cmd] == 0 )
+		return FRAME_TURNAROUND;
+	us = lat_sum[cmd] / lat_count[cmd] - cost_wire_us(frame);
+	return (us > 0) ? us : 0;
+}
+
+/* whole transaction, microseconds */
+long cost_us(const char *frame)
+{
+	return cost_wire_us(frame) + cost_answer_us(frame, NULL);
+}
+
+/* one line of a dry run report for frame */
+void cost_print(const char *frame, double hz)
+{
+	long wire = cost_wire_us(frame), answer, n, total;
+
+	answer = cost_answer_us(frame, &n);
+	total = wire + answer;
+	fprintf(outfile, "  %c  wire %6.2fms  answer %6.2fms (%s",
+		frame[0], wire / 1e3, answer / 1e3, n ? "measured, " : "typical");
+	if( n )
+		fprintf(outfile, "%ld samples", n);
+	fprintf(outfile, ")  %6.2fms", total / 1e3);
+	if( hz > 0 )
+		fprintf(outfile, "  at %.2fHz load %5.1f%%", hz, hz * total / 1e4);
+	fprintf(outfile, "  alone at most %.1f/s\n", 1e6 / total);
+}
@@ -0,0 +1,19 @@
+/*
+ * Serial link cost model and dry runs
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef COST_H
+#define COST_H
+
+extern int	dry_run;		/* report costs, send nothing */
+
+long	cost_wire_us(const char *frame);
+long	cost_answer_us(const char *frame, long *measured);
+long	cost_us(const char *frame);
+void	cost_print(const char *frame, double hz);
+
+#endif /* COST_H */
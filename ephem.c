@@ -0,0 +1,575 @@
+/*
+ * Solar system positions
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Positions are topocentric right ascension and declination on the
+ * J2000 equator, the frame catalogs and target lists are in. The Moon
+ * is Meeus' truncation of ELP-2000/82 (Astronomical Algorithms ch. 47)
+ * cut at about 7", the Sun the Astronomical Almanac's low precision
+ * series. The planets are Keplerian orbits from Standish's approximate
+ * elements with secular rates (JPL, 1800-2050), good to about an
+ * arcminute, in place of a VSOP87 series: past that the hand control
+ * cannot point anyway. Comets and minor planets are two body orbits.
+ * Planets and minor bodies get one light time iteration. What tracking
+ * needs from all of them is the rate, which is far better than that.
+ *
+ * ephem_batch() does many bodies at many epochs in one call: what only
+ * depends on the epoch (Earth, sidereal time, the site) is worked out
+ * once per epoch, then the bodies are shared out between threads.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <math.h>
+
+#include "scope-control.h"
+#include "astro.h"
+#include "plan.h"
+#include "trace.h"
+#include "ephem.h"
+
+#define	EARTH_RADIUS	6378.14			/* km */
+#define	AU_KM			149597870.7
+#define	LIGHT_DAYS		0.0057755183	/* light time for one AU, days */
+#define	OBLIQUITY_J2000	23.4392911		/* degrees */
+#define	GAUSS_K			0.01720209895	/* radians/day */
+#define	EPHEM_THREADS	64
+#define	EPHEM_CHUNK		256			/* least body-epochs worth a thread */
+#define	EPHEM_MAXEPOCHS	1000000
+
+/*
+ * Standish, Keplerian elements for the approximate positions of the
+ * major planets, table 1: a (AU), e, I, L, long. perihelion, long. node
+ * (degrees) at J2000 and their rates per century. Earth is the
+ * Earth-Moon barycentre.
+ */
+static const struct planet {
+	char	*name;
+	double	el[6], rate[6];
+} planets[] = {
+	{ "Mercury",	{ 0.38709927, 0.20563593, 7.00497902, 252.25032350, 77.45779628, 48.33076593 },
+					{ 0.00000037, 0.00001906, -0.00594749, 149472.67411175, 0.16047689, -0.12534081 } },
+	{ "Venus",		{ 0.72333566, 0.00677672, 3.39467605, 181.97909950, 131.60246718, 76.67984255 },
+					{ 0.00000390, -0.00004107, -0.00078890, 58517.81538729, 0.00268329, -0.27769418 } },
+	{ "Earth",		{ 1.00000261, 0.01671123, -0.00001531, 100.46457166, 102.93768193, 0.0 },
+					{ 0.00000562, -0.00004392, -0.01294668, 35999.37244981, 0.32327364, 0.0 } },
+	{ "Mars",		{ 1.52371034, 0.09339410, 1.84969142, -4.55343205, -23.94362959, 49.55953891 },
+					{ 0.00001847, 0.00007882, -0.00813131, 19140.30268499, 0.44441088, -0.29257343 } },
+	{ "Jupiter",	{ 5.20288700, 0.04838624, 1.30439695, 34.39644051, 14.72847983, 100.47390909 },
+					{ -0.00011607, -0.00013253, -0.00183714, 3034.74612775, 0.21252668, 0.20469106 } },
+	{ "Saturn",		{ 9.53667594, 0.05386179, 2.48599187, 49.95424423, 92.59887831, 113.66242448 },
+					{ -0.00125060, -0.00050991, 0.00193609, 1222.49362201, -0.41897216, -0.28867794 } },
+	{ "Uranus",		{ 19.18916464, 0.04725744, 0.77263783, 313.23810451, 170.95427630, 74.01692503 },
+					{ -0.00196176, -0.00004397, -0.00242939, 428.48202785, 0.40805281, 0.04240589 } },
+	{ "Neptune",	{ 30.06992276, 0.00859048, 1.77004347, -55.12002969, 44.96476227, 131.78422574 },
+					{ 0.00026291, 0.00005105, 0.00035372, 218.45945325, -0.32241464, -0.01262724 } },
+};
+#define	EARTH		2
+
+/* what every body at one epoch shares */
+struct epoch {
+	double	jd;
+	double	earth[3];		/* heliocentric, AU */
+	double	obs[3];			/* site from the geocentre, km */
+};
+
+struct batch {
+	const struct ephem_body *bodies;
+	int		nb, nt;
+	struct epoch *ep;
+	double	*ra, *dec;
+};
+
+struct batch_work {
+	pthread_t	tid;
+	struct batch *bp;
+	long		lo, hi;		/* body-major index range */
+};
+
+/* Meeus table 47.A: D M M' F, longitude 1e-6 degrees, distance 1e-3 km */
+static const struct { signed char d, m, mp, f; int l, r; } moon_lr[] = {
+	{ 0, 0, 1, 0, 6288774, -20905355 },	{ 2, 0,-1, 0, 1274027, -3699111 },
+	{ 2, 0, 0, 0,  658314,  -2955968 },	{ 0, 0, 2, 0,  213618,  -569925 },
+	{ 0, 1, 0, 0, -185116,     48888 },	{ 0, 0, 0, 2, -114332,    -3149 },
+	{ 2, 0,-2, 0,   58793,    246158 },	{ 2,-1,-1, 0,   57066,  -152138 },
+	{ 2, 0, 1, 0,   53322,   -170733 },	{ 2,-1, 0, 0,   45758,  -204586 },
+	{ 0, 1,-1, 0,  -40923,   -129620 },	{ 1, 0, 0, 0,  -34720,   108743 },
+	{ 0, 1, 1, 0,  -30383,    104755 },	{ 2, 0, 0,-2,   15327,    10321 },
+	{ 0, 0, 1, 2,  -12528,         0 },	{ 0, 0, 1,-2,   10980,    79661 },
+	{ 4, 0,-1, 0,   10675,    -34782 },	{ 0, 0, 3, 0,   10034,   -23210 },
+	{ 4, 0,-2, 0,    8548,    -21636 },	{ 2, 1,-1, 0,   -7888,    24208 },
+	{ 2, 1, 0, 0,   -6766,     30824 },	{ 1, 0,-1, 0,   -5163,    -8379 },
+	{ 1, 1, 0, 0,    4987,    -16675 },	{ 2,-1, 1, 0,    4036,   -12831 },
+	{ 2, 0, 2, 0,    3994,    -10445 },	{ 4, 0, 0, 0,    3861,   -11650 },
+	{ 2, 0,-3, 0,    3665,     14403 },	{ 0, 1,-2, 0,   -2689,    -7003 },
+	{ 2, 0,-1, 2,   -2602,         0 },	{ 2,-1,-2, 0,    2390,    10056 },
+	{ 1, 0, 1, 0,   -2348,      6322 },	{ 2,-2, 0, 0,    2236,    -9884 },
+};
+
+/* Meeus table 47.B: D M M' F, latitude 1e-6 degrees */
+static const struct { signed char d, m, mp, f; int b; } moon_b[] = {
+	{ 0, 0, 0, 1, 5128122 },	{ 0, 0, 1, 1,  280602 },	{ 0, 0, 1,-1,  277693 },
+	{ 2, 0, 0,-1,  173237 },	{ 2, 0,-1, 1,   55413 },	{ 2, 0,-1,-1,   46271 },
+	{ 2, 0, 0, 1,   32573 },	{ 0, 0, 2, 1,   17198 },	{ 2, 0, 1,-1,    9266 },
+	{ 0, 0, 2,-1,    8822 },	{ 2,-1, 0,-1,    8216 },	{ 2, 0,-2,-1,    4324 },
+	{ 2, 0, 1, 1,    4200 },	{ 2, 1, 0,-1,   -3359 },	{ 2,-1,-1, 1,    2463 },
+	{ 2,-1, 0, 1,    2211 },	{ 2,-1,-1,-1,    2065 },	{ 0, 1,-1,-1,   -1870 },
+	{ 4, 0,-1,-1,    1828 },	{ 0, 1, 0, 1,   -1794 },	{ 0, 0, 0, 3,   -1749 },
+	{ 0, 1,-1, 1,   -1565 },	{ 1, 0, 0, 1,   -1491 },	{ 0, 1, 1, 1,   -1475 },
+	{ 0, 1, 1,-1,   -1410 },	{ 0, 1, 0,-1,   -1344 },	{ 1, 0, 0,-1,   -1335 },
+	{ 0, 0, 3, 1,    1107 },	{ 4, 0, 0,-1,    1021 },	{ 4, 0,-1, 1,     833 },
+};
+
+#define	NELEM(a)	(sizeof(a)/sizeof(a[0]))
+
+/* ecliptic of date to J2000, general precession in longitude only */
+static double precess_lon(double lambda, double t)
+{
+	return lambda - DEG2RAD(1.396971*t + 0.0003086*t*t);
+}
+
+/* ecliptic (J2000) spherical to equatorial rectangular */
+static void ecl2equ(double lambda, double beta, double r, double *v)
+{
+	double eps = DEG2RAD(OBLIQUITY_J2000);
+	double x = r*cos(beta)*cos(lambda), y = r*cos(beta)*sin(lambda), z = r*sin(beta);
+
+	v[0] = x;
+	v[1] = y*cos(eps) - z*sin(eps);
+	v[2] = y*sin(eps) + z*cos(eps);
+}
+
+/* geocentric Moon, equatorial J2000, km */
+static void moon_vector(double jd, double *v)
+{
+	double t = (jd - ASTRO_J2000) / 36525, lp, d, m, mp, f, a1, a2, a3, e, arg, el, sl = 0, sr = 0, sb = 0;
+	int i;
+
+	lp = DEG2RAD(218.3164477 + 481267.88123421*t - 0.0015786*t*t + t*t*t/538841);
+	d  = DEG2RAD(297.8501921 + 445267.1114034*t - 0.0018819*t*t + t*t*t/545868);
+	m  = DEG2RAD(357.5291092 + 35999.0502909*t - 0.0001536*t*t);
+	mp = DEG2RAD(134.9633964 + 477198.8675055*t + 0.0087414*t*t + t*t*t/69699);
+	f  = DEG2RAD(93.2720950 + 483202.0175233*t - 0.0036539*t*t);
+	a1 = DEG2RAD(119.75 + 131.849*t);
+	a2 = DEG2RAD(53.09 + 479264.290*t);
+	a3 = DEG2RAD(313.45 + 481266.484*t);
+	e = 1 - 0.002516*t - 0.0000074*t*t;
+	for(i = 0; i < NELEM(moon_lr); i++) {
+		arg = moon_lr[i].d*d + moon_lr[i].m*m + moon_lr[i].mp*mp + moon_lr[i].f*f;
+		el = (moon_lr[i].m == 0) ? 1 : (abs(moon_lr[i].m) == 1) ? e : e*e;
+		sl += el * moon_lr[i].l * sin(arg);
+		sr += el * moon_lr[i].r * cos(arg);
+	}
+	for(i = 0; i < NELEM(moon_b); i++) {
+		arg = moon_b[i].d*d + moon_b[i].m*m + moon_b[i].mp*mp + moon_b[i].f*f;
+		el = (moon_b[i].m == 0) ? 1 : (abs(moon_b[i].m) == 1) ? e : e*e;
+		sb += el * moon_b[i].b * sin(arg);
+	}
+	sl += 3958*sin(a1) + 1962*sin(lp - f) + 318*sin(a2);
+	sb += -2235*sin(lp) + 382*sin(a3) + 175*sin(a1 - f) + 175*sin(a1 + f) + 127*sin(lp - mp) - 115*sin(lp + mp);
+	ecl2equ(precess_lon(lp + DEG2RAD(sl / 1e6), t), DEG2RAD(sb / 1e6), 385000.56 + sr / 1000, v);
+}
+
+/* geocentric Sun, equatorial J2000, AU */
+static void sun_vector(double jd, double *v)
+{
+	double n = jd - ASTRO_J2000, l, g, lambda, r;
+
+	l = DEG2RAD(280.460 + 0.9856474*n);
+	g = DEG2RAD(357.528 + 0.9856003*n);
+	lambda = l + DEG2RAD(1.915*sin(g) + 0.020*sin(2*g));
+	r = 1.00014 - 0.01671*cos(g) - 0.00014*cos(2*g);
+	ecl2equ(precess_lon(lambda, n / 36525), 0, r, v);
+}
+
+/* heliocentric two body position, equatorial J2000, AU */
+static void orbit_vector(const struct ephem_body *bp, double jd, double *v)
+{
+	double dt = jd - bp->tp, q = bp->q, e = bp->e, nu, r, x, px, py, a, mm, ee, w, s;
+	double cn = cos(DEG2RAD(bp->node)), sn = sin(DEG2RAD(bp->node));
+	double ci = cos(DEG2RAD(bp->i)), si = sin(DEG2RAD(bp->i));
+	double cw = cos(DEG2RAD(bp->peri)), sw = sin(DEG2RAD(bp->peri)), eps = DEG2RAD(OBLIQUITY_J2000);
+	int k;
+
+	if( fabs(e - 1) < 1e-6 ) {
+		/* parabola: Barker's equation */
+		w = 3 * GAUSS_K * dt / (sqrt(2) * q * sqrt(q));
+		s = cbrt(w/2 + sqrt(w*w/4 + 1)) - cbrt(-(w/2) + sqrt(w*w/4 + 1));
+		nu = 2 * atan(s);
+		r = q * (1 + s*s);
+	} else if( e < 1 ) {
+		a = q / (1 - e);
+		mm = GAUSS_K * dt / (a * sqrt(a));
+		mm = remainder(mm, 2*M_PI);
+		for(ee = (e > 0.8) ? M_PI * (mm < 0 ? -1 : 1) : mm, k = 0; k < 50; k++) {
+			x = (ee - e*sin(ee) - mm) / (1 - e*cos(ee));
+			ee -= x;
+			if( fabs(x) < 1e-12 )
+				break;
+		}
+		nu = 2 * atan2(sqrt(1 + e) * sin(ee/2), sqrt(1 - e) * cos(ee/2));
+		r = a * (1 - e*cos(ee));
+	} else {
+		a = q / (e - 1);
+		mm = GAUSS_K * dt / (a * sqrt(a));
+		for(ee = asinh(mm / e), k = 0; k < 50; k++) {
+			x = (e*sinh(ee) - ee - mm) / (e*cosh(ee) - 1);
+			ee -= x;
+			if( fabs(x) < 1e-12 )
+				break;
+		}
+		nu = 2 * atan(sqrt((e + 1) / (e - 1)) * tanh(ee/2));
+		r = a * (e*cosh(ee) - 1);
+	}
+	/* orbital plane to ecliptic to equator */
+	px = r * cos(nu);
+	py = r * sin(nu);
+	x = px*(cw*cn - sw*sn*ci) - py*(sw*cn + cw*sn*ci);
+	a = px*(cw*sn + sw*cn*ci) - py*(sw*sn - cw*cn*ci);
+	s = px*sw*si + py*cw*si;
+	v[0] = x;
+	v[1] = a*cos(eps) - s*sin(eps);
+	v[2] = a*sin(eps) + s*cos(eps);
+}
+
+/* a planet's elements at jd, as perihelion distance and time */
+static void planet_body(int p, double jd, struct ephem_body *bp)
+{
+	const struct planet *pp = &planets[p];
+	double t = (jd - ASTRO_J2000) / 36525, el[6], m;
+	int i;
+
+	for(i = 0; i < 6; i++)
+		el[i] = pp->el[i] + pp->rate[i]*t;
+	bp->kind = EPHEM_ELEMENTS;
+	bp->e = el[1];
+	bp->q = el[0] * (1 - el[1]);
+	bp->i = el[2];
+	bp->node = el[5];
+	bp->peri = el[4] - el[5];
+	m = remainder(DEG2RAD(el[3] - el[4]), 2*M_PI);
+	bp->tp = jd - m / (GAUSS_K / (el[0] * sqrt(el[0])));
+}
+
+/*
+ * "sun", "moon", a planet by name or "name:q,e,i,node,peri,tp" with perihelion distance
+ * in AU, angles in degrees (J2000 ecliptic) and the perihelion as a JD.
+ * Returns -1 if the spec makes no sense (logged).
+ */
+int ephem_parse(char *spec, struct ephem_body *bp)
+{
+	char *cp;
+	int i;
+
+	memset(bp, 0, sizeof(*bp));
+	if( strcmp(spec, "sun") == 0 || strcmp(spec, "Sun") == 0 ) {
+		bp->kind = EPHEM_SUN;
+		strcpy(bp->name, "Sun");
+		return 0;
+	}
+	if( strcmp(spec, "moon") == 0 || strcmp(spec, "Moon") == 0 ) {
+		bp->kind = EPHEM_MOON;
+		strcpy(bp->name, "Moon");
+		return 0;
+	}
+	for(i = 0; i < NELEM(planets); i++)
+		if( i != EARTH && strcasecmp(spec, planets[i].name) == 0 ) {
+			bp->kind = EPHEM_PLANET;
+			bp->planet = i;
+			strcpy(bp->name, planets[i].name);
+			return 0;
+		}
+	if( (cp = strchr(spec, ':')) == NULL ||
+			sscanf(cp + 1, "%lf,%lf,%lf,%lf,%lf,%lf", &bp->q, &bp->e, &bp->i, &bp->node, &bp->peri, &bp->tp) != 6 ||
+			bp->q <= 0 || bp->e < 0 || bp->tp < 2000000 ) {
+		errlog(19, "unknown body `%s', want sun, moon, a planet or name:q,e,i,node,peri,tp", spec);
+		return -1;
+	}
+	bp->kind = EPHEM_ELEMENTS;
+	snprintf(bp->name, sizeof(bp->name), "%.*s", (int)(cp - spec), spec);
+	return 0;
+}
+
+static void epoch_setup(struct epoch *ep, double jd, double lat, double lon)
+{
+	struct ephem_body earth;
+	double lst = astro_gmst(jd) + DEG2RAD(lon);
+
+	ep->jd = jd;
+	planet_body(EARTH, jd, &earth);
+	orbit_vector(&earth, jd, ep->earth);
+	ep->obs[0] = EARTH_RADIUS * cos(DEG2RAD(lat)) * cos(lst);
+	ep->obs[1] = EARTH_RADIUS * cos(DEG2RAD(lat)) * sin(lst);
+	ep->obs[2] = EARTH_RADIUS * sin(DEG2RAD(lat));
+}
+
+/* one body at one epoch */
+static void body_position(const struct ephem_body *bp, const struct epoch *ep, double *ra, double *dec)
+{
+	struct ephem_body pb;
+	const struct ephem_body *ob = bp;
+	double v[3], scale;
+	int i;
+
+	switch(bp->kind) {
+	case EPHEM_MOON:
+		moon_vector(ep->jd, v);
+		scale = 1;
+		break;
+	case EPHEM_SUN:
+		sun_vector(ep->jd, v);
+		scale = 1 / AU_KM;
+		break;
+	default:
+		/* from Earth, where the body was when the light left */
+		if( bp->kind == EPHEM_PLANET ) {
+			planet_body(bp->planet, ep->jd, &pb);
+			ob = &pb;
+		}
+		orbit_vector(ob, ep->jd, v);
+		for(i = 0; i < 3; i++)
+			v[i] -= ep->earth[i];
+		orbit_vector(ob, ep->jd - LIGHT_DAYS * sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]), v);
+		for(i = 0; i < 3; i++)
+			v[i] -= ep->earth[i];
+		scale = 1 / AU_KM;
+		break;
+	}
+	/* from the site rather than the centre of the Earth; matters for the Moon */
+	for(i = 0; i < 3; i++)
+		v[i] -= ep->obs[i] * scale;
+	*ra = astro_wrap(atan2(v[1], v[0]));
+	*dec = atan2(v[2], sqrt(v[0]*v[0] + v[1]*v[1]));
+}
+
+static void *batch_worker(void *arg)
+{
+	struct batch_work *wp = arg;
+	struct batch *bp = wp->bp;
+	long long t0 = TRACE_BEGIN();
+	long k;
+
+	for(k = wp->lo; k < wp->hi; k++)
+		body_position(&bp->bodies[k / bp->nt], &bp->ep[k % bp->nt], &bp->ra[k], &bp->dec[k]);
+	TRACE_END("ephemeris worker", -1, t0);
+	return NULL;
+}
+
+/*
+ * Topocentric RA/Dec (radians, J2000) of nb bodies at nt JDs for a site
+ * in degrees; body b at epoch t lands in ra[b*nt + t], dec[b*nt + t].
+ * Returns 0, -1 on failure (logged).
+ */
+int ephem_batch(const struct ephem_body *bodies, int nb, const double *jd, int nt,
+	double lat, double lon, double *ra, double *dec)
+{
+	struct batch_work work[EPHEM_THREADS];
+	struct batch b;
+	long total = (long)nb * nt;
+	int i, nthreads, ret = 0;
+
+	if( (b.ep = malloc(nt * sizeof(struct epoch))) == NULL ) {
+		errlog(19, "ephemeris out of memory");
+		return -1;
+	}
+	for(i = 0; i < nt; i++)
+		epoch_setup(&b.ep[i], jd[i], lat, lon);
+	b.bodies = bodies;
+	b.nb = nb;
+	b.nt = nt;
+	b.ra = ra;
+	b.dec = dec;
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if( nthreads > EPHEM_THREADS )
+		nthreads = EPHEM_THREADS;
+	if( nthreads > (total + EPHEM_CHUNK - 1) / EPHEM_CHUNK )
+		nthreads = (total + EPHEM_CHUNK - 1) / EPHEM_CHUNK;
+	if( nthreads < 1 )
+		nthreads = 1;
+	for(i = 0; i < nthreads; i++) {
+		work[i].bp = &b;
+		work[i].lo = total * i / nthreads;
+		work[i].hi = total * (i + 1) / nthreads;
+		if( i > 0 && pthread_create(&work[i].tid, NULL, batch_worker, &work[i]) != 0 ) {
+			errlog(19, "ephemeris cannot start thread");
+			nthreads = i;
+			ret = -1;
+			break;
+		}
+	}
+	if( ret == 0 )
+		batch_worker(&work[0]);
+	for(i = 1; i < nthreads; i++)
+		pthread_join(work[i].tid, NULL);
+	free(b.ep);
+	return ret;
+}
+
+/*
+ * One body at one JD; see ephem_batch().
+ */
+void ephem_position(const struct ephem_body *bp, double jd, double lat, double lon, double *ra, double *dec)
+{
+	struct epoch ep;
+
+	epoch_setup(&ep, jd, lat, lon);
+	body_position(bp, &ep, ra, dec);
+}
+
+static angle_t rad2angle(double a)
+{
+	return (angle_t)(int64_t)llround(a * (ANGLE_FULL / (2*M_PI)));
+}
+
+/* "planets" is the Sun, Moon and planets; returns count or -1 */
+static int parse_bodies(char *list, struct ephem_body **bpp)
+{
+	struct ephem_body *b;
+	char *cp, *next;
+	int n = 0, i, k = 0, l;
+
+	/* one body a name; each "planets" is the Sun, the Moon and all but the Earth */
+	for(cp = list; ; cp += l + 1) {
+		l = strcspn(cp, "+");
+		n += (l == 7 && strncmp(cp, "planets", 7) == 0) ? NELEM(planets) + 1 : 1;
+		if( cp[l] == '\0' )
+			break;
+	}
+	if( (b = malloc(n * sizeof(*b))) == NULL ) {
+		errlog(19, "ephemeris out of memory");
+		return -1;
+	}
+	for(cp = list; cp != NULL; cp = next) {
+		if( (next = strchr(cp, '+')) != NULL )
+			*next++ = '\0';
+		if( strcmp(cp, "planets") == 0 ) {
+			ephem_parse("sun", &b[k++]);
+			ephem_parse("moon", &b[k++]);
+			for(i = 0; i < NELEM(planets); i++)
+				if( i != EARTH )
+					ephem_parse(planets[i].name, &b[k++]);
+		} else if( ephem_parse(cp, &b[k++]) < 0 ) {
+			free(b);
+			return -1;
+		}
+	}
+	*bpp = b;
+	return k;
+}
+
+/* "now", a JD, or yyyy-mm-dd[Thh:mm[:ss]] UTC; returns a JD or 0 */
+static double parse_epoch(char *s)
+{
+	struct tm tm;
+	double jd;
+	int f;
+
+	if( strcmp(s, "now") == 0 ) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return astro_jd(ts.tv_sec + ts.tv_nsec/1e9);
+	}
+	if( strchr(s, '-') == NULL )
+		return (sscanf(s, "%lf", &jd) == 1 && jd > 0) ? jd : 0;
+	memset(&tm, 0, sizeof(tm));
+	f = sscanf(s, "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+	if( f < 3 || f == 4 )
+		return 0;
+	tm.tm_year -= 1900;
+	tm.tm_mon--;
+	return astro_jd(timegm(&tm));
+}
+
+/*
+ * --ephemeris body[+body...][@start[,step_seconds[,count]]]
+ */
+void cmd_ephemeris(char *arg)
+{
+	struct ephem_body *b;
+	struct timespec c0, c1;
+	struct tm tm;
+	char spec[1024], *cp, when[32], b1[32], b2[32];
+	double start, step = 3600, lat, lon, *jd = NULL, *ra = NULL, *dec = NULL;
+	long count = 1, i;
+	time_t tt;
+	int nb, k;
+
+	snprintf(spec, sizeof(spec), "%s", arg);
+	start = parse_epoch("now");
+	if( (cp = strchr(spec, '@')) != NULL ) {
+		char first[64];
+
+		*cp++ = '\0';
+		first[0] = '\0';
+		sscanf(cp, "%63[^,],%lf,%ld", first, &step, &count);
+		if( (start = parse_epoch(first)) == 0 || count < 1 || count > EPHEM_MAXEPOCHS ) {
+			errlog(19, "ephemeris wants @start[,step[,count]], not `%s'", cp);
+			return;
+		}
+	}
+	if( site_location(&lat, &lon) < 0 || (nb = parse_bodies(spec, &b)) < 0 )
+		return;
+	jd = malloc(count * sizeof(double));
+	ra = malloc(nb * count * sizeof(double));
+	dec = malloc(nb * count * sizeof(double));
+	if( jd == NULL || ra == NULL || dec == NULL ) {
+		errlog(19, "ephemeris out of memory");
+		goto done;
+	}
+	for(i = 0; i < count; i++)
+		jd[i] = start + i * step / 86400;
+	clock_gettime(CLOCK_MONOTONIC, &c0);
+	if( ephem_batch(b, nb, jd, count, lat, lon, ra, dec) < 0 )
+		goto done;
+	clock_gettime(CLOCK_MONOTONIC, &c1);
+	for(i = 0; i < count; i++) {
+		tt = (time_t)floor(astro_unix(jd[i]) + 0.5);
+		gmtime_r(&tt, &tm);
+		strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &tm);
+		for(k = 0; k < nb; k++) {
+			convert2hhmmss(b1, rad2angle(ra[k*count + i]), ANGLE_HOUR, 0);
+			convert2hhmmss(b2, rad2angle(dec[k*count + i]), ANGLE_DEG, 1);
+			fprintf(outfile, "%s %-10s %s %s\n", when, b[k].name, b1, b2);
+		}
+	}
+	fprintf(outfile, "# %d bodies x %ld epochs in %.3fms\n", nb, count,
+		(c1.tv_sec - c0.tv_sec)*1e3 + (c1.tv_nsec - c0.tv_nsec)/1e6);
+done:
+	free(dec);
+	free(ra);
+	free(jd);
+	free(b);
+}
+
+/*
+ * --goto-body body: precise goto to where it is now
+ */
+void cmd_gotobody(char *arg)
+{
+	struct ephem_body body;
+	angle_t target[2];
+	char b1[32], b2[32];
+	double lat, lon, ra, dec;
+
+	if( ephem_parse(arg, &body) < 0 || site_location(&lat, &lon) < 0 )
+		return;
+	ephem_position(&body, parse_epoch("now"), lat, lon, &ra, &dec);
+	target[0] = rad2angle(ra);
+	target[1] = rad2angle(dec);
+	convert2hhmmss(b1, target[0], ANGLE_HOUR, 0);
+	convert2hhmmss(b2, target[1], ANGLE_DEG, 1);
+	fprintf(outfile, "goto-body %s at %s %s ", body.name, b1, b2);
+	if( do_goto("goto-body", 'r', target, 0, NULL) < 0 )
+		fprintf(outfile, "fail\n");
+	else
+		fprintf(outfile, "success\n");
+}
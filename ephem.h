@@ -0,0 +1,36 @@
+/*
+ * Solar system positions
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef EPHEM_H
+#define EPHEM_H
+
+#define	EPHEM_SUN		0
+#define	EPHEM_MOON		1
+#define	EPHEM_ELEMENTS	2		/* comet or minor planet */
+#define	EPHEM_PLANET	3
+
+struct ephem_body {
+	int		kind;
+	int		planet;			/* EPHEM_PLANET, index into ephem.c's table */
+	char	name[32];
+	/* EPHEM_ELEMENTS, J2000 ecliptic; angles in degrees */
+	double	q;				/* perihelion distance, AU */
+	double	e;
+	double	i, node, peri;
+	double	tp;				/* JD of perihelion */
+};
+
+int		ephem_parse(char *spec, struct ephem_body *bp);
+void	ephem_position(const struct ephem_body *bp, double jd, double lat, double lon,
+			double *ra, double *dec);
+int		ephem_batch(const struct ephem_body *bodies, int nb, const double *jd, int nt,
+			double lat, double lon, double *ra, double *dec);
+void	cmd_ephemeris(char *arg);
+void	cmd_gotobody(char *arg);
+
+#endif /* EPHEM_H */
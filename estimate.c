@@ -0,0 +1,283 @@
+/*
+ * Position estimator between serial samples
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * A two state Kalman filter per axis: position, and the velocity error
+ * on top of what the mount was told to do. The commanded rate (slews,
+ * plus the sidereal drift of RA when tracking is off) drives the
+ * prediction, so a slew start or stop is followed at once instead of
+ * being learned from the samples; for a few seconds after each change
+ * the process noise is raised to cover the mount's acceleration ramp.
+ * Slew rates are taken to move the matching coordinate the same way in
+ * both coordinate pairs, which is exact for the pair the mount drives
+ * and good enough for the filter to correct in the other.
+ *
+ * Filter state lives in the poller; everything else goes through the
+ * mapped --estimate-file, so commands from other scope-control runs
+ * reach the filter and any process can read position at any instant.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+#include "scope-control.h"
+#include "rt.h"
+#include "estimate.h"
+
+#define	ARCSEC			(1296000.0 / ANGLE_FULL)	/* arcseconds per angle unit */
+#define	EST_SIDEREAL	15.041		/* arcseconds/second the sky turns */
+#define	EST_NOISE		1.0			/* precise sample noise, arcseconds */
+#define	EST_NOISE16		5.7			/* 16 bit sample: step/sqrt(12) */
+#define	EST_ACCEL		5.0			/* unmodelled acceleration, arcseconds/second^2 */
+#define	EST_SLEWACCEL	3600.0		/* while a commanded change settles */
+#define	EST_SETTLE		3.0			/* seconds */
+#define	EST_STALE		60.0		/* restart a filter after this long without samples */
+
+char	*estimate_file = NULL;
+
+/* hand control fixed slew rates 1-9, arcseconds/second, approximate */
+static const double fixed_rates[10] = {
+	0, 30, 60, 120, 240, 480, 1080, 3600, 7200, 10800
+};
+
+struct kf {
+	int		init;
+	angle_t	ref;		/* position is ref + p */
+	double	p, b;		/* arcseconds, arcseconds/second */
+	double	P[2][2];
+	double	t;			/* realtime of the state */
+	double	u;			/* commanded rate in effect at t */
+};
+
+static struct kf filters[2][2];		/* [coordinate pair][axis] */
+static struct est_shared *shared = NULL;
+
+static double realtime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* map the estimate file, creating it on first use; NULL when not asked for */
+static struct est_shared *estimate_map()
+{
+	struct est_shared *sp;
+	struct stat st;
+	int fd;
+
+	if( shared != NULL || estimate_file == NULL )
+		return shared;
+	if( (fd = open(estimate_file, O_RDWR|O_CREAT, 0644)) < 0 || fstat(fd, &st) < 0 ||
+			(st.st_size < sizeof(*sp) && ftruncate(fd, sizeof(*sp)) < 0) ) {
+		errlog(14, "cannot open estimate file %s: %s", estimate_file, strerror(errno));
+		estimate_file = NULL;
+		if( fd >= 0 )
+			close(fd);
+		return NULL;
+	}
+	sp = mmap(NULL, sizeof(*sp), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if( sp == MAP_FAILED ) {
+		errlog(14, "cannot map estimate file %s", estimate_file);
+		estimate_file = NULL;
+		return NULL;
+	}
+	if( sp->magic != EST_MAGIC ) {
+		memset(sp, 0, sizeof(*sp));
+		sp->tracking = -1;
+		sp->magic = EST_MAGIC;
+	}
+	return shared = sp;
+}
+
+static void seq_begin(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void seq_end(uint32_t *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/* a slew was commanded: fv, rate as for slew_frame() */
+void estimate_command(int axis, int fv, double rate)
+{
+	struct est_shared *sp;
+
+	if( (sp = estimate_map()) == NULL || axis < 0 || axis > 1 )
+		return;
+	seq_begin(&sp->cmd_seq);
+	if( fv )
+		sp->cmd_rate[axis] = rate;
+	else
+		sp->cmd_rate[axis] = (rate < 0 ? -1 : 1) * fixed_rates[abs((int)rate) % 10];
+	sp->cmd_time = realtime();
+	seq_end(&sp->cmd_seq);
+}
+
+void estimate_tracking(int mode)
+{
+	struct est_shared *sp;
+
+	if( (sp = estimate_map()) == NULL || sp->tracking == mode )
+		return;
+	seq_begin(&sp->cmd_seq);
+	sp->tracking = mode;
+	sp->cmd_time = realtime();
+	seq_end(&sp->cmd_seq);
+}
+
+/* the commanded rate of one coordinate */
+static double commanded(struct est_shared *cs, int pair, int axis)
+{
+	double u = cs->cmd_rate[axis];
+
+	if( pair == EST_RADEC && axis == 0 && cs->tracking == 0 )
+		u += EST_SIDEREAL;
+	return u;
+}
+
+static void kf_step(struct kf *f, struct est_shared *cs, int pair, int axis,
+	double t, angle_t meas, double r)
+{
+	double u = commanded(cs, pair, axis), dt, tc, q, y, s, k0, k1, P00, P01, P11;
+	int32_t shift;
+
+	if( !f->init || t - f->t > EST_STALE || t < f->t ) {
+		f->init = 1;
+		f->ref = meas;
+		f->p = f->b = 0;
+		f->P[0][0] = r*r;
+		f->P[0][1] = f->P[1][0] = 0;
+		f->P[1][1] = 100*100;
+		f->t = t;
+		f->u = u;
+		return;
+	}
+	/* predict, switching commanded rate at the moment it changed */
+	dt = t - f->t;
+	tc = (cs->cmd_time < f->t) ? f->t : (cs->cmd_time > t) ? t : cs->cmd_time;
+	f->p += f->u * (tc - f->t) + u * (t - tc) + f->b * dt;
+	q = (t - cs->cmd_time < EST_SETTLE) ? EST_SLEWACCEL : EST_ACCEL;
+	q *= q;
+	P00 = f->P[0][0] + dt*(2*f->P[0][1] + dt*f->P[1][1]) + q*dt*dt*dt/3;
+	P01 = f->P[0][1] + dt*f->P[1][1] + q*dt*dt/2;
+	P11 = f->P[1][1] + q*dt;
+	/* update */
+	y = (int32_t)(meas - f->ref) * ARCSEC - f->p;
+	s = P00 + r*r;
+	k0 = P00 / s;
+	k1 = P01 / s;
+	f->p += k0 * y;
+	f->b += k1 * y;
+	f->P[0][0] = (1 - k0) * P00;
+	f->P[0][1] = f->P[1][0] = (1 - k0) * P01;
+	f->P[1][1] = P11 - k1 * P01;
+	/* keep p small so the double never loses the fine bits */
+	shift = (int32_t)floor(f->p / ARCSEC + 0.5);
+	f->ref += shift;
+	f->p -= shift * ARCSEC;
+	f->t = t;
+	f->u = u;
+}
+
+/*
+ * Fold one 'e', 'E', 'z' or 'Z' reply taken at stamp into the filter
+ * and publish the result.
+ */
+void estimate_sample(char cmd, struct timespec *stamp, const char *reply)
+{
+	struct est_shared *sp, cs;
+	struct est_out *op;
+	struct kf *f;
+	angle_t meas[2];
+	int pair, i, digits = islower(cmd) ? 8 : 4;
+	uint32_t s;
+
+	if( (sp = estimate_map()) == NULL )
+		return;
+	pair = (tolower(cmd) == 'e') ? EST_RADEC : EST_AZALT;
+	meas[0] = hex2angle(reply, digits);
+	meas[1] = hex2angle(reply + digits + 1, digits);
+	do {
+		s = __atomic_load_n(&sp->cmd_seq, __ATOMIC_ACQUIRE);
+		cs = *sp;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while( (s & 1) || s != __atomic_load_n(&sp->cmd_seq, __ATOMIC_RELAXED) );
+	op = &sp->est[pair];
+	seq_begin(&op->seq);
+	for(i = 0; i < 2; i++) {
+		f = &filters[pair][i];
+		kf_step(f, &cs, pair, i, stamp->tv_sec + stamp->tv_nsec / 1e9, meas[i],
+			islower(cmd) ? EST_NOISE : EST_NOISE16);
+		op->t = f->t;
+		op->pos[i] = f->ref + (angle_t)(int32_t)floor(f->p / ARCSEC + 0.5);
+		op->vel[i] = f->u + f->b;
+		op->sigma[i] = sqrt(f->P[0][0]);
+	}
+	op->valid = 1;
+	seq_end(&op->seq);
+}
+
+/*
+ * --estimate now|<hz>,<seconds>: print the published estimates.
+ */
+void cmd_estimate(char *arg)
+{
+	static char *names[2][2] = { { "RA", "Dec" }, { "Az", "Alt" } };
+	struct est_shared *sp;
+	char b1[32], b2[32];
+	double hz = 1, secs = 0, t, vel[2];
+	long long next, end;
+	angle_t pos[2];
+	int pair, any;
+
+	if( estimate_file == NULL ) {
+		errlog(14, "estimate wants --estimate-file first");
+		return;
+	}
+	if( (sp = estimate_map()) == NULL )
+		return;
+	if( strcmp(arg, "now") != 0 && (sscanf(arg, "%lf,%lf", &hz, &secs) != 2 || hz <= 0 || hz > 10000) ) {
+		errlog(14, "estimate wants now or <hz>,<seconds>");
+		return;
+	}
+	next = rt_now();
+	end = next + (long long)(secs * 1e9);
+	do {
+		rt_sleep_until(next);
+		t = realtime();
+		for(any = 0, pair = 0; pair < 2; pair++) {
+			if( estimate_get(&sp->est[pair], t, pos, vel) < 0 )
+				continue;
+			convert2hhmmss(b1, pos[0], pair == EST_RADEC ? ANGLE_HOUR : ANGLE_DEG, 0);
+			convert2hhmmss(b2, pos[1], ANGLE_DEG, 1);
+			fprintf(outfile, "%.6f %s %s %s %s vel %+.3f %+.3f\"/s sigma %.2f\" age %.3fs\n",
+				t, names[pair][0], b1, names[pair][1], b2, vel[0], vel[1],
+				sp->est[pair].sigma[0], t - sp->est[pair].t);
+			any = 1;
+		}
+		if( !any ) {
+			errlog(14, "estimate: nothing published in %s yet", estimate_file);
+			return;
+		}
+		next += 1e9 / hz;
+	} while( next < end );
+}
@@ -0,0 +1,78 @@
+/*
+ * Position estimator between serial samples
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "angle.h"
+
+#define	EST_MAGIC		0x4E585345	/* "ESXN" */
+#define	EST_RADEC		0			/* est[] index for 'e'/'E' */
+#define	EST_AZALT		1			/* est[] index for 'z'/'Z' */
+
+/* filter output for one coordinate pair, under a sequence lock */
+struct est_out {
+	uint32_t	seq;		/* odd while being written */
+	uint32_t	valid;
+	double		t;			/* realtime seconds of pos */
+	angle_t		pos[2];
+	double		vel[2];		/* arcseconds/second */
+	double		sigma[2];	/* position 1 sigma, arcseconds */
+};
+
+/*
+ * Layout of the --estimate-file. Any scope-control that commands motion
+ * with the file set records the commanded rates; the poller's filter
+ * reads them and publishes est[]. Readers map it and call estimate_get().
+ */
+struct est_shared {
+	uint32_t	magic;
+	uint32_t	cmd_seq;	/* odd while the commanded rates change */
+	int32_t		tracking;	/* track_modes[] index, -1 unknown */
+	int32_t		pad;
+	double		cmd_rate[2];	/* commanded slew per axis, arcseconds/second */
+	double		cmd_time;	/* realtime of the last change */
+	struct est_out	est[2];
+};
+
+extern char	*estimate_file;
+
+void	estimate_command(int axis, int fv, double rate);
+void	estimate_tracking(int mode);
+void	estimate_sample(char cmd, struct timespec *stamp, const char *reply);
+void	cmd_estimate(char *arg);
+
+/*
+ * Position and velocity at realtime t from a published estimate;
+ * a few multiplies, no system calls. Returns 0, or -1 if none yet.
+ */
+static inline int estimate_get(const struct est_out *op, double t, angle_t *pos, double *vel)
+{
+	struct est_out o;
+	uint32_t s;
+	int i;
+
+	do {
+		s = __atomic_load_n(&op->seq, __ATOMIC_ACQUIRE);
+		o = *op;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while( (s & 1) || s != __atomic_load_n(&op->seq, __ATOMIC_RELAXED) );
+	if( !o.valid )
+		return -1;
+	for(i = 0; i < 2; i++) {
+		pos[i] = o.pos[i] + (angle_t)(int64_t)(o.vel[i] * (t - o.t) * (ANGLE_FULL / 1296000.0));
+		if( vel != NULL )
+			vel[i] = o.vel[i];
+	}
+	return 0;
+}
+
+#endif /* ESTIMATE_H */
@@ -0,0 +1,222 @@
+/*
+ * Command frame encoders for Celestron NexStar hand control
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "frame.h"
+
+static const struct frame_desc frame_table[128] = {
+	['K'] = { 'K',  2,  2, FRAME_READ },	/* echo */
+	['w'] = { 'w',  1,  9, FRAME_READ },	/* get location */
+	['W'] = { 'W',  9,  1, 0 },				/* set location */
+	['h'] = { 'h',  1,  9, FRAME_READ },	/* get time */
+	['H'] = { 'H',  9,  1, 0 },				/* set time */
+	['E'] = { 'E',  1, 10, FRAME_READ|FRAME_HEX },	/* get RA/Dec */
+	['e'] = { 'e',  1, 18, FRAME_READ|FRAME_HEX },	/* get precise RA/Dec */
+	['Z'] = { 'Z',  1, 10, FRAME_READ|FRAME_HEX },	/* get Az/Alt */
+	['z'] = { 'z',  1, 18, FRAME_READ|FRAME_HEX },	/* get precise Az/Alt */
+	['R'] = { 'R', 10,  1, 0 },				/* goto RA/Dec */
+	['r'] = { 'r', 18,  1, 0 },				/* goto precise RA/Dec */
+	['B'] = { 'B', 10,  1, 0 },				/* goto Az/Alt */
+	['b'] = { 'b', 18,  1, 0 },				/* goto precise Az/Alt */
+	['S'] = { 'S', 10,  1, 0 },				/* sync */
+	['s'] = { 's', 18,  1, 0 },				/* precise sync */
+	['t'] = { 't',  1,  2, FRAME_READ },	/* get tracking mode */
+	['T'] = { 'T',  2,  1, 0 },				/* set tracking mode */
+	['L'] = { 'L',  1,  2, FRAME_READ },	/* goto in progress */
+	['J'] = { 'J',  1,  2, FRAME_READ },	/* alignment complete */
+	['M'] = { 'M',  1,  1, 0 },				/* cancel goto */
+	['V'] = { 'V',  1,  3, FRAME_READ },	/* hand control version */
+	['m'] = { 'm',  1,  2, FRAME_READ },	/* model */
+	['P'] = { 'P',  8,  0, FRAME_PASSTHRU },	/* slew, device version */
+};
+
+/*
+ * Layout of each frame built here, declared once: the bytes that never
+ * change, with the variable fields left zero, and where those fields
+ * go. An encoder copies the image and drops its values in at the
+ * offsets, which are constants the compiler folds into the stores.
+ */
+struct frame_layout {
+	unsigned char	len;
+	unsigned char	at[2];		/* offsets of the variable fields */
+	char			image[FRAME_MAX+1];
+};
+
+static const struct frame_layout layout_position16 = { 10, { 1, 6 }, "R0000,0000" };
+static const struct frame_layout layout_position32 = { 18, { 1, 10 }, "r00000000,00000000" };
+/* 'P' slews: opcode 36/6 is positive, 37/7 negative; fixed rate is one byte, variable two */
+static const struct frame_layout layout_slew_fixed = { 8, { 3, 4 }, { 'P', 2, 16, 36, 0, 0, 0, 0 } };
+static const struct frame_layout layout_slew_var = { 8, { 3, 4 }, { 'P', 3, 16, 6, 0, 0, 0, 0 } };
+/* 'P' get device version, device in byte 2, two byte reply */
+static const struct frame_layout layout_version = { 8, { 2, 0 }, { 'P', 1, 16, 254, 0, 0, 0, 2 } };
+/* 'W' location and 'H' time: command then eight raw bytes */
+static const struct frame_layout layout_location = { 9, { 1, 0 }, { 'W', 0, 0, 0, 0, 0, 0, 0, 0 } };
+static const struct frame_layout layout_time = { 9, { 1, 0 }, { 'H', 0, 0, 0, 0, 0, 0, 0, 0 } };
+
+/* NULL for a command the hand control does not know */
+const struct frame_desc *frame_lookup(int cmd)
+{
+	if( cmd < 0 || cmd > 127 || frame_table[cmd].cmd == 0 )
+		return NULL;
+	return &frame_table[cmd];
+}
+
+/*
+ * Reply length for a complete frame, '#' included, or -1 if the
+ * command is unknown.
+ */
+int frame_reply_len(const char *frame)
+{
+	const struct frame_desc *fp;
+
+	if( (fp = frame_lookup(frame[0])) == NULL )
+		return -1;
+	if( fp->flags & FRAME_PASSTHRU )
+		return (unsigned char)frame[7] + 1;
+	return fp->rlen;
+}
+
+/*
+ * 1 if len bytes of reply have the shape frame's command answers with:
+ * the length, the '#' at the end, hex digits either side of a comma
+ * for positions, the probe character for an echo, and '0' or '1' for
+ * 'L'. Any byte is a 't' mode, as firmware may know more than the four
+ * we name. 0 for anything else: the link slipped.
+ */
+int frame_reply_ok(const char *frame, const char *reply, int len)
+{
+	const struct frame_desc *fp;
+	int i, comma;
+
+	if( (fp = frame_lookup(frame[0])) == NULL || len != frame_reply_len(frame) ||
+			len < 1 || reply[len-1] != '#' )
+		return 0;
+	if( fp->flags & FRAME_HEX ) {
+		comma = (len - 1) / 2;
+		for(i = 0; i < len - 1; i++)
+			if( (i == comma) ? reply[i] != ',' : !isxdigit((unsigned char)reply[i]) )
+				return 0;
+	}
+	switch(fp->cmd) {
+	case 'K':
+		return reply[0] == frame[1];
+	case 'L':
+		return reply[0] == '0' || reply[0] == '1';
+	}
+	return 1;
+}
+
+/*
+ * Microseconds one transaction holds the serial link: both directions
+ * at FRAME_BAUD plus the hand control's turnaround. 'P' is costed with
+ * a bare '#' reply.
+ */
+long frame_wire_us(const struct frame_desc *fp)
+{
+	int bytes = fp->wlen + (fp->rlen ? fp->rlen : 1);
+
+	return bytes * 10 * 1000000L / FRAME_BAUD + FRAME_TURNAROUND;
+}
+
+/*
+ * Build a goto or sync frame: cmd, then two 16 bit (upper case command)
+ * or 32 bit (lower case command) hex values separated by a comma.
+ * Returns frame length.
+ */
+int position_frame(char *buf, char cmd, angle_t rvalue1, angle_t rvalue2)
+{
+	if( islower(cmd) ) {
+		memcpy(buf, layout_position32.image, layout_position32.len + 1);
+		angle2hex(&buf[layout_position32.at[0]], rvalue1, 8);
+		angle2hex(&buf[layout_position32.at[1]], rvalue2, 8);
+		buf[0] = cmd;
+		return layout_position32.len;
+	}
+	memcpy(buf, layout_position16.image, layout_position16.len + 1);
+	angle2hex(&buf[layout_position16.at[0]], rvalue1, 4);
+	angle2hex(&buf[layout_position16.at[1]], rvalue2, 4);
+	buf[0] = cmd;
+	return layout_position16.len;
+}
+
+/*
+ * Build an 8 byte 'P' slew frame
+ * 	fv		fixed=0, variable=1
+ * 	azalt	azimuth=0, altitude=1 (RA=0, declination=1)
+ * 	rate	fixed rate [-9, 9] or variable rate in arcseconds/second
+ * Returns frame length.
+ */
+int slew_frame(char *buf, int fv, int azalt, int rate)
+{
+	if( fv != 0 )
+		return slew_frame_quarter(buf, azalt, rate*4);
+	memcpy(buf, layout_slew_fixed.image, layout_slew_fixed.len);
+	buf[2] |= azalt;
+	buf[layout_slew_fixed.at[0]] |= (rate < 0);
+	buf[layout_slew_fixed.at[1]] = abs(rate);
+	return layout_slew_fixed.len;
+}
+
+/*
+ * Variable rate 'P' slew frame in the hand control's own unit of a
+ * quarter arcsecond/second (FRAME_RATE_STEP), for rates finer than
+ * slew_frame() takes. Returns frame length.
+ */
+int slew_frame_quarter(char *buf, int azalt, int quarters)
+{
+	memcpy(buf, layout_slew_var.image, layout_slew_var.len);
+	buf[2] |= azalt;
+	buf[layout_slew_var.at[0]] |= (quarters < 0);
+	buf[layout_slew_var.at[1]] = abs(quarters) >> 8;
+	buf[layout_slew_var.at[1] + 1] = abs(quarters) & 0xFF;
+	return layout_slew_var.len;
+}
+
+/*
+ * 'P' frame asking device (0 azimuth/RA motor, 1 altitude/Dec motor,
+ * and so on) for its version. Returns frame length.
+ */
+int version_frame(char *buf, int device)
+{
+	memcpy(buf, layout_version.image, layout_version.len);
+	buf[layout_version.at[0]] += device;
+	return layout_version.len;
+}
+
+/*
+ * 'W' set location or 'H' set time (any other cmd is taken as 'W'):
+ * the eight bytes in v as the hand control takes them.
+ * Returns frame length.
+ */
+int settings_frame(char *buf, char cmd, const unsigned char *v)
+{
+	const struct frame_layout *lp = (cmd == 'H') ? &layout_time : &layout_location;
+
+	memcpy(buf, lp->image, lp->len);
+	memcpy(&buf[lp->at[0]], v, lp->len - 1);
+	return lp->len;
+}
+
+/*
+ * Site from a 'w' reply: degrees, minutes, seconds and a south/west
+ * flag for latitude then longitude, each an unsigned byte.
+ */
+void location_decode(const char *reply, double *lat, double *lon)
+{
+	const unsigned char *u = (const unsigned char *)reply;
+
+	*lat = u[0] + u[1]/60.0 + u[2]/3600.0;
+	*lon = u[4] + u[5]/60.0 + u[6]/3600.0;
+	if( u[3] != 0 )
+		*lat = -*lat;
+	if( u[7] != 0 )
+		*lon = -*lon;
+}
@@ -0,0 +1,44 @@
+/*
+ * Command frame encoders for Celestron NexStar hand control
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "angle.h"
+
+#define	FRAME_READ		0x01	/* no side effects: safe to repeat or share */
+#define	FRAME_PASSTHRU	0x02	/* 'P': reply length is in byte 7 */
+#define	FRAME_HEX		0x04	/* reply is two hex values split by a comma */
+
+#define	FRAME_MAX		18		/* longest frame built, 'r' 'b' 's' */
+
+#define	FRAME_BAUD		9600	/* 8N1, 10 bits a byte */
+#define	FRAME_TURNAROUND	2000	/* microseconds the hand control takes to answer, typical */
+#define	FRAME_RATE_STEP	0.25	/* variable slew resolution, arcseconds/second */
+#define	FRAME_RATE_MAX	16383	/* fastest variable slew, arcseconds/second */
+
+/* wire layout of each hand control command */
+struct frame_desc {
+	char			cmd;
+	unsigned char	wlen;	/* bytes sent, command included */
+	unsigned char	rlen;	/* bytes returned, '#' included */
+	unsigned char	flags;
+};
+
+const struct frame_desc	*frame_lookup(int cmd);
+int		frame_reply_len(const char *frame);
+long	frame_wire_us(const struct frame_desc *fp);
+int		frame_reply_ok(const char *frame, const char *reply, int len);
+int		position_frame(char *buf, char cmd, angle_t rvalue1, angle_t rvalue2);
+int		slew_frame(char *buf, int fv, int azalt, int rate);
+int		slew_frame_quarter(char *buf, int azalt, int quarters);
+int		version_frame(char *buf, int device);
+int		settings_frame(char *buf, char cmd, const unsigned char *v);
+void	location_decode(const char *reply, double *lat, double *lon);
+
+#endif /* FRAME_H */
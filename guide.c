@@ -0,0 +1,334 @@
+/*
+ * Autoguider pulse input
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * A guider writes correction pulses to a FIFO or a TCP socket; each one
+ * becomes a variable rate 'P' slew on its axis and a timerfd deadline
+ * for the matching stop. Pulse length is measured from the moment the
+ * start frame has left the serial port to the moment the stop frame has,
+ * and the stop is sent early by the start frame's measured wire time so
+ * the two line up. A new pulse on a busy axis replaces the old one.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <math.h>
+
+#include "scope-control.h"
+#include "frame.h"
+#include "bridge.h"
+#include "rt.h"
+#include "estimate.h"
+#include "guide.h"
+
+#define	GUIDE_BUF		256
+#define	GUIDE_MAXRATE	16383		/* arcseconds/second, what 'P' can carry */
+#define	GUIDE_MAXUS		60000000	/* longest pulse, microseconds */
+
+struct guide_axis {
+	int			tfd;		/* timerfd for the stop */
+	int			rate;		/* 0 when idle */
+	long long	start;		/* ns, start frame on the wire */
+	long long	want;		/* ns requested */
+	long long	wire;		/* ns to send one 'P' frame */
+	long long	deadline;	/* ns, when the stop is due out */
+};
+
+static struct guide_axis axes[2];
+static char *axis_names[2] = { "RA", "Dec" };
+static volatile sig_atomic_t guide_stop_flag = 0;
+
+/* timed pulses: count, error sum, sum of squares, worst; pulses cut short */
+static long g_count, g_cut;
+static double g_sum, g_sumsq, g_worst;
+
+static void guide_signal(int sig)
+{
+	guide_stop_flag = 1;
+}
+
+/*
+ * Send a variable rate slew and wait for it to leave the port.
+ * Returns the time it had gone, -1 on failure.
+ */
+static long long guide_slew(int axis, int rate)
+{
+	char buf[8];
+	long long t0, t;
+
+	slew_frame(buf, 1, axis, rate);
+	t0 = rt_now();
+	if( dev_write(buf, sizeof(buf)) != sizeof(buf) )
+		return -1;
+	tcdrain(devfd);
+	t = rt_now();
+	axes[axis].wire = t - t0;
+	if( dev_read(buf, 1) != 1 || buf[0] != '#' ) {
+		errlog(11, "guide %s slew failed", axis_names[axis]);
+		return -1;
+	}
+	estimate_command(axis, 1, rate);
+	return t;
+}
+
+static void guide_arm(struct guide_axis *ap, long long when)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	if( when > 0 ) {
+		its.it_value.tv_sec = when / 1000000000LL;
+		its.it_value.tv_nsec = when % 1000000000LL;
+	}
+	timerfd_settime(ap->tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* stop an axis; timed is set when its deadline fired */
+static int guide_end(int axis, int timed)
+{
+	struct guide_axis *ap = &axes[axis];
+	long long t;
+	double got, err;
+
+	guide_arm(ap, 0);
+	if( (t = guide_slew(axis, 0)) < 0 )
+		return -1;
+	got = (t - ap->start) / 1e6;
+	if( timed ) {
+		err = got - ap->want / 1e6;
+		g_count++;
+		g_sum += err;
+		g_sumsq += err*err;
+		if( fabs(err) > g_worst )
+			g_worst = fabs(err);
+		fprintf(outfile, "guide %s %+d\"/s %.3fms achieved %.3fms (%+.3fms)\n",
+			axis_names[axis], ap->rate, ap->want / 1e6, got, err);
+	} else {
+		g_cut++;
+		fprintf(outfile, "guide %s %+d\"/s %.3fms cut short at %.3fms\n",
+			axis_names[axis], ap->rate, ap->want / 1e6, got);
+	}
+	fflush(outfile);
+	ap->rate = 0;
+	return 0;
+}
+
+static int guide_pulse(int axis, int rate, long us)
+{
+	struct guide_axis *ap = &axes[axis];
+	long long t;
+
+	if( rate == 0 || us <= 0 )
+		return (ap->rate != 0) ? guide_end(axis, 0) : 0;
+	if( ap->rate != 0 ) {
+		g_cut++;
+		fprintf(outfile, "guide %s %+d\"/s replaced after %.3fms\n",
+			axis_names[axis], ap->rate, (rt_now() - ap->start) / 1e6);
+		fflush(outfile);
+	}
+	if( (t = guide_slew(axis, rate)) < 0 )
+		return -1;
+	ap->rate = rate;
+	ap->start = t;
+	ap->want = us * 1000LL;
+	/* 0 would disarm the timer, so a deadline already gone is 1ns */
+	ap->deadline = t + ap->want - ap->wire;
+	guide_arm(ap, ap->deadline > 0 ? ap->deadline : 1);
+	return 0;
+}
+
+/* ra/az is axis 0, dec/alt axis 1 */
+static int guide_axis_name(char *s)
+{
+	if( strcmp(s, "ra") == 0 || strcmp(s, "RA") == 0 || strcmp(s, "az") == 0 || strcmp(s, "0") == 0 )
+		return 0;
+	if( strcmp(s, "dec") == 0 || strcmp(s, "Dec") == 0 || strcmp(s, "alt") == 0 || strcmp(s, "1") == 0 )
+		return 1;
+	return -1;
+}
+
+static int guide_line(char *line)
+{
+	char name[16];
+	int axis, rate;
+	double ms;
+
+	line[strcspn(line, "#\r\n")] = '\0';
+	while( isspace(*line) )
+		line++;
+	if( *line == '\0' )
+		return 0;
+	if( strcmp(line, "stop") == 0 ) {
+		for(axis = 0; axis < 2; axis++)
+			if( axes[axis].rate != 0 && guide_end(axis, 0) < 0 )
+				return -1;
+		return 0;
+	}
+	if( sscanf(line, "%15s %d %lf", name, &rate, &ms) != 3 ||
+			(axis = guide_axis_name(name)) < 0 || abs(rate) > GUIDE_MAXRATE ||
+			ms < 0 || ms*1000 > GUIDE_MAXUS ) {
+		fprintf(errfile, "guide bad pulse `%s', skipped\n", line);
+		return 0;
+	}
+	return guide_pulse(axis, rate, (long)(ms*1000 + 0.5));
+}
+
+/*
+ * Run every complete pulse in buf, keep any partial one.
+ * Returns -1 if the serial link failed.
+ */
+static int guide_input(char *buf, int *lenp)
+{
+	struct guide_pulse gp;
+	char *nl;
+	int len = *lenp, l;
+
+	while( len > 0 ) {
+		if( (unsigned char)buf[0] == GUIDE_TAG ) {
+			if( len < sizeof(gp) )
+				break;
+			memcpy(&gp, buf, sizeof(gp));
+			l = sizeof(gp);
+			if( gp.axis > 1 || abs(gp.rate) > GUIDE_MAXRATE || gp.duration_us > GUIDE_MAXUS )
+				fprintf(errfile, "guide bad binary pulse, skipped\n");
+			else if( guide_pulse(gp.axis, gp.rate, gp.duration_us) < 0 )
+				return -1;
+		} else {
+			if( (nl = memchr(buf, '\n', len)) == NULL ) {
+				if( len == GUIDE_BUF - 1 )
+					len = 0;	/* no newline in sight, junk */
+				break;
+			}
+			*nl = '\0';
+			l = nl - buf + 1;
+			if( guide_line(buf) < 0 )
+				return -1;
+		}
+		len -= l;
+		memmove(buf, buf + l, len);
+	}
+	*lenp = len;
+	return 0;
+}
+
+/* a FIFO, made if missing; opened read/write so writers may come and go */
+static int guide_fifo(char *path)
+{
+	int fd;
+
+	if( mkfifo(path, 0660) < 0 && errno != EEXIST ) {
+		errlog(11, "guide cannot make FIFO %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if( (fd = open(path, O_RDWR|O_NONBLOCK)) < 0 )
+		errlog(11, "guide cannot open %s: %s", path, strerror(errno));
+	return fd;
+}
+
+/*
+ * --guide <fifo> or --guide [address:]port; runs until SIGINT/SIGTERM.
+ */
+void cmd_guide(char *arg)
+{
+	struct pollfd pfd[3];
+	struct sigaction old[2];
+	char buf[GUIDE_BUF], *cp;
+	uint64_t ticks;
+	int lfd = -1, fd = -1, i, l, len = 0;
+
+	cp = strrchr(arg, ':');
+	cp = (cp != NULL) ? cp + 1 : arg;
+	if( *cp != '\0' && strspn(cp, "0123456789") == strlen(cp) ) {
+		if( (lfd = tcp_listen("guide", arg)) < 0 )
+			return;
+	} else if( (fd = guide_fifo(arg)) < 0 )
+		return;
+	guide_stop_flag = 0;
+	catch_stop(guide_signal, old);
+	for(i = 0; i < 2; i++)
+		axes[i].tfd = -1;
+	for(i = 0; i < 2; i++) {
+		axes[i].rate = 0;
+		axes[i].wire = 0;
+		if( (axes[i].tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0 ) {
+			errlog(11, "guide timerfd: %s", strerror(errno));
+			goto done;
+		}
+	}
+	fprintf(outfile, "guide waiting for pulses on %s\n", arg);
+	fflush(outfile);
+	while( !guide_stop_flag ) {
+		/* stops first: they are the time critical part */
+		pfd[0].fd = axes[0].tfd;
+		pfd[1].fd = axes[1].tfd;
+		pfd[2].fd = (fd >= 0) ? fd : lfd;
+		for(i = 0; i < 3; i++)
+			pfd[i].events = POLLIN;
+		if( poll(pfd, 3, -1) < 0 ) {
+			if( errno == EINTR )
+				continue;
+			errlog(11, "guide poll: %s", strerror(errno));
+			break;
+		}
+		for(i = 0; i < 2; i++) {
+			if( !(pfd[i].revents & POLLIN) || read(axes[i].tfd, &ticks, sizeof(ticks)) <= 0 ||
+					axes[i].rate == 0 )
+				continue;
+			rt_late(rt_now() - axes[i].deadline);
+			if( guide_end(i, 1) < 0 )
+				goto done;
+		}
+		if( pfd[2].revents == 0 )
+			continue;
+		if( fd < 0 ) {
+			fd = accept(lfd, NULL, NULL);
+			len = 0;
+			continue;
+		}
+		if( (l = read(fd, buf + len, sizeof(buf) - 1 - len)) <= 0 ) {
+			if( l < 0 && errno == EAGAIN )
+				continue;
+			if( lfd < 0 )
+				break;
+			close(fd);		/* TCP guider went away, wait for the next */
+			fd = -1;
+			continue;
+		}
+		len += l;
+		if( guide_input(buf, &len) < 0 )
+			goto done;
+	}
+	for(i = 0; i < 2; i++)
+		if( axes[i].rate != 0 )
+			guide_end(i, 0);
+done:
+	for(i = 0; i < 2; i++)
+		if( axes[i].tfd >= 0 )
+			close(axes[i].tfd);
+	if( fd >= 0 )
+		close(fd);
+	if( lfd >= 0 )
+		close(lfd);
+	restore_stop(old);
+	if( g_count > 0 )
+		fprintf(outfile, "guide %ld pulses, length error mean %+.3fms rms %.3fms worst %.3fms, %ld cut short\n",
+			g_count, g_sum / g_count, sqrt(g_sumsq / g_count), g_worst, g_cut);
+	else
+		fprintf(outfile, "guide no timed pulses, %ld cut short\n", g_cut);
+}
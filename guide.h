@@ -0,0 +1,29 @@
+/*
+ * Autoguider pulse input
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef GUIDE_H
+#define GUIDE_H
+
+#include <stdint.h>
+
+#define	GUIDE_TAG	0xA5	/* first byte of a binary pulse */
+
+/*
+ * Binary pulse, host byte order. Anything not starting with GUIDE_TAG
+ * is read as a text line "<ra|dec|az|alt> <±arcsec/s> <milliseconds>".
+ */
+struct guide_pulse {
+	uint8_t		tag;
+	uint8_t		axis;			/* 0 azimuth/RA, 1 altitude/declination */
+	int16_t		rate;			/* arcseconds/second, 0 stops */
+	uint32_t	duration_us;
+};
+
+void	cmd_guide(char *arg);
+
+#endif /* GUIDE_H */
@@ -0,0 +1,75 @@
+/*
+ * Linear least squares by normal equations
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Rows are folded into A'A and A'b as they arrive, so a fit over
+ * millions of samples costs n*n per sample and no memory; the n*n
+ * system is then solved by Cholesky. Fine for the handful of well
+ * scaled parameters used here; callers scale columns to order one.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "lsq.h"
+
+void lsq_init(struct lsq *lp, int n)
+{
+	memset(lp, 0, sizeof(*lp));
+	lp->n = n;
+}
+
+void lsq_add(struct lsq *lp, const double *row, double y)
+{
+	int i, j;
+
+	for(i = 0; i < lp->n; i++) {
+		for(j = 0; j <= i; j++)
+			lp->ata[i][j] += row[i] * row[j];
+		lp->atb[i] += row[i] * y;
+	}
+	lp->rows++;
+}
+
+/*
+ * Solve for x. Only the lower triangle of A'A is kept.
+ * Returns 0, or -1 if the system is singular (too few or degenerate rows).
+ */
+int lsq_solve(struct lsq *lp, double *x)
+{
+	double l[LSQ_MAX][LSQ_MAX], s;
+	int i, j, k, n = lp->n;
+
+	if( lp->rows < n )
+		return -1;
+	for(i = 0; i < n; i++) {
+		for(j = 0; j <= i; j++) {
+			s = lp->ata[i][j];
+			for(k = 0; k < j; k++)
+				s -= l[i][k] * l[j][k];
+			if( i == j ) {
+				if( s <= 1e-12 * (lp->ata[i][i] + 1e-300) )
+					return -1;
+				l[i][i] = sqrt(s);
+			} else
+				l[i][j] = s / l[j][j];
+		}
+	}
+	/* L y = A'b, then L' x = y */
+	for(i = 0; i < n; i++) {
+		s = lp->atb[i];
+		for(k = 0; k < i; k++)
+			s -= l[i][k] * x[k];
+		x[i] = s / l[i][i];
+	}
+	for(i = n - 1; i >= 0; i--) {
+		s = x[i];
+		for(k = i + 1; k < n; k++)
+			s -= l[k][i] * x[k];
+		x[i] = s / l[i][i];
+	}
+	return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * Linear least squares by normal equations
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef LSQ_H
+#define LSQ_H
+
+#define	LSQ_MAX		16		/* most parameters in one fit */
+
+/* accumulated A'A and A'b; rows are never stored */
+struct lsq {
+	int		n;
+	long	rows;
+	double	ata[LSQ_MAX][LSQ_MAX];
+	double	atb[LSQ_MAX];
+};
+
+void	lsq_init(struct lsq *lp, int n);
+void	lsq_add(struct lsq *lp, const double *row, double y);
+int		lsq_solve(struct lsq *lp, double *x);
+
+#endif /* LSQ_H */
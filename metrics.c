@@ -0,0 +1,236 @@
+/*
+ * Runtime metrics for scope-control serial traffic
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * dev_write() opens a transaction keyed by the command character,
+ * the following dev_read() closes it. Counters live in per-thread
+ * blocks and are written out in Prometheus text format, suitable
+ * for the node_exporter textfile collector.
+ */
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+char *metrics_file = NULL;
+
+static struct metrics *metrics_list = NULL;
+static __thread struct metrics *mine = NULL;
+
+/* single writer per counter; relaxed stores keep readers tear free */
+#define	BUMP(x, n)	__atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+#define	PEEK(x)		__atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+/* first use on a thread: allocate and push onto the list, lock free */
+static struct metrics *metrics_self()
+{
+	struct metrics *m;
+
+	if( (m = mine) != NULL )
+		return m;
+	if( (m = calloc(1, sizeof(*m))) == NULL )
+		return NULL;
+	m->cur_op = -1;
+	m->next = __atomic_load_n(&metrics_list, __ATOMIC_RELAXED);
+	while( !__atomic_compare_exchange_n(&metrics_list, &m->next, m, 0,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED) )
+		;
+	return mine = m;
+}
+
+void metrics_tx(const void *bufp, int len, int sent)
+{
+	struct metrics *m;
+	struct metrics_op *op;
+
+	if( len <= 0 || (m = metrics_self()) == NULL )
+		return;
+	m->cur_op = ((const unsigned char *)bufp)[0] & (METRICS_OPS-1);
+	m->cur_start = now_us();
+	op = &m->op[m->cur_op];
+	if( sent > 0 )
+		BUMP(op->tx_bytes, sent);
+	if( sent != len ) {
+		BUMP(op->errors, 1);
+		m->cur_op = -1;
+	}
+}
+
+void metrics_rx(const void *bufp, int rlen, int got, int timeout)
+{
+	struct metrics *m;
+	struct metrics_op *op;
+	uint64_t us;
+	int b;
+
+	if( (m = metrics_self()) == NULL || m->cur_op < 0 )
+		return;
+	op = &m->op[m->cur_op];
+	m->cur_op = -1;
+	if( got > 0 )
+		BUMP(op->rx_bytes, got);
+	if( timeout ) {
+		BUMP(op->timeouts, 1);
+		return;
+	}
+	if( got != rlen || ((const char *)bufp)[rlen-1] != '#' ) {
+		BUMP(op->errors, 1);
+		return;
+	}
+	us = now_us() - m->cur_start;
+	for(b = 0; b < METRICS_BUCKETS-1 && us > (1ULL << b); b++)
+		;
+	BUMP(op->bucket[b], 1);
+	BUMP(op->latency_us, us);
+	BUMP(op->count, 1);
+}
+
+void metrics_coalesced(int cmd, int n)
+{
+	struct metrics *m;
+
+	if( (m = metrics_self()) == NULL )
+		return;
+	BUMP(m->op[cmd & (METRICS_OPS-1)].coalesced, n);
+}
+
+/* retried is 0 for the resync after a bad reply, 1 for the repeat */
+void metrics_resync(int cmd, int retried)
+{
+	struct metrics *m;
+	struct metrics_op *op;
+
+	if( (m = metrics_self()) == NULL )
+		return;
+	op = &m->op[cmd & (METRICS_OPS-1)];
+	if( retried )
+		BUMP(op->retries, 1);
+	else
+		BUMP(op->resyncs, 1);
+}
+
+void metrics_fail(int type)
+{
+	struct metrics *m;
+
+	if( (m = metrics_self()) == NULL )
+		return;
+	if( type < 0 || type >= METRICS_FAILS )
+		type = METRICS_FAILS-1;
+	BUMP(m->fails[type], 1);
+}
+
+static void op_label(char *buf, int op)
+{
+	if( op > ' ' && op < 0x7F && op != '"' && op != '\\' )
+		sprintf(buf, "%c", op);
+	else
+		sprintf(buf, "0x%02x", op);
+}
+
+/*
+ * Sum all threads and write Prometheus text format.
+ * Written to path.tmp and renamed so scrapers never see half a file.
+ * Returns 0 on success, -1 on error.
+ */
+int metrics_dump(const char *path)
+{
+	static struct metrics_op sum[METRICS_OPS];
+	uint64_t fails[METRICS_FAILS], cum;
+	struct metrics *m;
+	char tmp[4096], label[8];
+	FILE *f;
+	int i, b;
+
+	if( path == NULL )
+		return 0;
+	memset(sum, 0, sizeof(sum));
+	memset(fails, 0, sizeof(fails));
+	for(m = __atomic_load_n(&metrics_list, __ATOMIC_ACQUIRE); m != NULL; m = m->next) {
+		for(i = 0; i < METRICS_OPS; i++) {
+			sum[i].count += PEEK(m->op[i].count);
+			sum[i].errors += PEEK(m->op[i].errors);
+			sum[i].timeouts += PEEK(m->op[i].timeouts);
+			sum[i].coalesced += PEEK(m->op[i].coalesced);
+			sum[i].resyncs += PEEK(m->op[i].resyncs);
+			sum[i].retries += PEEK(m->op[i].retries);
+			sum[i].tx_bytes += PEEK(m->op[i].tx_bytes);
+			sum[i].rx_bytes += PEEK(m->op[i].rx_bytes);
+			sum[i].latency_us += PEEK(m->op[i].latency_us);
+			for(b = 0; b < METRICS_BUCKETS; b++)
+				sum[i].bucket[b] += PEEK(m->op[i].bucket[b]);
+		}
+		for(i = 0; i < METRICS_FAILS; i++)
+			fails[i] += PEEK(m->fails[i]);
+	}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if( (f = fopen(tmp, "w")) == NULL )
+		return -1;
+
+#define	COUNTER(name, field, help)											\
+	fprintf(f, "# HELP scope_control_" name " " help "\n"					\
+				"# TYPE scope_control_" name " counter\n");					\
+	for(i = 0; i < METRICS_OPS; i++) {										\
+		if( sum[i].count + sum[i].errors + sum[i].timeouts + sum[i].coalesced == 0 )			\
+			continue;														\
+		op_label(label, i);													\
+		fprintf(f, "scope_control_" name "{cmd=\"%s\"} %llu\n", label,		\
+			(unsigned long long)sum[i].field);								\
+	}
+
+	COUNTER("commands_total", count, "Completed serial transactions.");
+	COUNTER("command_errors_total", errors, "Short or malformed transactions.");
+	COUNTER("command_timeouts_total", timeouts, "Replies that did not arrive in time.");
+	COUNTER("coalesced_total", coalesced, "Queries answered from a shared reply.");
+	COUNTER("resyncs_total", resyncs, "Bad replies after which the link was resynchronized.");
+	COUNTER("retries_total", retries, "Read-only commands repeated after a resync.");
+	COUNTER("tx_bytes_total", tx_bytes, "Bytes written to the hand control.");
+	COUNTER("rx_bytes_total", rx_bytes, "Bytes read from the hand control.");
+#undef	COUNTER
+
+	fprintf(f, "# HELP scope_control_command_latency_seconds Write to end of reply.\n"
+				"# TYPE scope_control_command_latency_seconds histogram\n");
+	for(i = 0; i < METRICS_OPS; i++) {
+		if( sum[i].count == 0 )
+			continue;
+		op_label(label, i);
+		for(b = 0, cum = 0; b < METRICS_BUCKETS-1; b++) {
+			cum += sum[i].bucket[b];
+			fprintf(f, "scope_control_command_latency_seconds_bucket{cmd=\"%s\",le=\"%g\"} %llu\n",
+				label, (double)(1ULL << b)/1e6, (unsigned long long)cum);
+		}
+		fprintf(f, "scope_control_command_latency_seconds_bucket{cmd=\"%s\",le=\"+Inf\"} %llu\n",
+			label, (unsigned long long)sum[i].count);
+		fprintf(f, "scope_control_command_latency_seconds_sum{cmd=\"%s\"} %.6f\n",
+			label, (double)sum[i].latency_us/1e6);
+		fprintf(f, "scope_control_command_latency_seconds_count{cmd=\"%s\"} %llu\n",
+			label, (unsigned long long)sum[i].count);
+	}
+
+	fprintf(f, "# HELP scope_control_failures_total errlog() calls by fail type.\n"
+				"# TYPE scope_control_failures_total counter\n");
+	for(i = 0; i < METRICS_FAILS; i++)
+		if( fails[i] != 0 )
+			fprintf(f, "scope_control_failures_total{type=\"%d\"} %llu\n",
+				i, (unsigned long long)fails[i]);
+	if( fclose(f) != 0 || rename(tmp, path) != 0 ) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Runtime metrics for scope-control serial traffic
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#define	METRICS_OPS		128	/* indexed by command character */
+#define	METRICS_BUCKETS	24	/* latency buckets 1us << n, last takes the rest */
+#define	METRICS_FAILS	32	/* errlog() types counted */
+
+struct metrics_op {
+	uint64_t	count;		/* completed transactions */
+	uint64_t	errors;		/* short write/read or bad terminator */
+	uint64_t	timeouts;	/* reply did not arrive in time */
+	uint64_t	coalesced;	/* answered from a shared reply */
+	uint64_t	resyncs;	/* bad reply, link brought back in step */
+	uint64_t	retries;	/* read-only command sent again after a resync */
+	uint64_t	tx_bytes;
+	uint64_t	rx_bytes;
+	uint64_t	latency_us;	/* sum, for the histogram _sum */
+	uint64_t	bucket[METRICS_BUCKETS];
+};
+
+/*
+ * One of these per thread. Only the owning thread writes to it so
+ * the hot path needs no lock; readers sum across the list.
+ */
+struct metrics {
+	struct metrics_op	op[METRICS_OPS];
+	uint64_t			fails[METRICS_FAILS];
+	int					cur_op;		/* transaction in flight */
+	uint64_t			cur_start;
+	struct metrics		*next;
+};
+
+extern char *metrics_file;
+
+void	metrics_tx(const void *bufp, int len, int sent);
+void	metrics_rx(const void *bufp, int rlen, int got, int timeout);
+void	metrics_fail(int type);
+void	metrics_coalesced(int cmd, int n);
+void	metrics_resync(int cmd, int retried);
+int		metrics_dump(const char *path);
+
+#endif /* METRICS_H */
@@ -0,0 +1,256 @@
+/*
+ * Push notifications of goto, tracking and alignment state
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * --notify path[,ms] polls 'L' every ms (NOTIFY_INTERVAL by default)
+ * and 't' and 'J' every NOTIFY_SLOW polls, and writes one line per
+ * change to every client connected to the Unix socket at path:
+ *
+ *	<unix time> goto <0|1>
+ *	<unix time> tracking <mode> <name>
+ *	<unix time> aligned <0|1>
+ *
+ * The time is when the hand control answered (see coalesce.c). A new
+ * client is sent the current state at once, so it never has to ask
+ * the hand control itself; a client that will not take its lines is
+ * dropped rather than let it hold up the rest. Anything a client
+ * sends is ignored. Try `socat - UNIX-CONNECT:path'.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "scope-control.h"
+#include "coalesce.h"
+#include "notify.h"
+
+#define	NOTIFY_CLIENTS	32
+#define	NOTIFY_INTERVAL	250		/* milliseconds between 'L' polls */
+#define	NOTIFY_SLOW		4		/* 't' and 'J' every this many 'L' polls */
+
+struct notify_state {
+	char			cmd;
+	char			*event;
+	int				value;		/* -1 until first read */
+	struct timespec	stamp;		/* when value was read */
+};
+
+static struct notify_state states[] = {
+	{ 'L', "goto", -1 },
+	{ 't', "tracking", -1 },
+	{ 'J', "aligned", -1 },
+};
+#define	NSTATES	(sizeof(states)/sizeof(states[0]))
+
+static int clients[NOTIFY_CLIENTS];
+static volatile sig_atomic_t notify_stop = 0;
+
+static void notify_signal(int sig)
+{
+	notify_stop = 1;
+}
+
+static int notify_line(char *buf, size_t len, struct notify_state *sp)
+{
+	if( sp->cmd == 't' )
+		return snprintf(buf, len, "%ld.%06ld %s %d %s\n", (long)sp->stamp.tv_sec,
+			sp->stamp.tv_nsec / 1000, sp->event, sp->value,
+			(unsigned)sp->value < 4 ? track_modes[sp->value] : "?");
+	return snprintf(buf, len, "%ld.%06ld %s %d\n", (long)sp->stamp.tv_sec,
+		sp->stamp.tv_nsec / 1000, sp->event, sp->value);
+}
+
+/* a client that cannot take a whole line now is too far behind */
+static void notify_send(int i, char *line, int len)
+{
+	if( send(clients[i], line, len, MSG_DONTWAIT|MSG_NOSIGNAL) == len )
+		return;
+	fprintf(outfile, "notify client %d dropped, not reading\n", i);
+	close(clients[i]);
+	clients[i] = -1;
+}
+
+static void notify_accept(int lfd)
+{
+	char line[80];
+	int fd, i, j, l;
+
+	if( (fd = accept(lfd, NULL, NULL)) < 0 )
+		return;
+	for(i = 0; i < NOTIFY_CLIENTS && clients[i] >= 0; i++)
+		;
+	if( i == NOTIFY_CLIENTS ) {
+		fprintf(errfile, "notify full, refusing client\n");
+		close(fd);
+		return;
+	}
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	clients[i] = fd;
+	for(j = 0; j < NSTATES && clients[i] >= 0; j++)
+		if( states[j].value >= 0 ) {
+			l = notify_line(line, sizeof(line), &states[j]);
+			notify_send(i, line, l);
+		}
+}
+
+/*
+ * Read one state and tell everyone if it changed. A failure is only
+ * reported: dev_transact() has retried and resynced already, and the
+ * next poll may well get through.
+ * Returns -1 if the hand control did not answer.
+ */
+static int notify_check(struct notify_state *sp)
+{
+	struct timespec stamp;
+	char buf[2], line[80];
+	int i, l, value;
+
+	if( coalesce_query(sp->cmd, buf, 2, &stamp) != 2 ) {
+		fprintf(errfile, "notify `%c' failed\n", sp->cmd);
+		return -1;
+	}
+	value = (sp->cmd == 'L') ? buf[0] == '1' : (unsigned char)buf[0];
+	if( value == sp->value )
+		return 0;
+	sp->value = value;
+	sp->stamp = stamp;
+	l = notify_line(line, sizeof(line), sp);
+	fputs(line, outfile);
+	fflush(outfile);
+	for(i = 0; i < NOTIFY_CLIENTS; i++)
+		if( clients[i] >= 0 )
+			notify_send(i, line, l);
+	return 0;
+}
+
+static int notify_listen(char *path)
+{
+	struct sockaddr_un sa;
+	struct stat st;
+	int fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if( strlen(path) >= sizeof(sa.sun_path) ) {
+		errlog(22, "notify socket path %s too long", path);
+		return -1;
+	}
+	strcpy(sa.sun_path, path);
+	/* a socket left by an earlier run is ours to replace, anything else is not */
+	if( stat(path, &st) == 0 && S_ISSOCK(st.st_mode) )
+		unlink(path);
+	if( (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ) {
+		errlog(22, "notify socket: %s", strerror(errno));
+		return -1;
+	}
+	if( bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(fd, 8) < 0 ) {
+		errlog(22, "notify cannot listen on %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Watch the hand control and serve clients until SIGINT/SIGTERM.
+ */
+void cmd_notify(char *arg)
+{
+	struct pollfd pfd[NOTIFY_CLIENTS+2];
+	struct itimerspec its;
+	struct sigaction old[2];
+	char path[108], junk[64], *cp;
+	long ms = NOTIFY_INTERVAL;
+	uint64_t ticks;
+	unsigned long n;
+	int lfd, tfd, i, l, bad;
+
+	snprintf(path, sizeof(path), "%s", arg);
+	if( (cp = strrchr(path, ',')) != NULL ) {
+		*cp++ = '\0';
+		if( (ms = atol(cp)) < 10 || ms > 60000 ) {
+			errlog(22, "notify interval %s out of range", cp);
+			return;
+		}
+	}
+	if( (lfd = notify_listen(path)) < 0 )
+		return;
+	if( (tfd = timerfd_create(CLOCK_MONOTONIC, 0)) < 0 ) {
+		errlog(22, "notify timerfd: %s", strerror(errno));
+		close(lfd);
+		unlink(path);
+		return;
+	}
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_nsec = 1;
+	its.it_interval.tv_sec = ms / 1000;
+	its.it_interval.tv_nsec = (ms % 1000) * 1000000L;
+	timerfd_settime(tfd, 0, &its, NULL);
+	for(i = 0; i < NOTIFY_CLIENTS; i++)
+		clients[i] = -1;
+	notify_stop = 0;
+	catch_stop(notify_signal, old);
+	fprintf(outfile, "notify listening on %s, polling every %ldms\n", path, ms);
+	fflush(outfile);
+	for(n = 0; !notify_stop; ) {
+		pfd[0].fd = tfd;
+		pfd[1].fd = lfd;
+		for(i = 0; i < NOTIFY_CLIENTS; i++)
+			pfd[i+2].fd = clients[i];
+		for(i = 0; i < NOTIFY_CLIENTS+2; i++)
+			pfd[i].events = POLLIN;
+		if( poll(pfd, NOTIFY_CLIENTS+2, -1) < 0 ) {
+			if( errno == EINTR )
+				continue;
+			errlog(22, "notify poll: %s", strerror(errno));
+			break;
+		}
+		if( (pfd[0].revents & POLLIN) && read(tfd, &ticks, sizeof(ticks)) > 0 ) {
+			/* 'L' every time, 't' and 'J' in turn between */
+			bad = notify_check(&states[0]) < 0;
+			if( n % NOTIFY_SLOW == 0 )
+				bad |= notify_check(&states[1]) < 0;
+			if( n % NOTIFY_SLOW == NOTIFY_SLOW/2 )
+				bad |= notify_check(&states[2]) < 0;
+			n++;
+			/* keep serving through a bad spell; only a port that has gone ends it */
+			if( bad && dev_gone() ) {
+				errlog(22, "notify lost the serial port");
+				break;
+			}
+		}
+		if( pfd[1].revents & POLLIN )
+			notify_accept(lfd);
+		for(i = 0; i < NOTIFY_CLIENTS; i++) {
+			if( clients[i] < 0 || pfd[i+2].revents == 0 )
+				continue;
+			if( (l = read(clients[i], junk, sizeof(junk))) == 0 || (l < 0 && errno != EAGAIN) ) {
+				close(clients[i]);
+				clients[i] = -1;
+			}
+		}
+	}
+	for(i = 0; i < NOTIFY_CLIENTS; i++)
+		if( clients[i] >= 0 )
+			close(clients[i]);
+	close(tfd);
+	close(lfd);
+	unlink(path);
+	restore_stop(old);
+	fprintf(outfile, "notify stopped\n");
+}
@@ -0,0 +1,14 @@
+/*
+ * Push notifications of goto, tracking and alignment state
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+void	cmd_notify(char *arg);
+
+#endif /* NOTIFY_H */
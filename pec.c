@@ -0,0 +1,457 @@
+/*
+ * Periodic error capture and analysis
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * --pec-capture file,seconds[,hz] records precise RA/Dec at a fixed rate
+ * while the mount tracks. Tracking at the sidereal rate holds RA still,
+ * so whatever RA does is tracking error.
+ *
+ * --pec-analyze file[,worm period] unwraps the RA error and averages it
+ * into PEC_BIN bins; the averaging is also the anti-alias filter, and
+ * worm harmonics are far slower than a bin. The linear drift (polar
+ * alignment, rate offset) is removed and a Hann windowed FFT run over
+ * the bins. The strongest peak between PEC_MINPERIOD and PEC_MAXPERIOD
+ * is taken as the worm period unless one is given, and then refined
+ * against the harmonic fit's residual. The worm fundamental
+ * and PEC_HARMONICS-1 harmonics are then fitted by least squares, and
+ * the fit is written out as a PEC_SEGMENTS entry correction table,
+ * phase zero being the first sample. Only the binning and the residual
+ * touch every sample, so a night at 20Hz takes tens of milliseconds.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <math.h>
+
+#include "scope-control.h"
+#include "frame.h"
+#include "coalesce.h"
+#include "lsq.h"
+#include "rt.h"
+#include "pec.h"
+
+#define	PEC_RATE		20		/* default capture rate, Hz */
+#define	PEC_MINPERIOD	60		/* worm period search, seconds */
+#define	PEC_MAXPERIOD	1800
+#define	PEC_HARMONICS	5		/* fundamental and four harmonics */
+#define	PEC_SEGMENTS	88		/* correction table entries per worm turn */
+#define	PEC_PEAKS		5		/* spectral peaks listed */
+#define	PEC_BIN			1.0		/* seconds averaged per point for spectrum and fit */
+#define	PEC_REFINE		20		/* golden section steps on the worm period */
+#define	ARCSEC			(1296000.0 / ANGLE_FULL)	/* arcseconds per angle unit */
+
+static volatile sig_atomic_t pec_stop = 0;
+
+static void pec_signal(int sig)
+{
+	pec_stop = 1;
+}
+
+/*
+ * --pec-capture file,seconds[,hz]
+ */
+void cmd_peccapture(char *arg)
+{
+	struct pec_sample s;
+	struct sigaction old[2];
+	struct timespec stamp, wall;
+	char file[1024], buf[32], *cp;
+	double secs, hz = PEC_RATE;
+	long long next, end, period;
+	long n = 0;
+	angle_t ab[2];
+	FILE *f;
+
+	if( (cp = strchr(arg, ',')) == NULL || cp - arg >= sizeof(file) ) {
+		errlog(13, "pec-capture wants <file>,<seconds>[,<hz>]");
+		return;
+	}
+	snprintf(file, sizeof(file), "%.*s", (int)(cp - arg), arg);
+	secs = strtod(cp + 1, &cp);
+	if( *cp == ',' )
+		hz = atof(cp + 1);
+	if( secs <= 0 || hz <= 0 || hz * frame_wire_us(frame_lookup('e')) > 1e6 ) {
+		errlog(13, "pec-capture bad duration or rate (at most %.0fHz)",
+			1e6 / frame_wire_us(frame_lookup('e')));
+		return;
+	}
+	if( coalesce_query('t', buf, 2, NULL) == 2 && buf[0] == 0 )
+		fprintf(errfile, "pec-capture warning: tracking is off\n");
+	if( (f = fopen(file, "w")) == NULL ) {
+		errlog(13, "cannot create %s: %s", file, strerror(errno));
+		return;
+	}
+	pec_stop = 0;
+	catch_stop(pec_signal, old);
+	period = 1e9 / hz;
+	next = rt_now();
+	end = next + (long long)(secs * 1e9);
+	fprintf(outfile, "pec-capture %s for %gs at %gHz\n", file, secs, hz);
+	fflush(outfile);
+	for(; next < end && !pec_stop; next += period) {
+		rt_sleep_until(next);
+		if( read_position("pec-capture", 'e', 18, buf, ab, &stamp) < 0 )
+			break;
+		/* the reply's wall clock stamp moved onto the monotonic clock, which NTP does not step */
+		clock_gettime(CLOCK_REALTIME, &wall);
+		s.t = rt_now() / 1e9 - (wall.tv_sec - stamp.tv_sec) - (wall.tv_nsec - stamp.tv_nsec) / 1e9;
+		s.ra = ab[0];
+		s.dec = ab[1];
+		fwrite(&s, sizeof(s), 1, f);
+		n++;
+	}
+	restore_stop(old);
+	if( fclose(f) != 0 )
+		errlog(13, "cannot write %s", file);
+	fprintf(outfile, "pec-capture %ld samples\n", n);
+}
+
+/*
+ * Samples whose time does not move forward (a clock step in an older
+ * capture, a repeated reply, a hand edit) are dropped.
+ * Returns number of samples, -1 on error. *sp is malloc'ed.
+ */
+static long pec_load(char *file, struct pec_sample **sp)
+{
+	struct stat st;
+	long n, i, k;
+	int fd;
+
+	if( (fd = open(file, O_RDONLY)) < 0 )
+		return -1;
+	if( fstat(fd, &st) < 0 ) {
+		close(fd);
+		return -1;
+	}
+	n = st.st_size / sizeof(struct pec_sample);
+	if( (*sp = malloc(n * sizeof(struct pec_sample) + 1)) == NULL ||
+			read(fd, *sp, n * sizeof(struct pec_sample)) != n * sizeof(struct pec_sample) ) {
+		free(*sp);
+		*sp = NULL;
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	for(i = k = 0; i < n; i++)
+		if( k == 0 || (*sp)[i].t > (*sp)[k-1].t )
+			(*sp)[k++] = (*sp)[i];
+	if( k < n )
+		fprintf(errfile, "pec %s: %ld samples out of time order dropped\n", file, n - k);
+	return k;
+}
+
+/* in place radix-2 FFT, n a power of two */
+static void fft(double *re, double *im, long n)
+{
+	long i, j, k, len;
+	double wr, wi, ur, ui, xr, xi, t;
+
+	for(i = 1, j = 0; i < n; i++) {
+		for(k = n >> 1; j & k; k >>= 1)
+			j ^= k;
+		j |= k;
+		if( i < j ) {
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+	for(len = 2; len <= n; len <<= 1) {
+		wr = cos(-2*M_PI/len);
+		wi = sin(-2*M_PI/len);
+		for(i = 0; i < n; i += len) {
+			ur = 1;
+			ui = 0;
+			for(k = 0; k < len/2; k++) {
+				xr = re[i+k+len/2]*ur - im[i+k+len/2]*ui;
+				xi = re[i+k+len/2]*ui + im[i+k+len/2]*ur;
+				re[i+k+len/2] = re[i+k] - xr;
+				im[i+k+len/2] = im[i+k] - xi;
+				re[i+k] += xr;
+				im[i+k] += xi;
+				t = ur*wr - ui*wi;
+				ui = ur*wi + ui*wr;
+				ur = t;
+			}
+		}
+	}
+}
+
+/*
+ * Hann window, FFT and list the biggest peaks of the uniform series y
+ * (nb points dt apart). Returns the worm period: the strongest peak
+ * inside the search band, 0 if none.
+ */
+static double pec_spectrum(double *y, long nb, double dt)
+{
+	double *re, *im, *mag, w, wsum = 0, best = 0, period = 0, a, b, c, p;
+	long m, i, k, kmin, kmax, peak[PEC_PEAKS];
+	int np = 0, q;
+
+	for(m = 1; m < nb; m <<= 1)
+		;
+	re = calloc(m, sizeof(double));
+	im = calloc(m, sizeof(double));
+	mag = calloc(m/2 + 1, sizeof(double));
+	if( re == NULL || im == NULL || mag == NULL ) {
+		free(re); free(im); free(mag);
+		return 0;
+	}
+	for(i = 0; i < nb; i++) {
+		w = 0.5 - 0.5*cos(2*M_PI*i/(nb - 1));
+		wsum += w;
+		re[i] = w * y[i];
+	}
+	fft(re, im, m);
+	for(k = 0; k <= m/2; k++)
+		mag[k] = 2 * sqrt(re[k]*re[k] + im[k]*im[k]) / wsum;
+	/* local maxima, biggest first; ignore DC and anything under two cycles */
+	kmin = 2.0 * m / nb > 2 ? 2.0 * m / nb : 2;
+	for(k = kmin; k < m/2; k++) {
+		if( mag[k] <= mag[k-1] || mag[k] < mag[k+1] )
+			continue;
+		for(q = np; q > 0 && mag[peak[q-1]] < mag[k]; q--)
+			if( q < PEC_PEAKS )
+				peak[q] = peak[q-1];
+		if( q < PEC_PEAKS ) {
+			peak[q] = k;
+			if( np < PEC_PEAKS )
+				np++;
+		}
+	}
+	for(q = 0; q < np; q++)
+		fprintf(outfile, "pec peak period %8.1fs amplitude %6.2f\"\n",
+			m*dt / peak[q], mag[peak[q]]);
+	/* strongest peak in the worm band, refined by a parabola through its neighbours */
+	kmin = m*dt / PEC_MAXPERIOD;
+	kmax = m*dt / PEC_MINPERIOD;
+	for(k = (kmin > 1 ? kmin : 1); k <= kmax && k < m/2; k++) {
+		if( mag[k] <= best || mag[k] <= mag[k-1] || mag[k] < mag[k+1] )
+			continue;
+		best = mag[k];
+		a = mag[k-1]; b = mag[k]; c = mag[k+1];
+		p = (a - 2*b + c) != 0 ? 0.5 * (a - c) / (a - 2*b + c) : 0;
+		period = m*dt / (k + p);
+	}
+	free(re);
+	free(im);
+	free(mag);
+	return period;
+}
+
+/* cos, sin of k*ph for k = 1..PEC_HARMONICS into row[2k], row[2k+1] */
+static void harmonics(double *row, double ph)
+{
+	double c = cos(ph), s = sin(ph);
+	int k;
+
+	row[2] = c;
+	row[3] = s;
+	for(k = 2; k <= PEC_HARMONICS; k++) {
+		row[2*k] = row[2*k-2] * c - row[2*k-1] * s;
+		row[2*k+1] = row[2*k-1] * c + row[2*k-2] * s;
+	}
+}
+
+/*
+ * Fit drift and worm harmonics to the bin means for one worm period.
+ * Returns the residual sum of squares, -1 if the fit failed.
+ */
+static double pec_fit(double *bt, double *be, long *bc, long nb, double t0,
+	double mid, double span, double period, double *x)
+{
+	struct lsq fit;
+	double row[LSQ_MAX], rss = 0;
+	long b;
+	int k;
+
+	lsq_init(&fit, 2 + 2*PEC_HARMONICS);
+	for(b = 0; b < nb; b++) {
+		if( bc[b] == 0 )
+			continue;
+		row[0] = 1;
+		row[1] = (bt[b] - mid) / span;
+		harmonics(row, 2*M_PI * (bt[b] - t0) / period);
+		lsq_add(&fit, row, be[b]);
+		rss += be[b] * be[b];
+	}
+	if( lsq_solve(&fit, x) < 0 )
+		return -1;
+	/* residual straight from the normal equations: y'y - x'A'y */
+	for(k = 0; k < fit.n; k++)
+		rss -= x[k] * fit.atb[k];
+	return rss;
+}
+
+/*
+ * The FFT only places the worm to within a bin; a golden section search
+ * over the bin either side for the least residual pins it down.
+ */
+static double pec_refine(double *bt, double *be, long *bc, long nb, double t0,
+	double mid, double span, double period, double *x)
+{
+	double g = (sqrt(5) - 1) / 2, w = period * period / span;
+	double a = period - w, b = period + w, c, d, fc, fd;
+	int i;
+
+	c = b - g*(b - a);
+	d = a + g*(b - a);
+	fc = pec_fit(bt, be, bc, nb, t0, mid, span, c, x);
+	fd = pec_fit(bt, be, bc, nb, t0, mid, span, d, x);
+	for(i = 0; i < PEC_REFINE; i++) {
+		if( fc < fd ) {
+			b = d; d = c; fd = fc;
+			c = b - g*(b - a);
+			fc = pec_fit(bt, be, bc, nb, t0, mid, span, c, x);
+		} else {
+			a = c; c = d; fc = fd;
+			d = a + g*(b - a);
+			fd = pec_fit(bt, be, bc, nb, t0, mid, span, d, x);
+		}
+	}
+	return (a + b) / 2;
+}
+
+/*
+ * --pec-analyze file[,worm period seconds]
+ */
+void cmd_pecanalyze(char *arg)
+{
+	struct pec_sample *s;
+	struct lsq fit;
+	struct timespec t0, t1;
+	char file[1024], *cp;
+	double *err, *bt = NULL, *be = NULL, period = 0, x[LSQ_MAX], row[LSQ_MAX];
+	double span, mid, pe, rate, ph, rms0 = 0, rms1 = 0, r;
+	long n, nb, i, b, *bc = NULL;
+	int k, refine, npar = 2 + 2*PEC_HARMONICS;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	snprintf(file, sizeof(file), "%s", arg);
+	if( (cp = strchr(file, ',')) != NULL ) {
+		*cp++ = '\0';
+		period = atof(cp);
+	}
+	if( (n = pec_load(file, &s)) < 0 ) {
+		errlog(13, "cannot read capture %s", file);
+		return;
+	}
+	if( n < 64 || s[n-1].t <= s[0].t ) {
+		errlog(13, "pec-analyze %s: too few samples", file);
+		free(s);
+		return;
+	}
+	span = s[n-1].t - s[0].t;
+	mid = (s[0].t + s[n-1].t) / 2;
+	nb = span / PEC_BIN + 1;
+	err = malloc(n * sizeof(double));
+	bt = calloc(nb, sizeof(double));
+	be = calloc(nb, sizeof(double));
+	bc = calloc(nb, sizeof(long));
+	if( err == NULL || bt == NULL || be == NULL || bc == NULL ) {
+		errlog(13, "pec-analyze out of memory");
+		goto done;
+	}
+	/* unwrapped RA error in arcseconds, summed into bins */
+	for(err[0] = 0, i = 0; i < n; i++) {
+		if( i > 0 )
+			err[i] = err[i-1] + (int32_t)(s[i].ra - s[i-1].ra) * ARCSEC;
+		if( (b = (s[i].t - s[0].t) / PEC_BIN) < 0 || b >= nb )
+			continue;
+		bt[b] += s[i].t;
+		be[b] += err[i];
+		bc[b]++;
+	}
+	/* bin means; drift fitted on them */
+	lsq_init(&fit, 2);
+	for(b = 0; b < nb; b++) {
+		if( bc[b] == 0 )
+			continue;
+		bt[b] /= bc[b];
+		be[b] /= bc[b];
+		row[0] = 1;
+		row[1] = (bt[b] - mid) / span;
+		lsq_add(&fit, row, be[b]);
+	}
+	if( lsq_solve(&fit, x) < 0 ) {
+		errlog(13, "pec-analyze drift fit failed");
+		goto done;
+	}
+	fprintf(outfile, "pec %ld samples, %.3fs apart, %.0fs span, drift %+.4f\"/s\n",
+		n, span / (n - 1), span, x[1] / span);
+	for(i = 0; i < n; i++) {
+		err[i] -= x[0] + x[1] * (s[i].t - mid) / span;
+		rms0 += err[i] * err[i];
+	}
+	rms0 = sqrt(rms0 / n);
+	for(b = 0; b < nb; b++)
+		if( bc[b] > 0 )
+			be[b] -= x[0] + x[1] * (bt[b] - mid) / span;
+	if( (refine = (period <= 0)) ) {
+		/* gaps in the capture are bridged by the last bin seen */
+		for(b = 1; b < nb; b++)
+			if( bc[b] == 0 )
+				be[b] = be[b-1];
+		period = pec_spectrum(be, nb, PEC_BIN);
+		for(b = 0; b < nb; b++)
+			if( bc[b] == 0 )
+				be[b] = 0;
+	}
+	if( period <= 0 ) {
+		errlog(13, "pec-analyze no worm period between %ds and %ds", PEC_MINPERIOD, PEC_MAXPERIOD);
+		goto done;
+	}
+	if( refine )
+		period = pec_refine(bt, be, bc, nb, s[0].t, mid, span, period, x);
+	if( span < 2 * period )
+		fprintf(errfile, "pec-analyze warning: capture covers %.1f worm turns, want 2 or more\n",
+			span / period);
+	if( pec_fit(bt, be, bc, nb, s[0].t, mid, span, period, x) < 0 ) {
+		errlog(13, "pec-analyze harmonic fit failed");
+		goto done;
+	}
+	/* residual of the raw samples, so sample noise shows */
+	for(i = 0; i < n; i++) {
+		row[0] = 1;
+		row[1] = (s[i].t - mid) / span;
+		harmonics(row, 2*M_PI * (s[i].t - s[0].t) / period);
+		for(r = err[i], k = 0; k < npar; k++)
+			r -= x[k] * row[k];
+		rms1 += r * r;
+	}
+	rms1 = sqrt(rms1 / n);
+	fprintf(outfile, "pec worm period %.2fs, phase zero at the first sample, %.3f on the capture clock\n", period, s[0].t);
+	for(k = 1; k <= PEC_HARMONICS; k++)
+		fprintf(outfile, "pec harmonic %d amplitude %6.3f\" phase %+7.2f deg\n", k,
+			hypot(x[2*k], x[2*k+1]), atan2(x[2*k+1], x[2*k]) * 180 / M_PI);
+	fprintf(outfile, "pec rms error %.3f\" detrended, %.3f\" after correction\n", rms0, rms1);
+	fprintf(outfile, "# segment seconds correction(\") rate(\"/s)\n");
+	for(i = 0; i < PEC_SEGMENTS; i++) {
+		ph = 2*M_PI * i / PEC_SEGMENTS;
+		pe = rate = 0;
+		for(k = 1; k <= PEC_HARMONICS; k++) {
+			pe += x[2*k] * cos(k*ph) + x[2*k+1] * sin(k*ph);
+			rate += (2*M_PI*k / period) * (x[2*k+1] * cos(k*ph) - x[2*k] * sin(k*ph));
+		}
+		fprintf(outfile, "%3ld %8.2f %+8.3f %+8.4f\n", i, period * i / PEC_SEGMENTS, -pe, -rate);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(outfile, "pec analysed in %.1fms\n",
+		(t1.tv_sec - t0.tv_sec)*1e3 + (t1.tv_nsec - t0.tv_nsec)/1e6);
+done:
+	free(bc);
+	free(be);
+	free(bt);
+	free(err);
+	free(s);
+}
@@ -0,0 +1,23 @@
+/*
+ * Periodic error capture and analysis
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef PEC_H
+#define PEC_H
+
+#include "angle.h"
+
+/* one capture sample, host byte order */
+struct pec_sample {
+	double	t;			/* monotonic seconds, middle of the 'e' transaction */
+	angle_t	ra, dec;
+};
+
+void	cmd_peccapture(char *arg);
+void	cmd_pecanalyze(char *arg);
+
+#endif /* PEC_H */
@@ -0,0 +1,407 @@
+/*
+ * Night visibility planner
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * --plan targets,output[,yyyy-mm-dd] samples the 24 hours from local
+ * noon once a minute for every target and reports rise, transit and
+ * set, and the windows in which it is above the horizon mask while the
+ * Sun is below PLAN_DARK. output is a --compile-sequence source with
+ * a goto per visible target, in order of when each comes into view.
+ *
+ * The site is --site lat,lon in degrees (north, east positive) or
+ * else the hand control's ('w'). --horizon names a file of
+ * "azimuth altitude" lines in degrees, interpolated to every degree.
+ *
+ * Targets are split between one thread per CPU. Each target's sine of
+ * altitude for the whole night is a multiply-add per sample over
+ * precomputed sidereal time sines and cosines, a loop the compiler
+ * vectorises; azimuth, the only other trig, is worked out only where
+ * the altitude is inside the mask's range.
+ */
+
+#include <sys/types.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "scope-control.h"
+#include "astro.h"
+#include "trace.h"
+#include "plan.h"
+
+#define	PLAN_STEP		60			/* seconds between samples */
+#define	PLAN_SAMPLES	(86400/PLAN_STEP)
+#define	PLAN_WINDOWS	4			/* windows kept per target */
+#define	PLAN_DARK		-12.0		/* Sun altitude for darkness, nautical */
+#define	PLAN_H0			-0.5667		/* rise/set altitude, with refraction */
+#define	PLAN_THREADS	64
+
+char	*site = NULL;
+char	*horizon_file = NULL;
+
+struct plan_result {
+	float	rise, set;				/* sample index, fractional; -1 none */
+	float	maxalt;					/* sine */
+	int		minutes;				/* inside windows */
+	int		nwin;
+	short	win[PLAN_WINDOWS][2];	/* first and last sample */
+};
+
+/* shared, read-only while the workers run */
+static struct plan {
+	int		n;
+	float	*cra, *sra, *sdec, *cdec;	/* targets, structure of arrays */
+	float	cl[PLAN_SAMPLES], sl[PLAN_SAMPLES];	/* cos/sin of sidereal time */
+	char	dark[PLAN_SAMPLES];
+	float	slat, clat;
+	float	mask[360];					/* sine of minimum altitude */
+	float	mask_lo, mask_hi;
+	struct plan_result *res;
+} pl;
+
+struct plan_work {
+	pthread_t	tid;
+	int			lo, hi;
+};
+
+/*
+ * Site from --site, else from the hand control.
+ */
+int site_location(double *lat, double *lon)
+{
+	char buf[9];
+
+	if( site == NULL )
+		return read_location(buf, lat, lon);
+	if( sscanf(site, "%lf,%lf", lat, lon) != 2 || fabs(*lat) > 90 || fabs(*lon) > 180 ) {
+		errlog(17, "site wants <latitude>,<longitude> in degrees");
+		return -1;
+	}
+	return 0;
+}
+
+static int cmp_point(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* horizon mask, flat when there is no file */
+static int plan_horizon(void)
+{
+	double (*p)[2] = NULL, az, alt, f;
+	char line[256];
+	int n = 0, size = 0, i, j;
+	FILE *fp;
+
+	for(i = 0; i < 360; i++)
+		pl.mask[i] = 0;
+	if( horizon_file == NULL )
+		goto done;
+	if( (fp = fopen(horizon_file, "r")) == NULL ) {
+		errlog(17, "cannot open horizon %s: %s", horizon_file, strerror(errno));
+		return -1;
+	}
+	while( fgets(line, sizeof(line), fp) != NULL ) {
+		line[strcspn(line, "#")] = '\0';
+		if( sscanf(line, "%lf %lf", &az, &alt) != 2 )
+			continue;
+		if( alt < -90 || alt > 90 ) {
+			errlog(17, "%s altitude %g out of range", horizon_file, alt);
+			goto bad;
+		}
+		if( n == size ) {
+			size = size ? size*2 : 64;
+			if( (p = realloc(p, size*sizeof(*p))) == NULL ) {
+				errlog(17, "%s too many points", horizon_file);
+				goto bad;
+			}
+		}
+		p[n][0] = fmod(fmod(az, 360) + 360, 360);
+		p[n++][1] = alt;
+	}
+	fclose(fp);
+	if( n == 0 ) {
+		errlog(17, "%s has no azimuth altitude lines", horizon_file);
+		free(p);
+		return -1;
+	}
+	qsort(p, n, sizeof(*p), cmp_point);
+	/* interpolate between neighbours, around through north */
+	for(i = 0, j = 0; i < 360; i++) {
+		double a0, a1, h0, h1;
+
+		while( j < n && p[j][0] <= i )
+			j++;
+		if( j == 0 ) {
+			a0 = p[n-1][0] - 360; h0 = p[n-1][1];
+		} else {
+			a0 = p[j-1][0]; h0 = p[j-1][1];
+		}
+		if( j == n ) {
+			a1 = p[0][0] + 360; h1 = p[0][1];
+		} else {
+			a1 = p[j][0]; h1 = p[j][1];
+		}
+		f = (a1 > a0) ? (i - a0) / (a1 - a0) : 0;
+		pl.mask[i] = sin(DEG2RAD(h0 + f*(h1 - h0)));
+	}
+	free(p);
+done:
+	pl.mask_lo = pl.mask_hi = pl.mask[0];
+	for(i = 1; i < 360; i++) {
+		if( pl.mask[i] < pl.mask_lo ) pl.mask_lo = pl.mask[i];
+		if( pl.mask[i] > pl.mask_hi ) pl.mask_hi = pl.mask[i];
+	}
+	return 0;
+bad:
+	fclose(fp);
+	free(p);
+	return -1;
+}
+
+/* where the sine of altitude crosses s between samples j-1 and j */
+static float plan_cross(const float *sa, int j, float s)
+{
+	return j - 1 + (s - sa[j-1]) / (sa[j] - sa[j-1]);
+}
+
+static void *plan_worker(void *arg)
+{
+	struct plan_work *wp = arg;
+	float sa[PLAN_SAMPLES], s0 = sin(DEG2RAD(PLAN_H0));
+	long long t0 = TRACE_BEGIN();
+	int t, j, in, above, kept = 0;
+
+	for(t = wp->lo; t < wp->hi; t++) {
+		struct plan_result *rp = &pl.res[t];
+		float cra = pl.cra[t], sra = pl.sra[t], sdec = pl.sdec[t], cdec = pl.cdec[t];
+		float a = pl.slat*sdec, b = pl.clat*cdec, mx;
+
+		/* sin(alt) = sin(lat)sin(dec) + cos(lat)cos(dec)cos(lst - ra) */
+		for(j = 0; j < PLAN_SAMPLES; j++)
+			sa[j] = a + b*(pl.cl[j]*cra + pl.sl[j]*sra);
+		rp->rise = rp->set = -1;
+		rp->minutes = rp->nwin = 0;
+		mx = sa[0];
+		for(j = 1; j < PLAN_SAMPLES; j++) {
+			if( sa[j] > mx )
+				mx = sa[j];
+			if( rp->rise < 0 && sa[j-1] <= s0 && sa[j] > s0 )
+				rp->rise = plan_cross(sa, j, s0);
+			if( rp->set < 0 && sa[j-1] > s0 && sa[j] <= s0 )
+				rp->set = plan_cross(sa, j, s0);
+		}
+		rp->maxalt = mx;
+		if( mx <= pl.mask_lo )
+			continue;
+		for(in = 0, j = 0; j < PLAN_SAMPLES; j++) {
+			above = 0;
+			if( pl.dark[j] && sa[j] > pl.mask_lo ) {
+				if( sa[j] > pl.mask_hi )
+					above = 1;
+				else {
+					float ch = pl.cl[j]*cra + pl.sl[j]*sra, sh = pl.sl[j]*cra - pl.cl[j]*sra;
+					double az = atan2(-cdec*sh, sdec*pl.clat - cdec*pl.slat*ch);
+					int i = (int)floor(RAD2DEG(az) + 0.5);
+
+					above = sa[j] > pl.mask[(i + 360) % 360];
+				}
+			}
+			if( above ) {
+				rp->minutes += PLAN_STEP / 60;
+				if( !in ) {
+					/* past PLAN_WINDOWS only the minutes count */
+					if( (kept = rp->nwin < PLAN_WINDOWS) )
+						rp->win[rp->nwin++][0] = j;
+				}
+				if( kept )
+					rp->win[rp->nwin-1][1] = j;
+			}
+			in = above;
+		}
+	}
+	TRACE_END("plan worker", -1, t0);
+	return NULL;
+}
+
+/* UTC hh:mm of a sample index, or --:-- */
+static char *plan_time(char *buf, time_t t0, double j)
+{
+	time_t t;
+	struct tm tm;
+
+	if( j < 0 ) {
+		strcpy(buf, "--:--");
+		return buf;
+	}
+	t = t0 + (time_t)(j*PLAN_STEP + 30);
+	gmtime_r(&t, &tm);
+	strftime(buf, 8, "%H:%M", &tm);
+	return buf;
+}
+
+static struct plan_result *sort_res;
+static int cmp_start(const void *a, const void *b)
+{
+	const struct plan_result *x = &sort_res[*(const int *)a], *y = &sort_res[*(const int *)b];
+
+	return x->win[0][0] - y->win[0][0];
+}
+
+/*
+ * --plan targets,output[,yyyy-mm-dd]
+ */
+void cmd_plan(char *arg)
+{
+	struct plan_work work[PLAN_THREADS];
+	struct timespec c0, c1;
+	struct tm tm;
+	angle_t (*t)[2] = NULL;
+	char **names = NULL, file[1024], out[1024], date[16], b1[32], b2[32], b3[8], b4[8], b5[8];
+	double lat, lon, jd0, gmst0, sra, sdec, alt, az, transit;
+	time_t t0;
+	int n = 0, i, j, k, nthreads, visible, dark0 = -1, dark1 = -1, *order = NULL;
+	FILE *f;
+
+	memset(&pl, 0, sizeof(pl));
+	date[0] = '\0';
+	if( sscanf(arg, "%1023[^,],%1023[^,],%15s", file, out, date) < 2 ) {
+		errlog(17, "plan wants <targets>,<output>[,yyyy-mm-dd]");
+		return;
+	}
+	if( site_location(&lat, &lon) < 0 || plan_horizon() < 0 )
+		return;
+	/* the night is the 24 hours from local mean noon */
+	if( date[0] != '\0' ) {
+		memset(&tm, 0, sizeof(tm));
+		if( sscanf(date, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3 ) {
+			errlog(17, "plan bad date %s", date);
+			return;
+		}
+		tm.tm_year -= 1900;
+		tm.tm_mon--;
+		t0 = timegm(&tm) + 43200 - (time_t)(lon*240);
+	} else {
+		t0 = time(NULL) - 43200 + (time_t)(lon*240);
+		t0 = t0 - ((t0 % 86400) + 86400) % 86400 + 43200 - (time_t)(lon*240);
+	}
+	if( (n = read_targets(file, &t, &names)) <= 0 ) {
+		if( n == 0 )
+			errlog(17, "plan %s has no targets", file);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &c0);
+	pl.n = n;
+	pl.cra = malloc(n * sizeof(float));
+	pl.sra = malloc(n * sizeof(float));
+	pl.sdec = malloc(n * sizeof(float));
+	pl.cdec = malloc(n * sizeof(float));
+	pl.res = malloc(n * sizeof(struct plan_result));
+	order = malloc(n * sizeof(int));
+	if( pl.cra == NULL || pl.sra == NULL || pl.sdec == NULL || pl.cdec == NULL || pl.res == NULL || order == NULL ) {
+		errlog(17, "plan out of memory");
+		goto done;
+	}
+	for(i = 0; i < n; i++) {
+		double ra = t[i][0] * (2*M_PI / ANGLE_FULL), dec = (int32_t)t[i][1] * (2*M_PI / ANGLE_FULL);
+
+		pl.cra[i] = cos(ra);
+		pl.sra[i] = sin(ra);
+		pl.sdec[i] = sin(dec);
+		pl.cdec[i] = cos(dec);
+	}
+	pl.slat = sin(DEG2RAD(lat));
+	pl.clat = cos(DEG2RAD(lat));
+	jd0 = astro_jd(t0);
+	gmst0 = astro_gmst(jd0);
+	for(j = 0; j < PLAN_SAMPLES; j++) {
+		double jd = jd0 + j*PLAN_STEP/86400.0;
+		double lst = gmst0 + DEG2RAD(lon) + 2*M_PI*ASTRO_SIDEREAL*j*PLAN_STEP/86400.0;
+
+		pl.cl[j] = cos(lst);
+		pl.sl[j] = sin(lst);
+		astro_sun(jd, &sra, &sdec);
+		astro_altaz(lst, DEG2RAD(lat), sra, sdec, &alt, &az);
+		if( (pl.dark[j] = alt < DEG2RAD(PLAN_DARK)) ) {
+			if( dark0 < 0 )
+				dark0 = j;
+			dark1 = j;
+		}
+	}
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if( nthreads > PLAN_THREADS )
+		nthreads = PLAN_THREADS;
+	if( nthreads > (n + 255) / 256 )
+		nthreads = (n + 255) / 256;
+	if( nthreads < 1 )
+		nthreads = 1;
+	for(i = 0; i < nthreads; i++) {
+		work[i].lo = (long)n * i / nthreads;
+		work[i].hi = (long)n * (i + 1) / nthreads;
+		if( i > 0 && pthread_create(&work[i].tid, NULL, plan_worker, &work[i]) != 0 ) {
+			errlog(17, "plan cannot start thread");
+			for(k = 1; k < i; k++)
+				pthread_join(work[k].tid, NULL);
+			goto done;
+		}
+	}
+	plan_worker(&work[0]);
+	for(i = 1; i < nthreads; i++)
+		pthread_join(work[i].tid, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &c1);
+	for(visible = 0, i = 0; i < n; i++)
+		if( pl.res[i].nwin > 0 )
+			order[visible++] = i;
+	sort_res = pl.res;
+	qsort(order, visible, sizeof(int), cmp_start);
+	gmtime_r(&t0, &tm);
+	strftime(b3, sizeof(b3), "%m-%d", &tm);
+	fprintf(outfile, "plan %04d-%s site %+.4f %+.4f, dark %s-%s UTC, %d of %d targets visible, %.1fms on %d threads\n",
+		tm.tm_year + 1900, b3, lat, lon, plan_time(b1, t0, dark0), plan_time(b2, t0, dark1),
+		visible, n, (c1.tv_sec - c0.tv_sec)*1e3 + (c1.tv_nsec - c0.tv_nsec)/1e6, nthreads);
+	if( (f = fopen(out, "w")) == NULL ) {
+		errlog(17, "cannot create %s: %s", out, strerror(errno));
+		goto done;
+	}
+	fprintf(f, "# plan from %s for %04d-%s, site %+.4f %+.4f; times UTC\n", file, tm.tm_year + 1900, b3, lat, lon);
+	for(k = 0; k < visible; k++) {
+		struct plan_result *rp = &pl.res[i = order[k]];
+		double ra = t[i][0] * (2*M_PI / ANGLE_FULL);
+
+		/* next upper culmination after t0 */
+		transit = RAD2DEG(astro_wrap(ra - gmst0 - DEG2RAD(lon))) / 360 * 86400 / ASTRO_SIDEREAL / PLAN_STEP;
+		fprintf(outfile, "%-20s rise %s transit %s set %s max %5.1fd visible %4dmin",
+			names[i], plan_time(b3, t0, rp->rise), plan_time(b4, t0, transit),
+			plan_time(b5, t0, rp->set), RAD2DEG(asin(rp->maxalt)), rp->minutes);
+		for(j = 0; j < rp->nwin; j++)
+			fprintf(outfile, " %s-%s", plan_time(b1, t0, rp->win[j][0]), plan_time(b2, t0, rp->win[j][1]));
+		fprintf(outfile, "\n");
+		convert2hhmmss(b1, t[i][0], ANGLE_HOUR, 0);
+		convert2hhmmss(b2, t[i][1], ANGLE_DEG, 1);
+		fprintf(f, "# %s from %s", names[i], plan_time(b3, t0, rp->win[0][0]));
+		fprintf(f, " to %s\ngoto ra %s %s\n", plan_time(b3, t0, rp->win[0][1]), b1, b2);
+	}
+	if( fclose(f) != 0 )
+		errlog(17, "cannot write %s", out);
+done:
+	for(i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+	free(t);
+	free(order);
+	free(pl.res);
+	free(pl.cdec);
+	free(pl.sdec);
+	free(pl.sra);
+	free(pl.cra);
+}
@@ -0,0 +1,18 @@
+/*
+ * Night visibility planner
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef PLAN_H
+#define PLAN_H
+
+extern char	*site;
+extern char	*horizon_file;
+
+int		site_location(double *lat, double *lon);
+void	cmd_plan(char *arg);
+
+#endif /* PLAN_H */
@@ -0,0 +1,375 @@
+/*
+ * Pointing model from sync and plate solve observations
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * With --pointing-log set, every --sync and --pointing-add (a plate
+ * solve: where the telescope really points) appends the true position,
+ * where the mount thinks it points and the time. A sync moves the
+ * mount's zero point, so a model is best built from plate solves taken
+ * between syncs rather than across them.
+ *
+ * --fit-pointing log,model[,terms] fits the TPOINT terms, mount minus
+ * true, in arcseconds; with a the hour angle (azimuth) and b the
+ * declination (altitude):
+ *	dA cos b = IH cos b + CH + NP sin b - MA cos a sin b + ME sin a sin b
+ *	db       = ID + MA sin a + ME cos a
+ * Both rows are on-sky distances, so the fit is by lsq.c directly.
+ * --pointing-model loads the result and do_goto() moves every goto of
+ * the model's frame ('r' or 'b') by it before the frame is built.
+ * Equatorial models need the site (see --site) for hour angles.
+ */
+
+#include <sys/types.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
+#include "scope-control.h"
+#include "astro.h"
+#include "lsq.h"
+#include "plan.h"
+#include "pmodel.h"
+
+#define	PMODEL_ARCSEC	(1296000.0 / ANGLE_FULL)	/* arcseconds per angle unit */
+#define	PMODEL_MINCOS	0.01		/* sec/tan terms are held here near the pole */
+
+char	*pointing_log = NULL;
+char	*pointing_model = NULL;
+
+static char *term_names[PMODEL_TERMS] = { "IH", "ID", "CH", "NP", "MA", "ME" };
+
+/* loaded model */
+static int model_loaded = 0;
+static char model_frame;
+static double model[PMODEL_TERMS];
+static double site_lat, site_lon;
+
+struct pm_point {
+	double	a, b;			/* radians, hour angle or azimuth, dec or alt */
+	double	d1, d2;			/* mount minus true, arcseconds */
+};
+
+static double rad(angle_t v, int sign)
+{
+	return (sign ? (int32_t)v : v) * (2*M_PI / ANGLE_FULL);
+}
+
+/* local sidereal time at a unix time */
+static double pm_lst(double when)
+{
+	return astro_wrap(astro_gmst(astro_jd(when)) + DEG2RAD(site_lon));
+}
+
+/* model offsets at a, b in arcseconds */
+static void pm_eval(const double *c, double a, double b, double *d1, double *d2)
+{
+	double cb = cos(b), sb = sin(b);
+
+	if( fabs(cb) < PMODEL_MINCOS )
+		cb = (cb < 0) ? -PMODEL_MINCOS : PMODEL_MINCOS;
+	*d1 = c[0] + (c[2] + c[3]*sb - c[4]*cos(a)*sb + c[5]*sin(a)*sb) / cb;
+	*d2 = c[1] + c[4]*sin(a) + c[5]*cos(a);
+}
+
+/* the two rows' basis functions, dA row scaled by cos b */
+static void pm_rows(double a, double b, double *r1, double *r2)
+{
+	double cb = cos(b), sb = sin(b);
+
+	r1[0] = cb;	r1[1] = 0;	r1[2] = 1;	r1[3] = sb;	r1[4] = -cos(a)*sb;	r1[5] = sin(a)*sb;
+	r2[0] = 0;	r2[1] = 1;	r2[2] = 0;	r2[3] = 0;	r2[4] = sin(a);		r2[5] = cos(a);
+}
+
+/*
+ * Append an observation: truth is where the telescope points, the
+ * mount's idea is read now. frame is 'r' or 'b'.
+ */
+int pmodel_record(char *name, char frame, angle_t *truth)
+{
+	struct timespec ts;
+	angle_t mount[2];
+	char buf[32], t1[32], t2[32], m1[32], m2[32];
+	int hour = (frame == 'r') ? ANGLE_HOUR : ANGLE_DEG;
+	FILE *f;
+
+	if( read_position(name, frame == 'r' ? 'e' : 'z', 18, buf, mount, NULL) < 0 )
+		return -1;
+	if( (f = fopen(pointing_log, "a")) == NULL ) {
+		errlog(18, "%s cannot open %s: %s", name, pointing_log, strerror(errno));
+		return -1;
+	}
+	convert2hhmmss(t1, truth[0], hour, 0);
+	convert2hhmmss(t2, truth[1], ANGLE_DEG, 1);
+	convert2hhmmss(m1, mount[0], hour, 0);
+	convert2hhmmss(m2, mount[1], ANGLE_DEG, 1);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	fprintf(f, "%c %.3f %s %s %s %s\n", frame, ts.tv_sec + ts.tv_nsec/1e9, t1, t2, m1, m2);
+	if( fclose(f) != 0 ) {
+		errlog(18, "%s cannot write %s", name, pointing_log);
+		return -1;
+	}
+	fprintf(outfile, "%s recorded %s %s, mount at %s %s\n", name, t1, t2, m1, m2);
+	return 0;
+}
+
+/*
+ * --pointing-add [azalt:]position, a plate solve of where the telescope is
+ */
+void cmd_pointingadd(char *arg)
+{
+	angle_t truth[2];
+	char frame = 'r';
+
+	if( pointing_log == NULL ) {
+		errlog(18, "pointing-add wants --pointing-log first");
+		return;
+	}
+	if( strncmp(arg, "azalt:", 6) == 0 ) {
+		frame = 'b';
+		arg += 6;
+	}
+	if( convert2position(arg, ANGLE_HOUR, &truth[0], &truth[1]) < 0 ) {
+		errlog(18, "pointing-add invalid position `%s'", arg);
+		return;
+	}
+	pmodel_record("pointing-add", frame, truth);
+}
+
+/* read the log, points of the first frame seen; returns count or -1 */
+static int pm_read_log(char *file, struct pm_point **pp, char *framep)
+{
+	struct pm_point *p = NULL;
+	angle_t v[4];
+	char line[256], frame, *cp;
+	double when;
+	int n = 0, size = 0, lineno = 0, i, err, have_site = 0;
+	FILE *f;
+
+	*framep = 0;
+	if( (f = fopen(file, "r")) == NULL ) {
+		errlog(18, "cannot open %s: %s", file, strerror(errno));
+		return -1;
+	}
+	while( fgets(line, sizeof(line), f) != NULL ) {
+		lineno++;
+		for(cp = line; isspace(*cp); cp++)
+			;
+		if( *cp == '\0' || *cp == '#' )
+			continue;
+		if( sscanf(cp, "%c %lf", &frame, &when) != 2 || (frame != 'r' && frame != 'b') ) {
+			errlog(18, "%s:%d bad observation", file, lineno);
+			goto bad;
+		}
+		cp = strchr(cp + 2, ' ');
+		for(i = 0, err = (cp == NULL); i < 4 && err == 0; i++)
+			v[i] = convert2angle(cp, &cp, NULL, NULL, NULL, &err);
+		if( err != 0 ) {
+			errlog(18, "%s:%d bad position", file, lineno);
+			goto bad;
+		}
+		if( *framep == 0 )
+			*framep = frame;
+		if( frame != *framep )
+			continue;
+		if( frame == 'r' && !have_site ) {
+			if( site_location(&site_lat, &site_lon) < 0 )
+				goto bad;
+			have_site = 1;
+		}
+		if( n == size ) {
+			size = size ? size*2 : 64;
+			if( (p = realloc(p, size*sizeof(*p))) == NULL ) {
+				errlog(18, "%s too many observations", file);
+				goto bad;
+			}
+		}
+		p[n].b = rad(v[1], 1);
+		p[n].d1 = (int32_t)(v[2] - v[0]) * PMODEL_ARCSEC;
+		p[n].d2 = (int32_t)(v[3] - v[1]) * PMODEL_ARCSEC;
+		if( frame == 'r' ) {
+			/* hour angle grows as right ascension falls */
+			p[n].a = pm_lst(when) - rad(v[0], 0);
+			p[n].d1 = -p[n].d1;
+		} else
+			p[n].a = rad(v[0], 0);
+		n++;
+	}
+	fclose(f);
+	*pp = p;
+	return n;
+bad:
+	fclose(f);
+	free(p);
+	return -1;
+}
+
+/* on-sky rms of what is left after a model */
+static double pm_rms(struct pm_point *p, int n, const double *c)
+{
+	double d1, d2, s = 0;
+	int i;
+
+	for(i = 0; i < n; i++) {
+		pm_eval(c, p[i].a, p[i].b, &d1, &d2);
+		d1 = (p[i].d1 - d1) * cos(p[i].b);
+		d2 = p[i].d2 - d2;
+		s += d1*d1 + d2*d2;
+	}
+	return sqrt(s / n);
+}
+
+/*
+ * --fit-pointing log,model[,terms]; terms like IH+ID+CH, default all
+ */
+void cmd_fitpointing(char *arg)
+{
+	struct pm_point *p = NULL;
+	struct lsq ls, inv;
+	struct timespec t0, t1;
+	char file[1024], out[1024], terms[64], frame;
+	double r1[PMODEL_TERMS], r2[PMODEL_TERMS], x[LSQ_MAX], e[LSQ_MAX], c[PMODEL_TERMS], se[PMODEL_TERMS];
+	double zero[PMODEL_TERMS] = { 0 }, before, after, s2;
+	int used[PMODEL_TERMS], col[PMODEL_TERMS], n, nt = 0, i, j;
+	FILE *f;
+
+	strcpy(terms, "IH+ID+CH+NP+MA+ME");
+	if( sscanf(arg, "%1023[^,],%1023[^,],%63s", file, out, terms) < 2 ) {
+		errlog(18, "fit-pointing wants <log>,<model>[,terms]");
+		return;
+	}
+	for(i = 0; i < PMODEL_TERMS; i++) {
+		used[i] = strstr(terms, term_names[i]) != NULL;
+		if( used[i] )
+			col[nt++] = i;
+	}
+	if( nt == 0 ) {
+		errlog(18, "fit-pointing no known terms in %s", terms);
+		return;
+	}
+	if( (n = pm_read_log(file, &p, &frame)) < 0 )
+		return;
+	if( 2*n < nt ) {
+		errlog(18, "fit-pointing %d observations cannot fit %d terms", n, nt);
+		free(p);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	lsq_init(&ls, nt);
+	for(i = 0; i < n; i++) {
+		pm_rows(p[i].a, p[i].b, r1, r2);
+		for(j = 0; j < nt; j++) {
+			x[j] = r1[col[j]];
+			e[j] = r2[col[j]];
+		}
+		lsq_add(&ls, x, p[i].d1 * cos(p[i].b));
+		lsq_add(&ls, e, p[i].d2);
+	}
+	inv = ls;
+	if( lsq_solve(&ls, x) < 0 ) {
+		errlog(18, "fit-pointing observations do not separate the terms %s", terms);
+		free(p);
+		return;
+	}
+	memset(c, 0, sizeof(c));
+	for(j = 0; j < nt; j++)
+		c[col[j]] = x[j];
+	before = pm_rms(p, n, zero);
+	after = pm_rms(p, n, c);
+	/* standard errors from the diagonal of (A'A)^-1, one column at a time */
+	s2 = (2*n > nt) ? after*after * n / (2*n - nt) : 0;
+	memset(se, 0, sizeof(se));
+	for(j = 0; j < nt; j++) {
+		memset(inv.atb, 0, sizeof(inv.atb));
+		inv.atb[j] = 1;
+		if( lsq_solve(&inv, e) == 0 )
+			se[col[j]] = sqrt(s2 * e[j]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(outfile, "fit-pointing %s: %d %s observations, rms %.1f\" before, %.1f\" after, %.0fus\n",
+		file, n, frame == 'r' ? "equatorial" : "azimuth/altitude", before, after,
+		(t1.tv_sec - t0.tv_sec)*1e6 + (t1.tv_nsec - t0.tv_nsec)/1e3);
+	for(i = 0; i < PMODEL_TERMS; i++)
+		if( used[i] )
+			fprintf(outfile, "\t%s %+9.1f\" +- %.1f\"\n", term_names[i], c[i], se[i]);
+	free(p);
+	if( (f = fopen(out, "w")) == NULL ) {
+		errlog(18, "cannot create %s: %s", out, strerror(errno));
+		return;
+	}
+	fprintf(f, "# pointing model from %s, %d observations, rms %.1f\" after fit\n", file, n, after);
+	fprintf(f, "frame %c\n", frame);
+	for(i = 0; i < PMODEL_TERMS; i++)
+		if( used[i] )
+			fprintf(f, "%s %.3f\n", term_names[i], c[i]);
+	if( fclose(f) != 0 )
+		errlog(18, "cannot write %s", out);
+}
+
+static int pm_load(char *name)
+{
+	char line[256], word[16];
+	double v;
+	int i;
+	FILE *f;
+
+	if( (f = fopen(pointing_model, "r")) == NULL ) {
+		errlog(18, "%s cannot open pointing model %s: %s", name, pointing_model, strerror(errno));
+		return -1;
+	}
+	memset(model, 0, sizeof(model));
+	model_frame = 0;
+	while( fgets(line, sizeof(line), f) != NULL ) {
+		if( line[0] == '#' )
+			continue;
+		if( sscanf(line, "frame %c", &model_frame) == 1 )
+			continue;
+		if( sscanf(line, "%15s %lf", word, &v) != 2 )
+			continue;
+		for(i = 0; i < PMODEL_TERMS && strcmp(word, term_names[i]) != 0; i++)
+			;
+		if( i < PMODEL_TERMS )
+			model[i] = v;
+	}
+	fclose(f);
+	if( model_frame != 'r' && model_frame != 'b' ) {
+		errlog(18, "%s %s has no frame line", name, pointing_model);
+		return -1;
+	}
+	if( model_frame == 'r' && site_location(&site_lat, &site_lon) < 0 )
+		return -1;
+	model_loaded = 1;
+	return 0;
+}
+
+/*
+ * Move a goto target from where it is to where the mount must be told
+ * to go. Gotos in the other frame are left alone. Returns -1 on error.
+ */
+int pmodel_apply(char *name, char cmd, angle_t *target)
+{
+	double a, b, d1, d2;
+	char frame = tolower(cmd);
+
+	if( pointing_model == NULL )
+		return 0;
+	if( !model_loaded && pm_load(name) < 0 )
+		return -1;
+	if( frame != model_frame )
+		return 0;
+	b = rad(target[1], 1);
+	a = (frame == 'r') ? pm_lst(time(NULL)) - rad(target[0], 0) : rad(target[0], 0);
+	pm_eval(model, a, b, &d1, &d2);
+	if( frame == 'r' )
+		d1 = -d1;
+	target[0] += (int32_t)lround(d1 / PMODEL_ARCSEC);
+	target[1] += (int32_t)lround(d2 / PMODEL_ARCSEC);
+	fprintf(outfile, "(pointing model %+.1f\" %+.1f\") ", d1, d2);
+	return 0;
+}
@@ -0,0 +1,24 @@
+/*
+ * Pointing model from sync and plate solve observations
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef PMODEL_H
+#define PMODEL_H
+
+#include "angle.h"
+
+#define	PMODEL_TERMS	6		/* IH ID CH NP MA ME */
+
+extern char	*pointing_log;
+extern char	*pointing_model;
+
+int		pmodel_record(char *name, char frame, angle_t *truth);
+int		pmodel_apply(char *name, char cmd, angle_t *target);
+void	cmd_pointingadd(char *arg);
+void	cmd_fitpointing(char *arg);
+
+#endif /* PMODEL_H */
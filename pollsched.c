@@ -0,0 +1,270 @@
+/*
+ * Fixed rate polling scheduler
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * --poll "e:10,z:5@50,L:1" runs each read-only command at its rate in
+ * Hz, first due at its phase in milliseconds. Commands without a phase
+ * are packed back to back after the start so they do not queue behind
+ * each other. Deadlines are absolute on one timerfd, so the cadence does
+ * not drift with the time each transaction takes; a command more than a
+ * period late skips the slots it missed rather than bunching up. The
+ * load the schedule puts on the serial link is checked against the
+ * frame table before anything is sent.
+ */
+
+#include <sys/types.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "scope-control.h"
+#include "frame.h"
+#include "coalesce.h"
+#include "rt.h"
+#include "estimate.h"
+#include "tlog.h"
+#include "cost.h"
+#include "trace.h"
+#include "pollsched.h"
+
+#define	POLL_TASKS		8
+#define	POLL_SAMPLES	4096	/* lateness samples kept per command */
+#define	POLL_LEADIN		10000000LL	/* ns from setup to the first deadline */
+
+struct poll_task {
+	const struct frame_desc *fp;
+	double		hz;
+	long long	period;		/* ns */
+	long long	phase;		/* ns after start, -1 to pack */
+	long long	next;		/* ns, next deadline */
+	long		count;
+	long		missed;
+	long long	late[POLL_SAMPLES];
+};
+
+double	poll_time = 0;
+
+static struct poll_task tasks[POLL_TASKS];
+static int ntasks;
+static volatile sig_atomic_t poll_stop = 0;
+
+static void poll_signal(int sig)
+{
+	poll_stop = 1;
+}
+
+/* "<cmd>:<hz>[@<phase ms>],..." */
+static int poll_parse(char *arg)
+{
+	struct poll_task *tp;
+	char *cp = arg, *end;
+
+	for(ntasks = 0; *cp != '\0'; ntasks++) {
+		if( ntasks == POLL_TASKS ) {
+			errlog(12, "poll at most %d commands", POLL_TASKS);
+			return -1;
+		}
+		tp = &tasks[ntasks];
+		memset(tp, 0, sizeof(*tp));
+		if( !coalesce_able(cp[0]) || cp[1] != ':' ) {
+			errlog(12, "poll `%c' is not a read-only query", cp[0]);
+			return -1;
+		}
+		tp->fp = frame_lookup(cp[0]);
+		tp->hz = strtod(cp + 2, &end);
+		if( tp->hz <= 0 || tp->hz > 1000 ) {
+			errlog(12, "poll bad rate for `%c'", cp[0]);
+			return -1;
+		}
+		tp->period = 1e9 / tp->hz;
+		tp->phase = -1;
+		if( *end == '@' )
+			tp->phase = strtod(end + 1, &end) * 1e6;
+		if( *end != ',' && *end != '\0' ) {
+			errlog(12, "poll bad schedule at `%s'", end);
+			return -1;
+		}
+		cp = (*end == ',') ? end + 1 : end;
+	}
+	if( ntasks == 0 ) {
+		errlog(12, "poll nothing to do");
+		return -1;
+	}
+	return 0;
+}
+
+/* print one reply the way the single shot commands would */
+static void poll_print(struct poll_task *tp, char *buf, struct timespec *stamp)
+{
+	angle_t ab[2];
+	int i;
+
+	fprintf(outfile, "%ld.%06ld %c ", (long)stamp->tv_sec, stamp->tv_nsec / 1000, tp->fp->cmd);
+	switch(tp->fp->cmd) {
+	case 'e': case 'E': case 'z': case 'Z':
+		fprintf(outfile, "%s\n", decode(buf, tp->fp->cmd, ab));
+		break;
+	case 't':
+		fprintf(outfile, "%s\n", (unsigned)buf[0] < 4 ? track_modes[(int)buf[0]] : "?");
+		break;
+	case 'h':
+		fprintf(outfile, "%02d:%02d:%02d %02d/%02d/%02d\n",
+			buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
+		break;
+	default:
+		for(i = 0; i < tp->fp->rlen - 1; i++)
+			fprintf(outfile, "%02X", (unsigned char)buf[i]);
+		fprintf(outfile, "\n");
+		break;
+	}
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void poll_report(double elapsed)
+{
+	struct poll_task *tp;
+	long n;
+
+	for(tp = tasks; tp < &tasks[ntasks]; tp++) {
+		n = (tp->count < POLL_SAMPLES) ? tp->count : POLL_SAMPLES;
+		fprintf(outfile, "poll %c %.2fHz achieved %.2fHz, %ld samples, %ld missed",
+			tp->fp->cmd, tp->hz, tp->count / elapsed, tp->count, tp->missed);
+		if( n > 0 ) {
+			qsort(tp->late, n, sizeof(long long), cmp_ll);
+			fprintf(outfile, ", lateness p50 %.3fms p90 %.3fms p99 %.3fms max %.3fms",
+				tp->late[n/2] / 1e6, tp->late[n*9/10] / 1e6,
+				tp->late[n*99/100] / 1e6, tp->late[n-1] / 1e6);
+		}
+		fprintf(outfile, "\n");
+	}
+}
+
+/*
+ * --dry-run: what the schedule costs, and how far its rates could be
+ * scaled together before the link is full.
+ */
+static void poll_dryrun(void)
+{
+	struct poll_task *tp;
+	double load = 0;
+	char cmd;
+
+	fprintf(outfile, "dry run, poll schedule (nothing sent):\n");
+	for(tp = tasks; tp < &tasks[ntasks]; tp++) {
+		cmd = tp->fp->cmd;
+		cost_print(&cmd, tp->hz);
+		load += tp->hz * cost_us(&cmd) / 1e6;
+	}
+	fprintf(outfile, "link utilization %.1f%%, %s by %.2f times; most it can sustain:",
+		load*100, load <= 1 ? "rates can go up" : "over", load <= 1 ? 1/load : load);
+	for(tp = tasks; tp < &tasks[ntasks]; tp++)
+		fprintf(outfile, " %c %.2fHz", tp->fp->cmd, tp->hz / load);
+	fprintf(outfile, "\n");
+}
+
+void cmd_poll(char *arg)
+{
+	struct poll_task *tp, *due;
+	struct itimerspec its;
+	struct sigaction old[2];
+	struct timespec stamp;
+	char buf[32];
+	long long start, end, pack, now, late, t;
+	double load = 0;
+	uint64_t ticks;
+	int tfd;
+
+	if( poll_parse(arg) < 0 )
+		return;
+	if( dry_run ) {
+		poll_dryrun();
+		return;
+	}
+	for(tp = tasks; tp < &tasks[ntasks]; tp++)
+		load += tp->hz * frame_wire_us(tp->fp) / 1e6;
+	if( load > 1.0 ) {
+		errlog(12, "poll schedule needs %.0f%% of the serial link", load*100);
+		return;
+	}
+	if( telemetry_log != NULL && tlog_open(telemetry_log) < 0 )
+		return;
+	if( (tfd = timerfd_create(CLOCK_MONOTONIC, 0)) < 0 ) {
+		errlog(12, "poll timerfd: %s", strerror(errno));
+		tlog_close();
+		return;
+	}
+	poll_stop = 0;
+	catch_stop(poll_signal, old);
+	fprintf(outfile, "poll serial link load %.1f%%\n", load*100);
+	start = rt_now() + POLL_LEADIN;
+	end = (poll_time > 0) ? start + (long long)(poll_time*1e9) : 0;
+	for(pack = 0, tp = tasks; tp < &tasks[ntasks]; tp++) {
+		if( tp->phase >= 0 )
+			tp->next = start + tp->phase;
+		else {
+			tp->next = start + pack;
+			pack += frame_wire_us(tp->fp) * 1000LL;
+		}
+	}
+	while( !poll_stop ) {
+		for(due = tasks, tp = tasks + 1; tp < &tasks[ntasks]; tp++)
+			if( tp->next < due->next )
+				due = tp;
+		if( end && due->next >= end )
+			break;
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = due->next / 1000000000LL;
+		its.it_value.tv_nsec = due->next % 1000000000LL;
+		timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+		if( read(tfd, &ticks, sizeof(ticks)) < 0 ) {
+			if( errno == EINTR )
+				continue;
+			errlog(12, "poll timerfd: %s", strerror(errno));
+			break;
+		}
+		now = rt_now();
+		late = now - due->next;
+		if( late >= due->period ) {
+			/* too late for this slot and maybe more; take the current one */
+			due->missed += late / due->period;
+			due->next += (late / due->period) * due->period;
+			late %= due->period;
+		}
+		rt_late(late);
+		due->late[due->count % POLL_SAMPLES] = late;
+		due->count++;
+		due->next += due->period;
+		if( coalesce_query(due->fp->cmd, buf, due->fp->rlen, &stamp) != due->fp->rlen ||
+				buf[due->fp->rlen - 1] != '#' ) {
+			errlog(12, "poll `%c' failed", due->fp->cmd);
+			break;
+		}
+		if( strchr("eEzZ", due->fp->cmd) != NULL )
+			estimate_sample(due->fp->cmd, &stamp, buf);
+		tlog_reply(due->fp->cmd, &stamp, buf, due->fp->rlen);
+		t = TRACE_BEGIN();
+		poll_print(due, buf, &stamp);
+		TRACE_END("format", due->fp->cmd, t);
+	}
+	restore_stop(old);
+	close(tfd);
+	tlog_close();
+	fflush(outfile);
+	/* ran to the end: the window is what was asked for */
+	now = (end && !poll_stop && !syserr) ? end : rt_now();
+	poll_report(now > start ? (now - start) / 1e9 : 1);
+}
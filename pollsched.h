@@ -0,0 +1,16 @@
+/*
+ * Fixed rate polling scheduler
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef POLLSCHED_H
+#define POLLSCHED_H
+
+extern double	poll_time;		/* seconds to poll for, 0 = until signalled */
+
+void	cmd_poll(char *arg);
+
+#endif /* POLLSCHED_H */
@@ -0,0 +1,178 @@
+/*
+ * Real-time scheduling for the timing critical loops
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * --realtime[=priority[@cpu,...]] asks for SCHED_FIFO, locks memory,
+ * pre-faults stack and heap, optionally pins to CPUs, and then measures
+ * wakeup latency so the user can see what the box actually delivers.
+ * Each step that is refused (usually EPERM without CAP_SYS_NICE or a
+ * memlock limit) is reported and the rest carry on.
+ *
+ * All of it lasts for the rest of the process, not just the timing
+ * loops: the scheduling class, the locked memory, and malloc() being
+ * told never to give memory back or to use mmap() for big blocks, so
+ * every later allocation comes from the locked, pre-faulted heap. Put
+ * --realtime just before the options that need it.
+ *
+ * Timed waits everywhere go through rt_sleep_until() and timer
+ * wakeups report in with rt_late(), so the lateness seen during the
+ * run can be reported at the end whether or not real-time was granted.
+ */
+
+#define	_GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <malloc.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rt.h"
+
+#define	RT_PRIORITY		50			/* SCHED_FIFO default, below kernel irq threads */
+#define	RT_STACK		(256*1024)	/* stack pre-faulted */
+#define	RT_HEAP			(1024*1024)	/* heap pre-faulted and kept */
+#define	RT_SAMPLES		4096		/* lateness samples kept */
+#define	RT_PROBES		200			/* 1ms sleeps measured at start */
+
+int	rt_enabled = 0;
+
+/* most recent RT_SAMPLES wakeup latencies, ns; static so mlockall pins it */
+static long long rt_samples[RT_SAMPLES];
+static long rt_count = 0;
+
+long long rt_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+void rt_late(long long ns)
+{
+	rt_samples[rt_count++ % RT_SAMPLES] = ns;
+}
+
+/* sleep to an absolute CLOCK_MONOTONIC time in ns and record how late we woke */
+void rt_sleep_until(long long deadline)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline / 1000000000LL;
+	ts.tv_nsec = deadline % 1000000000LL;
+	while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR )
+		;
+	rt_late(rt_now() - deadline);
+}
+
+void rt_sleep(long long ns)
+{
+	if( ns > 0 )
+		rt_sleep_until(rt_now() + ns);
+}
+
+static int cmp_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* percentiles of the kept samples, microseconds; clears them */
+static void rt_summary(FILE *f, char *what)
+{
+	static long long sorted[RT_SAMPLES];
+	long n = (rt_count < RT_SAMPLES) ? rt_count : RT_SAMPLES;
+
+	if( n == 0 )
+		return;
+	memcpy(sorted, rt_samples, n * sizeof(long long));
+	qsort(sorted, n, sizeof(long long), cmp_ll);
+	fprintf(f, "%s wakeup latency over %ld: p50 %.1fus p99 %.1fus p99.9 %.1fus max %.1fus\n",
+		what, rt_count, sorted[n/2] / 1e3, sorted[n*99/100] / 1e3,
+		sorted[n*999/1000] / 1e3, sorted[n-1] / 1e3);
+	rt_count = 0;
+}
+
+/* touch pages now so the first real use does not take a fault */
+static void rt_prefault()
+{
+	char stack[RT_STACK], *heap;
+	volatile char *vp = stack;	/* so the stores are not optimised away */
+	int i;
+
+	for(i = 0; i < RT_STACK; i += 4096)
+		vp[i] = 0;
+	/* keep freed heap in the process instead of handing it back; for good */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if( (heap = malloc(RT_HEAP)) != NULL ) {
+		for(i = 0; i < RT_HEAP; i += 4096)
+			heap[i] = 0;
+		free(heap);
+	}
+}
+
+/*
+ * arg is NULL or "[priority][@cpu[,cpu...]]". Reports each step on f.
+ * Returns the number of steps that were refused.
+ */
+int rt_enable(FILE *f, char *arg)
+{
+	struct sched_param sp;
+	cpu_set_t cpus;
+	char *cp;
+	int prio = RT_PRIORITY, cpu, failed = 0, i;
+
+	if( arg != NULL && *arg != '@' && *arg != '\0' )
+		prio = atoi(arg);
+	if( prio < sched_get_priority_min(SCHED_FIFO) || prio > sched_get_priority_max(SCHED_FIFO) ) {
+		fprintf(f, "realtime priority %d out of range\n", prio);
+		return 1;
+	}
+	if( arg != NULL && (cp = strchr(arg, '@')) != NULL ) {
+		CPU_ZERO(&cpus);
+		for(cp++; *cp != '\0'; cp += strspn(cp, ",")) {
+			cpu = strtol(cp, &cp, 10);
+			if( cpu >= 0 && cpu < CPU_SETSIZE )
+				CPU_SET(cpu, &cpus);
+			if( *cp != ',' && *cp != '\0' )
+				break;
+		}
+		if( sched_setaffinity(0, sizeof(cpus), &cpus) < 0 ) {
+			fprintf(f, "realtime cpu affinity refused: %s\n", strerror(errno));
+			failed++;
+		}
+	}
+	if( mlockall(MCL_CURRENT|MCL_FUTURE) < 0 ) {
+		fprintf(f, "realtime mlockall refused: %s\n", strerror(errno));
+		failed++;
+	}
+	rt_prefault();
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = prio;
+	if( sched_setscheduler(0, SCHED_FIFO, &sp) < 0 ) {
+		fprintf(f, "realtime SCHED_FIFO %d refused: %s\n", prio, strerror(errno));
+		failed++;
+	}
+	rt_enabled = 1;
+	rt_count = 0;
+	for(i = 0; i < RT_PROBES; i++)
+		rt_sleep(1000000);
+	rt_summary(f, failed ? "realtime (partial)" : "realtime");
+	return failed;
+}
+
+/* lateness of the timed waits since rt_enable(), if it was asked for */
+void rt_report(FILE *f)
+{
+	if( rt_enabled )
+		rt_summary(f, "run");
+}
@@ -0,0 +1,23 @@
+/*
+ * Real-time scheduling for the timing critical loops
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef RT_H
+#define RT_H
+
+#include <stdio.h>
+
+extern int	rt_enabled;
+
+int		rt_enable(FILE *f, char *arg);
+long long	rt_now();
+void	rt_sleep_until(long long deadline);
+void	rt_sleep(long long ns);
+void	rt_late(long long ns);
+void	rt_report(FILE *f);
+
+#endif /* RT_H */
@@ -21,6 +21,32 @@
 #include <ctype.h>
 #include <libgen.h>
 #include <errno.h>
+#include <poll.h>
+
+#include "scope-control.h"
+#include "angle.h"
+#include "frame.h"
+#include "metrics.h"
+#include "slewplan.h"
+#include "slewhist.h"
+#include "bridge.h"
+#include "coalesce.h"
+#include "seq.h"
+#include "guide.h"
+#include "rt.h"
+#include "pollsched.h"
+#include "pec.h"
+#include "estimate.h"
+#include "tlog.h"
+#include "skyidx.h"
+#include "astro.h"
+#include "plan.h"
+#include "pmodel.h"
+#include "ephem.h"
+#include "track.h"
+#include "notify.h"
+#include "cost.h"
+#include "trace.h"
 
 /* */
 
@@ -34,6 +60,14 @@
 #define	DEV_OPEN	0
 #define	DEV_CLOSE	1
 
+/* hand control answers well inside this; anything longer is lost */
+#define	DEV_TIMEOUT	3500	/* milliseconds */
+#define	DEV_REPLY_SLACK	100	/* milliseconds past the wire time a checked reply may take */
+#define	DEV_QUIET	20		/* milliseconds of silence that end a resync drain */
+#define	DEV_RESYNCS	5		/* 'K' probes before giving up */
+#define	DEV_RETRIES	3		/* repeats of a read-only command after a resync */
+#define	GOTO_POLL	100		/* milliseconds between 'L' polls */
+
 /* commands */
 #define	OPT_ECHO		0x8001
 #define	OPT_DEVICE		0x8002
@@ -60,15 +94,54 @@
 #define	OPT_DEVVERSION	0x8017
 #define OPT_GETMODEL	0x8018
 #define	OPT_SLEW		0x8019
+#define	OPT_GOTORALIST	0x801A
+#define	OPT_GOTOAZLIST	0x801B
+#define	OPT_SLEWMODEL	0x801C
+#define	OPT_SLEWHIST	0x801D
+#define	OPT_FITSLEW		0x801E
+#define	OPT_PREDICTSLEW	0x801F
+#define	OPT_BRIDGE		0x8020
+#define	OPT_RUNSEQ		0x8021
+#define	OPT_GUIDE		0x8022
+#define	OPT_POLL		0x8023
+#define	OPT_PECCAPTURE	0x8024
+#define	OPT_SKYNEAR		0x8025
+#define	OPT_SKYCONE		0x8026
+#define	OPT_POINTADD	0x8027
+#define	OPT_TRACKBODY	0x8028
+#define	OPT_GOTOBODY	0x8029
+#define	OPT_NOTIFY		0x802A
 /* non-celestron commands */
 #define	OPT_HELP		0x7000
 #define	OPT_VERSION		0x7001
 #define	OPT_COPYRIGHT	0x7002
+#define	OPT_METRICS		0x7003
+#define	OPT_COALESCE	0x7004
+#define	OPT_COMPILESEQ	0x7005
+#define	OPT_REALTIME	0x7006
+#define	OPT_POLLTIME	0x7007
+#define	OPT_PECANALYZE	0x7008
+#define	OPT_ESTFILE		0x7009
+#define	OPT_ESTIMATE	0x700A
+#define	OPT_TLOG		0x700B
+#define	OPT_TLOGDUMP	0x700C
+#define	OPT_SKYINDEX	0x700D
+#define	OPT_BUILDSKY	0x700E
+#define	OPT_SITE		0x700F
+#define	OPT_HORIZON		0x7010
+#define	OPT_PLAN		0x7011
+#define	OPT_POINTLOG	0x7012
+#define	OPT_FITPOINT	0x7013
+#define	OPT_POINTMODEL	0x7014
+#define	OPT_EPHEMERIS	0x7015
+#define	OPT_DRYRUN		0x7016
+#define	OPT_TRACE		0x7017
 
 
 char	*devname = NULL;
 int		devfd;
 int		devstatus = -1;
+static int	dev_cmd = -1;		/* command of the last write, for tracing */
 int		syserr = 0;
 struct termios termios_new, termios_original;
 
@@ -82,6 +155,9 @@ struct option long_options[] = {
 		{"version", no_argument, 0, OPT_VERSION},
 		{"copyright", no_argument, 0, OPT_COPYRIGHT},
 		{"help", no_argument, 0, OPT_HELP},
+		{"metrics-file", required_argument, 0, OPT_METRICS},
+		{"coalesce-window", required_argument, 0, OPT_COALESCE},
+		{"realtime", optional_argument, 0, OPT_REALTIME},
 		{"echo",	required_argument,	0,	OPT_ECHO},
 		{"device",	required_argument,	0,	OPT_DEVICE},
 		{"getlocation", no_argument,	0,	OPT_GETLOC},
@@ -107,6 +183,41 @@ struct option long_options[] = {
 		{"deviceversion", required_argument, 0, OPT_DEVVERSION},
 		{"getmodel", no_argument, 0, OPT_GETMODEL},
 		{"slew", required_argument, 0, OPT_SLEW},
+		{"gotora-list", required_argument, 0, OPT_GOTORALIST},
+		{"gotoazalt-list", required_argument, 0, OPT_GOTOAZLIST},
+		{"slew-model", required_argument, 0, OPT_SLEWMODEL},
+		{"slew-history", required_argument, 0, OPT_SLEWHIST},
+		{"fit-slew-model", required_argument, 0, OPT_FITSLEW},
+		{"predict-slew", required_argument, 0, OPT_PREDICTSLEW},
+		{"bridge", required_argument, 0, OPT_BRIDGE},
+		{"compile-sequence", required_argument, 0, OPT_COMPILESEQ},
+		{"run-sequence", required_argument, 0, OPT_RUNSEQ},
+		{"guide", required_argument, 0, OPT_GUIDE},
+		{"poll", required_argument, 0, OPT_POLL},
+		{"poll-time", required_argument, 0, OPT_POLLTIME},
+		{"pec-capture", required_argument, 0, OPT_PECCAPTURE},
+		{"pec-analyze", required_argument, 0, OPT_PECANALYZE},
+		{"estimate-file", required_argument, 0, OPT_ESTFILE},
+		{"estimate", required_argument, 0, OPT_ESTIMATE},
+		{"telemetry-log", required_argument, 0, OPT_TLOG},
+		{"telemetry-dump", required_argument, 0, OPT_TLOGDUMP},
+		{"build-sky-index", required_argument, 0, OPT_BUILDSKY},
+		{"sky-index", required_argument, 0, OPT_SKYINDEX},
+		{"sky-near", required_argument, 0, OPT_SKYNEAR},
+		{"sky-cone", required_argument, 0, OPT_SKYCONE},
+		{"site", required_argument, 0, OPT_SITE},
+		{"horizon", required_argument, 0, OPT_HORIZON},
+		{"plan", required_argument, 0, OPT_PLAN},
+		{"pointing-log", required_argument, 0, OPT_POINTLOG},
+		{"pointing-add", required_argument, 0, OPT_POINTADD},
+		{"fit-pointing", required_argument, 0, OPT_FITPOINT},
+		{"pointing-model", required_argument, 0, OPT_POINTMODEL},
+		{"track-body", required_argument, 0, OPT_TRACKBODY},
+		{"goto-body", required_argument, 0, OPT_GOTOBODY},
+		{"ephemeris", required_argument, 0, OPT_EPHEMERIS},
+		{"notify", required_argument, 0, OPT_NOTIFY},
+		{"dry-run", no_argument, 0, OPT_DRYRUN},
+		{"trace-file", required_argument, 0, OPT_TRACE},
 		{0,			0,					0,	0}
 };
 
@@ -156,11 +267,33 @@ void errlog(int type, const char *format, ...)
 	vfprintf(errfile, format, ap);
 	fprintf(errfile, "\n");
 	va_end(ap);
+	metrics_fail(type);
 	syserr = 1;
 }
 
+/*
+ * Send SIGINT and SIGTERM to handler while a loop runs, keeping what
+ * was there in old[2] for restore_stop() to put back when it is done.
+ */
+void catch_stop(void (*handler)(int), struct sigaction *old)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handler;
+	sigaction(SIGINT, &sa, &old[0]);
+	sigaction(SIGTERM, &sa, &old[1]);
+}
+
+void restore_stop(struct sigaction *old)
+{
+	sigaction(SIGINT, &old[0], NULL);
+	sigaction(SIGTERM, &old[1], NULL);
+}
+
 int dev_control(int cmd, char *serial_device)
 {
+	long long t = TRACE_BEGIN();
 
 	if( cmd == DEV_OPEN ) {
 		if( devstatus != -1 )
@@ -188,6 +321,7 @@ int dev_control(int cmd, char *serial_device)
 				if (tcsetattr(devfd,TCSAFLUSH, &termios_new) == 0) {
 					devstatus = 0;
 					devname = serial_device;
+					TRACE_END("port open", -1, t);
 					return 0;
 				}
 			}
@@ -213,61 +347,189 @@ int dev_control(int cmd, char *serial_device)
 
 int dev_write(const void *bufp, size_t len)
 {
-	return write(devfd, bufp, len);
+	long long t = TRACE_BEGIN();
+	int l;
+
+	/* main() refuses the options that send; this catches any that read the site and such */
+	if( dry_run ) {
+		errlog(0, "--dry-run, not sending `%c' to the hand control", len > 0 ? ((const char *)bufp)[0] : ' ');
+		return -1;
+	}
+	if( len > 0 && !coalesce_able(((const char *)bufp)[0]) )
+		coalesce_invalidate();
+	l = write(devfd, bufp, len);
+	metrics_tx(bufp, len, l);
+	if( len > 0 )
+		dev_cmd = ((const unsigned char *)bufp)[0];
+	TRACE_END("write", dev_cmd, t);
+	return l;
 }
 
-int dev_read(void *bufp, size_t rlen)
+/*
+ * Read exactly rlen bytes unless the hand control goes quiet for ms
+ * or the port fails. Returns the number of bytes read.
+ */
+static int dev_read_within(void *bufp, size_t rlen, int ms)
 {
-	int l, len = 0, tlen=rlen;
+	struct pollfd pfd;
+	long long t = TRACE_BEGIN();
+	int l, len = 0, timeout = 0;
 
-	while((l = read(devfd, &((char*)bufp)[len], rlen)) != rlen) {
-		rlen -= l;
+	pfd.fd = devfd;
+	pfd.events = POLLIN;
+	while( len < rlen ) {
+		if( (l = poll(&pfd, 1, ms)) <= 0 ) {
+			timeout = (l == 0);
+			break;
+		}
+		if( (l = read(devfd, &((char*)bufp)[len], rlen - len)) <= 0 )
+			break;
 		len += l;
 	}
-	return tlen;
+	metrics_rx(bufp, rlen, len, timeout);
+	TRACE_END("reply", dev_cmd, t);
+	return len;
 }
 
-void cmd_echo(char *arg)
+/*
+ * Read exactly rlen bytes unless the hand control goes quiet for
+ * DEV_TIMEOUT or the port fails. Returns the number of bytes read.
+ */
+int dev_read(void *bufp, size_t rlen)
 {
-	static char buf[2];
+	return dev_read_within(bufp, rlen, DEV_TIMEOUT);
+}
+
+/*
+ * Get back in step with the hand control: throw away whatever is
+ * arriving until the line has been quiet for DEV_QUIET, then echo a
+ * probe character with 'K' until it comes back as the whole reply.
+ * The probe changes every try so a late echo cannot pass for a new one.
+ * Returns 0, -1 if the hand control never answered properly.
+ */
+int dev_resync(void)
+{
+	static char probe = 'a';
+	struct pollfd pfd;
+	char buf[64], frame[2];
+	long long t = TRACE_BEGIN();
 	int i;
 
-	buf[0] = 'K';
-	buf[1] = arg[0];
-	if( dev_write(buf, 2) != 2) {
-		errlog(1, "cmd_echo failed to write");
-		return;
+	pfd.fd = devfd;
+	pfd.events = POLLIN;
+	for(i = 0; i < DEV_RESYNCS; i++) {
+		while( poll(&pfd, 1, DEV_QUIET) > 0 )
+			if( read(devfd, buf, sizeof(buf)) <= 0 )
+				return -1;
+		frame[0] = 'K';
+		frame[1] = probe;
+		probe = (probe == 'z') ? 'a' : probe + 1;
+		if( dev_write(frame, 2) != 2 )
+			return -1;
+		if( dev_read_within(buf, 2, DEV_REPLY_SLACK) == 2 && frame_reply_ok(frame, buf, 2) ) {
+			TRACE_END("resync", -1, t);
+			return 0;
+		}
+	}
+	TRACE_END("resync", -1, t);
+	return -1;
+}
+
+/*
+ * 1 if the port is no longer there to talk to: never opened, closed,
+ * or hung up (a USB adapter pulled, the other end of a pty gone), as
+ * against a hand control that is only not answering.
+ */
+int dev_gone(void)
+{
+	struct pollfd pfd;
+
+	if( devfd < 0 )
+		return 1;
+	pfd.fd = devfd;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLHUP|POLLERR|POLLNVAL));
+}
+
+/*
+ * One command/reply transaction with the reply checked for shape
+ * (frame_reply_ok()). A reply that is short, long or garbled means
+ * the link slipped: it is brought back in step with dev_resync() and
+ * a read-only command is tried again, up to DEV_RETRIES times. Any
+ * other command is not repeated, since it may already have acted, and
+ * is given the full DEV_TIMEOUT. A read-only reply is due within its
+ * wire time plus DEV_REPLY_SLACK, so a lost byte costs a fraction of a
+ * second rather than DEV_TIMEOUT.
+ * Returns rlen, or -1 with the link in step (if it can be) on failure.
+ */
+int dev_transact(const char *frame, int wlen, char *reply, int rlen)
+{
+	const struct frame_desc *fp = frame_lookup(frame[0]);
+	int try, ms = DEV_TIMEOUT, again;
+
+	if( (again = (fp != NULL && (fp->flags & FRAME_READ))) )
+		ms = frame_wire_us(fp) / 1000 + DEV_REPLY_SLACK;
+	for(try = 0; ; try++) {
+		if( dev_write(frame, wlen) != wlen )
+			return -1;
+		if( dev_read_within(reply, rlen, ms) == rlen && frame_reply_ok(frame, reply, rlen) )
+			return rlen;
+		metrics_resync(frame[0], 0);
+		if( dev_resync() < 0 ) {
+			errlog(21, "hand control not answering after `%c', cannot resync", frame[0]);
+			return -1;
+		}
+		if( !again || try == DEV_RETRIES )
+			return -1;
+		metrics_resync(frame[0], 1);
 	}
-	if( dev_read(buf, 2) != 2) {
-		errlog(1, "cmd_echo failed to read");
+}
+
+void cmd_echo(char *arg)
+{
+	char frame[2] = { 'K', arg[0] }, buf[2];
+
+	if( dev_transact(frame, 2, buf, 2) != 2 ) {
+		errlog(1, "cmd_echo failed");
 		return;
 	}
 	fprintf(outfile, "cmdecho read %c%c\n", buf[0], buf[1]);
 }
 
+/*
+ * Read the site from the hand control as degrees, north and east
+ * positive. buf gets the raw 9 byte reply. Returns -1 on failure.
+ */
+int read_location(char *buf, double *lat, double *lon)
+{
+	if( dev_transact("w", 1, buf, 9) != 9 ) {
+		errlog(2, "cmd_getloc failed to read");
+		return -1;
+	}
+	location_decode(buf, lat, lon);
+	return 0;
+}
+
 void cmd_getloc()
 {
 	char	buf[9];
+	unsigned char *u = (unsigned char *)buf;
+	double	lat, lon;
 
-	if(dev_write("w", 1) != 1 ) {
-		errlog(2, "cmd_getloc failed to write");
+	if( read_location(buf, &lat, &lon) < 0 )
 		return;
-	}
-	if(dev_read(buf, 9) != 9 ) {
-		errlog(2, "cmd_getloc failed to read");
-		return;
-	}
 	fprintf(outfile, "Location %s %02dd %02dm %02ds %c %03dd %02dm %02ds %c\n",
 		buf[8] == '#' ? "valid" : "invalid",
-		buf[0], buf[1], buf[2], buf[3] == 0 ? 'N' : 'S',
-		buf[4], buf[5], buf[6], buf[7] == 0 ? 'E' : 'W');
+		u[0], u[1], u[2], u[3] == 0 ? 'N' : 'S',
+		u[4], u[5], u[6], u[7] == 0 ? 'E' : 'W');
 }
 
 void cmd_setloc(char *str)
 {
 	int lon_d, lon_m, lon_s, lon_ew, lat_d, lat_m, lat_s, lat_ns;
 	int c;
-	char buf[9];
+	char buf[9], reply;
+	unsigned char v[8];
 
 	c = sscanf(str, "%d %d %d %d %d %d",
 		&lat_d, &lat_m, &lat_s, &lon_d, &lon_m, &lon_s);
@@ -285,35 +547,26 @@ void cmd_setloc(char *str)
 		lon_d = -lon_d;
 	} else
 		lon_ew = 0; /* east */
-	buf[0] = 'W';
-	buf[1] = lat_d;
-	buf[2] = lat_m;
-	buf[3] = lat_s;
-	buf[4] = lat_ns;
-	buf[5] = lon_d;
-	buf[6] = lon_m;
-	buf[7] = lon_s;
-	buf[8] = lon_ew;
-	if ( dev_write(buf, 9) != 9 ) {
-		errlog(3, "cmd_setloc return error on write");
-		return;
-	}
-	if( dev_read(buf, 1) != 1 ) {
+	v[0] = lat_d;
+	v[1] = lat_m;
+	v[2] = lat_s;
+	v[3] = lat_ns;
+	v[4] = lon_d;
+	v[5] = lon_m;
+	v[6] = lon_s;
+	v[7] = lon_ew;
+	if( dev_transact(buf, settings_frame(buf, 'W', v), &reply, 1) != 1 ) {
 		errlog(3, "cmd_setloc returned error on read");
 		return;
 	}
-	fprintf(outfile, "cmd_setloc set location %s\n", buf[0] == '#' ? "successfully" : "error");
+	fprintf(outfile, "cmd_setloc set location successfully\n");
 }
 
 void cmd_gettime()
 {
 	char	buf[9];
 
-	if(dev_write("h", 1) != 1 ) {
-		errlog(2, "cmd_getloc failed to write");
-		return;
-	}
-	if(dev_read(buf, 9) != 9 ) {
+	if( dev_transact("h", 1, buf, 9) != 9 ) {
 		errlog(2, "cmd_gettime failed to read");
 		return;
 	}
@@ -330,7 +583,8 @@ void cmd_settime(char *str)
 	struct tm *tm;
 	time_t t;
 	extern time_t timezone;
-	char buf[9];
+	char buf[9], reply;
+	unsigned char v[8];
 
 	if( strcmp("localtime", str) == 0 ) {
 		t = time(NULL);
@@ -351,24 +605,19 @@ void cmd_settime(char *str)
 			return;
 		}
 	}
-	buf[0] = 'H';
-	buf[1] = hour;
-	buf[2] = min;
-	buf[3] = sec;
-	buf[4] = mon;
-	buf[5] = day;
-	buf[6] = year;
-	buf[7] = gmtoffs;
-	buf[8] = dst;
-	if ( dev_write(buf, 9) != 9 ) {
-		errlog(4, "cmd_settime return error on write");
-		return;
-	}
-	if( dev_read(buf, 1) != 1 ) {
+	v[0] = hour;
+	v[1] = min;
+	v[2] = sec;
+	v[3] = mon;
+	v[4] = day;
+	v[5] = year;
+	v[6] = gmtoffs;
+	v[7] = dst;
+	if( dev_transact(buf, settings_frame(buf, 'H', v), &reply, 1) != 1 ) {
 		errlog(4, "cmd_settime returned error on read");
 		return;
 	}
-	fprintf(outfile, "cmd_settime set time/date %s\n", buf[0] == '#' ? "successfully" : "error");
+	fprintf(outfile, "cmd_settime set time/date successfully\n");
 }
 
 /*
@@ -384,21 +633,20 @@ char	*track_modes[] = { "Off", "Alt-Azimuth", "EQNorth", "EQSouth"};
 
 void cmd_gettrack()
 {
-	char	buf[2], *m;
+	char	buf[2];
+	int		mode;
 
-	if(dev_write("t", 1) != 1 ) {
-		errlog(2, "cmd_gettrack failed to write");
+	if( dev_transact("t", 1, buf, 2) != 2 ) {
+		errlog(2, "cmd_gettrack failed to read");
 		return;
 	}
-	if( (dev_read(buf, 2) != 2) || (buf[1] != '#') ) {
-		errlog(2, "cmd_gettrack failed to read");
+	mode = (unsigned char)buf[0];
+	if( mode > 3 ) {
+		fprintf(outfile, "Tracking mode: Unknown (%d)\n", mode);
 		return;
 	}
-	if( buf[0] > 3 || buf[0] < 0 )
-		m = "Unknown";
-	else
-		m = track_modes[buf[0]];
-	fprintf(outfile, "Tracking mode: %s\n", m);
+	estimate_tracking(mode);
+	fprintf(outfile, "Tracking mode: %s\n", track_modes[mode]);
 }
 
 void cmd_settrack(char *type)
@@ -415,14 +663,11 @@ void cmd_settrack(char *type)
 		return;
 	}
 	cmd[1] = i;
-	if(dev_write(cmd, 2) != 2 ) {
-		errlog(2, "cmd_settrack failed to write");
-		return;
-	}
-	if( (dev_read(&buf, 1) != 1) || (buf != '#') ) {
-		errlog(2, "cmd_gettrack failed to read");
+	if( dev_transact(cmd, 2, &buf, 1) != 1 ) {
+		errlog(2, "cmd_settrack failed to read");
 		return;
 	}
+	estimate_tracking(i);
 	fprintf(outfile, "Tracking mode set to %s\n", track_modes[i]);
 }
 
@@ -430,11 +675,7 @@ void cmd_isgotoinprogress()
 {
 	char buf[2];
 
-	if(dev_write("L", 1) != 1 ) {
-		errlog(0, "cmd_isgotoinprogress failed to write");
-		return;
-	}
-	if( (dev_read(&buf, 2) != 2) || (buf[1] != '#') ) {
+	if( dev_transact("L", 1, buf, 2) != 2 ) {
 		errlog(2, "cmd_isgotinprogress failed to read");
 		return;
 	}
@@ -445,11 +686,7 @@ void cmd_isaligncomplete()
 {
 	char buf[2];
 	
-	if(dev_write("J", 1) != 1 ) {
-		errlog(0, "cmd_isaligncomplete failed to writer");
-		return;
-	}
-	if( (dev_read(&buf, 2) != 2) || (buf[1] != '#') ) {
+	if( dev_transact("J", 1, buf, 2) != 2 ) {
 		errlog(2, "cmd_isaligncomplete failed to read");
 		return;
 	}
@@ -457,222 +694,137 @@ void cmd_isaligncomplete()
 }
 
 /*
- * parse [+-]#+[dh]#+m#+[.#+]s into an angle and return
- * individual components
- * if next is not NULL *next returns pointer to next character in buffer after
- * completion or last character seen on error.
- * On error, returns NaN and contents of *dh, *min and *sec are undefined
+ * Read a position without printing it.
+ * buf receives the raw reply, at least rlen+1 bytes; stamp, if not
+ * NULL, the time it was read.
+ * Returns 0 on success, -1 on failure (already logged).
  */
-double convert2angle(char *buf, char **next, int *dh, int *min, double *sec, int *rerr)
+int read_position(char *name, char cmd, int rlen, char *buf, angle_t *ab, struct timespec *stamp)
 {
-	char *bp = buf, c;
-	int sign = 1, state = 0, type = 0, done = 0;
-	int number1=0, number2=0, number3=0;
-	double fraction=0.0,part=0.0, rvalue;
+	struct timespec ts;
+	int l;
 
-	while((c = *bp++) != 0) {
-		switch(state) {
-		case 0: /* looking for #,  + or - ; ignore space */
-			if( isspace(c) )
-				continue;
-			if( c == '+' ) {
-				sign = 1;
-				state = 1;
-				continue;
-			}
-			if( c == '-' ) {
-				sign = -1;
-				state = 1;
-				continue;
-			}
-			state = 1;
-			/* fall through to numbers only */
-		case 1:
-			if( !(c >= '0' && c <= '9') )
-				goto err;
-			for(number1 = 0; c >= '0' && c <= '9'; c = *bp++)
-				number1 = number1*10 + (c - '0');
-			state = 2;
-			--bp; /* point back to char that broke the loop */
-			break;
-		case 2: /* must be one of 'd', 'D', 'H' or 'h' */
-			if( c == 'd' || c == 'D' )
-				type = 1;
-			else if (c == 'h' || c == 'H' )
-				type = 2;
-			else
-				goto err;
-			state = 3;
-			break;
-		case 3:
-			if( isspace(c))
-				continue;
-			state = 4;
-			/* fall through */
-		case 4:
-			if( !(c >= '0' && c <= '9') )
-				goto err;
-			for(number2 = 0; c >= '0' && c <= '9'; c = *bp++)
-				number2 = number2*10 + (c - '0');
-			state = 5;
-			--bp; /* point back to char that broke the loop */
-			break;
-		case 5: /* must be m or M */
-			if( c != 'm' && c != 'M' )
-				goto err;
-			state = 6;
-			break;
-		case 6:
-			if( isspace(c))
-				break;
-			state = 7;
-			/* fall through */
-		case 7:
-			if( !(c >= '0' && c <= '9') )
-				goto err;
-			for(number3 = 0; c >= '0' && c <= '9'; c = *bp++)
-				number3 = number3*10 + (c - '0');
-			state = 8;
-			--bp; /* point back to char that broke the loop */
-			break;
-		case 8: /* must be . s or S */
-			fraction = 0.0;
-			if( c == 's' || c == 'S' ) {
-				done = 1;
-				break;
-			}
-			if( c != '.' )
-				goto err;
-			state = 9;
-			break;
-		case 9: /* grab fraction */
-			part = 0.1;
-			fraction = 0.0;
-			while( c >= '0' && c <= '9' ) {
-				fraction += ((double)(c - '0'))*part;
-				part /= 10.0;
-				c = *bp++;
-			}
-			if( c != 's' && c != 'S' )
-				goto err;
-			done = 1;
-			break;
+	if( stamp == NULL )
+		stamp = &ts;
+	memset(buf, 0, rlen+1);
+	if( (l = coalesce_query(cmd, buf, rlen, stamp)) < 0 ) {
+		errlog(5, "%s no valid reply from hand control\n", name);
+		return -1;
+	}
+	if( l != rlen ) {
+		errlog(5, "%s cannot read result\n", name);
+		return -1;
+	}
+	decode(buf, cmd, ab);
+	estimate_sample(cmd, stamp, buf);
+	return 0;
+}
+
+void cmd_getposition(char *name, char cmd, int rlen)
+{
+	char buf[20];
+	angle_t ab[2];
+	struct timespec stamp;
+	long long t;
+
+	if( read_position(name, cmd, rlen, buf, ab, &stamp) < 0 )
+		return;
+	t = TRACE_BEGIN();
+	fprintf(outfile, "%s returns %s %s", name, buf, decode(buf, cmd, ab));
+	if( coalesce_window > 0 )
+		fprintf(outfile, " at %ld.%06ld", (long)stamp.tv_sec, stamp.tv_nsec/1000);
+	fprintf(outfile, "\n");
+	TRACE_END("format", cmd, t);
+}
+
+/*
+ * Poll 'L' until the goto in progress finishes.
+ * Returns 0 when done, -1 on link failure (already logged).
+ */
+int wait_goto(char *name)
+{
+	char buf[2];
+
+	for(;;) {
+		if( dev_transact("L", 1, buf, 2) != 2 ) {
+			errlog(7, "%s lost contact waiting for goto", name);
+			return -1;
 		}
-		if( done )
-			break;
+		if( buf[0] != '1' )
+			return 0;
+		usleep(GOTO_POLL*1000);
 	}
-	if( !done )
-		goto err;
-	/* success! return values */
-	if( next )
-		*next = bp;
-	if( dh != NULL )
-		*dh = number1*sign;
-	if( min != NULL )
-		*min = number2*sign;
-	if( sec != NULL )
-		*sec = (double)sign*((double)number3 + fraction);
-	rvalue = (double)number1 + ((double)number2 + ((double)number3 + fraction)/60.0)/60.0;
-	if( type == 1 )
-		rvalue /= 360.0;
-	else /* type == 2 */
-		rvalue /= 24.0;
-	rvalue *= (double)sign;
-	*rerr = 0;
-	return rvalue;
-err:
-	if( next )
-		*next = bp;
-	/* process error here */
-	*rerr = state;
-	return 0.0;
 }
 
 /*
- * convert hhmmss or ddmmss to degrees. 
- * type==0 for ddmms type=1 for hhmmss
+ * Send a precise or 16 bit goto to target and optionally wait for it.
+ * With --slew-history set the goto is always waited for and timed, and
+ * the positions before and after are recorded. sent, if not NULL, gets
+ * the frame as it went out, pointing model applied, or "" if none did.
+ * Returns milliseconds taken (0 if not waited for), -1 on failure.
  */
-int convert2position(char *buf, int type, double *rvalue1, double *rvalue2)
-{
-	char *fmt;
-	int	dh1, min1, dh2, min2, err;
-	double second1, second2;
-
-	*rvalue1 = convert2angle(buf, &fmt, &dh1, &min1, &second1, &err);
-	*rvalue2 = convert2angle(fmt, NULL, &dh2, &min2, &second2, &err);
- 	return 0;
-}
-
-void convert2hhmmss(char *buf, double value, int hour)
-{
-	int dh, m, s, frac, minus = 0;
-	char *ticks[2] = { "dms", "hms" };
-
-	if( value < 0.0 ) {
-		minus = 1;
-		value = -value;
-	}
-	dh = floor(value); value = (value - dh)*60;
-	m  = floor(value); value = (value -  m)*60;
-	s  = floor(value); value = (value -  s)*1000;
-	frac = floor(value);
-	sprintf(buf, "%c%03d%c %02d%c %02d.%03d%c", (minus == 0) ? '+' : '-',
-		dh, ticks[hour][0], m, ticks[hour][1], s, frac, ticks[hour][2]);
-}
-
-/* decode 16 or 32 bit positional in RA or ALTAZIMUTH */
-char *decode(char *buf, char cmd, double *ab)
-{
-	long long v[2];
-	static char rbuf[64];
-	char buf1[17], buf2[17];
-	double m[2], r;
-
-	switch(cmd) {
-	default:
-		return "unimplemented";
-	case 'E': case 'Z': /* 16 bit precision */
-		v[0] = strtoll(&buf[0], NULL, 16);
-		v[1] = strtoll(&buf[5], NULL, 16);
-		ab[0] = ((double)v[0]/65536.0);
-		ab[1] = ((double)v[1]/65536.0);
-		m[0] = (cmd == 'E')  ? 24 : 360;
-		m[1] = 360;
-		break;
-	case 'e': case 'z': /* 24 bit precision */
-		v[0] = strtoll(&buf[0], NULL, 16);
-		v[1] = strtoll(&buf[9], NULL, 16);
-		ab[0] = ((double)v[0]/4294967296.0);
-		ab[1] = ((double)v[1]/4294967296.0);
-		m[0] = (cmd == 'e')  ? 24 : 360;
-		m[1] = 360;
-		break;
-	}
-	if( (r = ab[1]*m[1]) > 180.0 )
-		r =  r - 360;
-	convert2hhmmss(buf1, ab[0]*m[0], (cmd == 'e' || cmd == 'E') ? 1 : 0);
-	convert2hhmmss(buf2, ab[1] = r,  0);
-	sprintf(rbuf, "%s %s", buf1, buf2);
-	return rbuf;
+/*
+ * The position frame that follows the mount's own axes: 'z' for an
+ * Alt-Azimuth mount, 'e' for EQ, from the tracking mode.
+ * Returns -1 if the hand control does not answer.
+ */
+static int mount_frame(char *name)
+{
+	char buf[2];
+
+	if( dev_transact("t", 1, buf, 2) != 2 ) {
+		errlog(8, "%s cannot read tracking mode", name);
+		return -1;
+	}
+	/* tracking off says nothing of the mount; take it as EQ */
+	return (buf[0] == 1) ? 'z' : 'e';
 }
 
-void cmd_getposition(char *name, char cmd, int rlen)
+long do_goto(char *name, char cmd, angle_t *target, int wait, char *sent)
 {
-	char buf[20];
-	double ab[2];
-	int l, len = 0;
+	struct slew_record rec;
+	struct timespec t0, t1;
+	angle_t mount[2];
+	char buf[32], reply;
+	int len, pcmd = 0;
 
-	if(dev_write(&cmd, 1) != 1) {
-		errlog(5, "%s cannot write command\n", name);
-		return;
+	memset(&rec, 0, sizeof(rec));
+	if( sent != NULL )
+		sent[0] = '\0';
+	mount[0] = target[0];
+	mount[1] = target[1];
+	if( pmodel_apply(name, cmd, mount) < 0 )
+		return -1;
+	if( slew_history != NULL ) {
+		/* slew times follow the axes, so record where they were whatever the goto */
+		if( (pcmd = mount_frame(name)) < 0 )
+			return -1;
+		if( read_position(name, pcmd, 18, buf, rec.from, NULL) < 0 )
+			return -1;
+		wait = 1;
 	}
-	memset(buf, 0, sizeof(buf));
-	if(dev_read(&buf, rlen) != rlen ) {
-		errlog(5, "%s cannot read result\n", name);
-		return;
+	len = position_frame(buf, cmd, mount[0], mount[1]);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if( sent != NULL )
+		strcpy(sent, buf);
+	if( dev_transact(buf, len, &reply, 1) != 1 )
+		return -1;
+	if( !wait )
+		return 0;
+	if( wait_goto(name) < 0 )
+		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	rec.duration_ms = (t1.tv_sec - t0.tv_sec)*1000 + (t1.tv_nsec - t0.tv_nsec)/1000000;
+	if( slew_history != NULL ) {
+		if( read_position(name, pcmd, 18, buf, rec.to, NULL) < 0 )
+			return -1;
+		rec.when = time(NULL);
+		rec.cmd = pcmd;
+		if( slew_history_append(slew_history, &rec) < 0 )
+			fprintf(errfile, "%s cannot append to %s: %s\n", name,
+				slew_history, strerror(errno));
 	}
-	fprintf(outfile, "%s returns %s %s\n", name, buf, decode(buf, cmd, ab));
-	
+	return rec.duration_ms;
 }
 
 /*
@@ -682,60 +834,289 @@ void cmd_getposition(char *name, char cmd, int rlen)
  */
 void cmd_gotoposition(char *name, char cmd, char *optarg)
 {
-	double rvalue1, rvalue2;
-	long r1, r2;
-	char buf[32], *fmt;
+	angle_t rvalue1, rvalue2, target[2];
+	char buf[32];
+	long ms;
 
 	if( cmd == 'R' || cmd == 'r' ) {
-		if(convert2position(optarg, 1, &rvalue1, &rvalue2) < 0 )
+		if(convert2position(optarg, ANGLE_HOUR, &rvalue1, &rvalue2) < 0 ) {
+			errlog(6, "%s invalid position `%s'", name, optarg);
 			return;
+		}
 	} else {
-		if(convert2position(optarg, 0, &rvalue1, &rvalue2 )< 0 )
+		if(convert2position(optarg, ANGLE_DEG, &rvalue1, &rvalue2 )< 0 ) {
+			errlog(6, "%s invalid position `%s'", name, optarg);
 			return;
+		}
 	}
-	if (cmd == 'r' || cmd == 'b' ) { /* precise position */
-		r1 = rvalue1*4294967296.0;
-		r2 = rvalue2*4294967296.0;
-		sprintf(buf, "%c%08X,%08X", cmd, ((int)r1)&0xFFFFFFFF,
-										((int)r2)&0xFFFFFFFF);
-	} else {
-		sprintf(buf, "%c%04X,%04X", cmd, (int)(rvalue1*65536.0)&0xFFFF,
-								(int)(rvalue2*65526.0)&0xFFFF);
-	}
-	fprintf(outfile, "%s converts `%s' to `'%s' ", name, optarg, buf);
-	dev_write(buf, strlen(buf));
-	dev_read(buf, 1);
-	if( buf[0] == '#' )
-		fprintf(outfile, "success\n");
-	else
+	target[0] = rvalue1;
+	target[1] = rvalue2;
+	fprintf(outfile, "%s converts `%s' ", name, optarg);
+	ms = do_goto(name, cmd, target, 0, buf);
+	if( buf[0] != '\0' )
+		fprintf(outfile, "to `'%s' ", buf);
+	if( ms < 0 )
 		fprintf(outfile, "fail\n");
+	else if( slew_history != NULL )
+		fprintf(outfile, "success %.1fs\n", ms/1000.0);
+	else
+		fprintf(outfile, "success\n");
 }
 
 void cmd_sync(char *name, char cmd, char *optarg)
 {
-	double rvalue1, rvalue2;
-	long r1, r2;
-	char buf[32], *fmt;
+	angle_t rvalue1, rvalue2;
+	char buf[32], reply;
+	int len;
 
-	if( convert2position(optarg, 1, &rvalue1, &rvalue2) < 0 )
+	if( convert2position(optarg, ANGLE_HOUR, &rvalue1, &rvalue2) < 0 ) {
+		errlog(6, "%s invalid position `%s'", name, optarg);
 		return;
-	if (cmd == 's' ) { /* precise position */
-		r1 = rvalue1*4294967296.0;
-		r2 = rvalue2*4294967296.0;
-		sprintf(buf, "%c%08X,%08X", cmd, ((int)r1)&0xFFFFFFFF,
-										((int)r2)&0xFFFFFFFF);
-	} else {
-		sprintf(buf, "%c%04X,%04X", cmd, (int)(rvalue1*65536.0)&0xFFFF,
-								(int)(rvalue2*65526.0)&0xFFFF);
 	}
+	if( pointing_log != NULL ) {
+		angle_t truth[2] = { rvalue1, rvalue2 };
+
+		if( pmodel_record(name, 'r', truth) < 0 )
+			return;
+	}
+	len = position_frame(buf, cmd, rvalue1, rvalue2);
 	fprintf(outfile, "%s converts `%s' to `'%s' ", name, optarg, buf);
-	dev_write(buf, strlen(buf));
-	dev_read(buf, 1);
-	if( buf[0] == '#' )
+	if( dev_transact(buf, len, &reply, 1) == 1 )
 		fprintf(outfile, "success\n");
 	else
 		fprintf(outfile, "fail\n");
-	
+}
+
+/*
+ * Read a list of targets, one position per line in the same form as
+ * --gotora/--gotoazalt, anything after the position is its name.
+ * Blank lines and lines starting with '#' are skipped.
+ * Returns the number of targets or -1 on error; *targets and *names are
+ * malloc'ed.
+ */
+int read_targets(char *file, angle_t (**targets)[2], char ***names)
+{
+	FILE *f;
+	char line[256], *cp, *next, **nnm;
+	int n = 0, size = 0, err, lineno = 0;
+	angle_t (*t)[2] = NULL, (*nt)[2];
+	char **nm = NULL;
+
+	if( (f = fopen(file, "r")) == NULL ) {
+		errlog(8, "cannot open target list %s: %s", file, strerror(errno));
+		return -1;
+	}
+	while( fgets(line, sizeof(line), f) != NULL ) {
+		lineno++;
+		for(cp = line; isspace(*cp); cp++)
+			;
+		if( *cp == '\0' || *cp == '#' )
+			continue;
+		if( n == size ) {
+			size = size ? size*2 : 64;
+			if( (nt = realloc(t, size*sizeof(*t))) != NULL )
+				t = nt;
+			if( (nnm = realloc(nm, size*sizeof(char *))) != NULL )
+				nm = nnm;
+			if( nt == NULL || nnm == NULL ) {
+				errlog(8, "%s too many targets", file);
+				goto fail;
+			}
+		}
+		t[n][0] = convert2angle(cp, &next, NULL, NULL, NULL, &err);
+		if( err == 0 )
+			t[n][1] = convert2angle(next, &next, NULL, NULL, NULL, &err);
+		if( err != 0 ) {
+			errlog(8, "%s:%d bad position", file, lineno);
+			goto fail;
+		}
+		while( isspace(*next) )
+			next++;
+		next[strcspn(next, "\r\n")] = '\0';
+		nm[n++] = strdup(next);
+	}
+	fclose(f);
+	*targets = t;
+	*names = nm;
+	return n;
+fail:
+	fclose(f);
+	while( n > 0 )
+		free(nm[--n]);
+	free(t);
+	free(nm);
+	return -1;
+}
+
+/*
+ * Where the axes of the mount go for each target of an RA/Dec list.
+ * On an EQ mount they are RA and Dec already. On an Alt-Azimuth mount
+ * they are azimuth and altitude, worked out for now; the list is
+ * ordered once, so the sky turning during the run is not allowed for.
+ * Returns 'z' when axes[] has been filled with azimuth/altitude, 'e'
+ * when the targets can be costed as they are, -1 on error.
+ */
+static int mount_axes(char *name, angle_t (*targets)[2], int n, angle_t (*axes)[2])
+{
+	double lat, lon, lst, alt, az;
+	int i, frame;
+
+	if( (frame = mount_frame(name)) != 'z' )
+		return frame;
+	if( site_location(&lat, &lon) < 0 )
+		return -1;
+	lst = astro_gmst(astro_jd(time(NULL))) + DEG2RAD(lon);
+	for(i = 0; i < n; i++) {
+		astro_altaz(lst, DEG2RAD(lat), targets[i][0] * (2*M_PI/ANGLE_FULL),
+			(int32_t)targets[i][1] * (2*M_PI/ANGLE_FULL), &alt, &az);
+		axes[i][0] = (angle_t)llround(az * (ANGLE_FULL/(2*M_PI)));
+		axes[i][1] = (angle_t)(int32_t)lround(alt * (ANGLE_FULL/(2*M_PI)));
+	}
+	return 'z';
+}
+
+/*
+ * Visit every target in a list, ordered to keep total slew time down.
+ * cmd is 'r' (RA/Dec list) or 'b' (azimuth/altitude list). Slew times
+ * are costed on the mount's own axes: an RA/Dec list on an Alt-Azimuth
+ * mount is turned into azimuth/altitude first, while an azimuth/altitude
+ * list is taken as the axes whatever the mount. Azimuth and RA are
+ * taken to turn freely, the short way round: the hand control does not
+ * say where the cable wrap stands, so a goto it sends the long way to
+ * unwind takes longer than predicted.
+ */
+void cmd_gotolist(char *name, char cmd, char *file)
+{
+	angle_t (*targets)[2], (*axes)[2], start[2];
+	char **names, buf[32];
+	int n, i, *order = NULL, from = 'z';
+	double total;
+	long ms;
+
+	if( (n = read_targets(file, &targets, &names)) <= 0 )
+		return;
+	axes = targets;
+	if( cmd == 'r' ) {
+		if( (axes = malloc(n*sizeof(*axes))) == NULL ||
+				(from = mount_axes(name, targets, n, axes)) < 0 )
+			goto done;
+		if( from == 'e' ) {
+			free(axes);
+			axes = targets;
+		}
+	}
+	if( read_position(name, from, 18, buf, start, NULL) < 0 )
+		goto done;
+	if( (order = malloc(n*sizeof(int))) == NULL ||
+			(total = slew_order(&slew_model, start, axes, n, order)) < 0 ) {
+		errlog(8, "%s out of memory", name);
+		goto done;
+	}
+	fprintf(outfile, "%s %d targets, predicted slew time %.1fs\n", name, n, total);
+	for(i = 0; i < n; i++) {
+		angle_t *tp = targets[order[i]];
+		fprintf(outfile, "%s %d/%d `%s' (%.1fs) ", name, i+1, n,
+			names[order[i]], slew_time(&slew_model, start, axes[order[i]]));
+		fflush(outfile);
+		ms = do_goto(name, cmd, tp, 1, buf);
+		if( buf[0] != '\0' )
+			fprintf(outfile, "%s ", buf);
+		if( ms < 0 ) {
+			fprintf(outfile, "fail\n");
+			errlog(7, "%s goto failed", name);
+			break;
+		}
+		fprintf(outfile, "done %.1fs\n", ms/1000.0);
+		start[0] = axes[order[i]][0];
+		start[1] = axes[order[i]][1];
+	}
+done:
+	free(order);
+	if( axes != targets )
+		free(axes);
+	for(i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+	free(targets);
+}
+
+/*
+ * Fit the slew model to a goto history, use it for the rest of this run
+ * and save it next to the history as <history>.model for --slew-model.
+ * The fit uses the gotos of whichever frame, RA/Dec or azimuth/altitude,
+ * the history has more of; they should be the mount's own axes.
+ */
+void cmd_fitslewmodel(char *file)
+{
+	struct slew_record *recs;
+	char model[1024];
+	double rms;
+	int n, i, eq, cmd;
+
+	if( (n = slew_history_load(file, &recs)) < 0 ) {
+		errlog(8, "cannot read slew history %s", file);
+		return;
+	}
+	for(i = eq = 0; i < n; i++)
+		eq += recs[i].cmd == 'e';
+	cmd = (eq > n - eq) ? 'e' : 'z';
+	if( (rms = slew_fit(recs, &n, cmd, &slew_model)) < 0 ) {
+		errlog(8, "slew history %s has only %d %s gotos", file, n,
+			cmd == 'e' ? "RA/Dec" : "azimuth/altitude");
+		free(recs);
+		return;
+	}
+	free(recs);
+	snprintf(model, sizeof(model), "%s.model", file);
+	if( save_slew_model(model, &slew_model) != 0 )
+		errlog(8, "cannot write %s", model);
+	fprintf(outfile, "slew model from %d %s gotos: rate %.3f,%.3f deg/s accel %.3f,%.3f deg/s^2 "
+		"settle %.2fs rms %.2fs saved to %s\n", n, cmd == 'e' ? "RA/Dec" : "azimuth/altitude",
+		slew_model.rate[0], slew_model.rate[1], slew_model.accel[0],
+		slew_model.accel[1], slew_model.settle, rms, model);
+}
+
+/* parse "<position>;<position>" and print the predicted goto seconds */
+int predict_slew(char *str)
+{
+	angle_t from[2], to[2];
+	char *next;
+	int err;
+
+	from[0] = convert2angle(str, &next, NULL, NULL, NULL, &err);
+	if( err == 0 )
+		from[1] = convert2angle(next, &next, NULL, NULL, NULL, &err);
+	while( err == 0 && (isspace(*next) || *next == ';') )
+		next++;
+	if( err == 0 )
+		to[0] = convert2angle(next, &next, NULL, NULL, NULL, &err);
+	if( err == 0 )
+		to[1] = convert2angle(next, &next, NULL, NULL, NULL, &err);
+	if( err != 0 )
+		return -1;
+	fprintf(outfile, "%.3f\n", slew_time(&slew_model, from, to));
+	return 0;
+}
+
+/*
+ * --predict-slew "<from>;<to>", or "-" to answer one query per line from
+ * stdin for as long as it stays open; answers are flushed per line so a
+ * scheduler can keep this running as a co-process.
+ */
+void cmd_predictslew(char *arg)
+{
+	char line[256];
+
+	if( strcmp(arg, "-") != 0 ) {
+		if( predict_slew(arg) < 0 )
+			errlog(8, "predict-slew wants <position>;<position>");
+		return;
+	}
+	while( fgets(line, sizeof(line), infile) != NULL ) {
+		if( predict_slew(line) < 0 )
+			fprintf(outfile, "error\n");
+		fflush(outfile);
+	}
 }
 
 void cmd_cancelgoto()
@@ -743,9 +1124,7 @@ void cmd_cancelgoto()
 	char buf;
 	
 	fprintf(outfile, "cmd_cancelgoto ... ");
-	dev_write("M", 1);
-	dev_read(&buf, 1);
-	if( buf == '#' )
+	if( dev_transact("M", 1, &buf, 1) == 1 )
 		fprintf(outfile, "success\n");
 	else
 		fprintf(outfile, "fail\n");
@@ -756,9 +1135,7 @@ void cmd_getversion()
 	char buf[3];
 
 	fprintf(outfile, "Hand Control Version is ");
-	dev_write("V", 1);
-	dev_read(&buf, 3);
-	if( buf[2] == '#' )
+	if( dev_transact("V", 1, buf, 3) == 3 )
 		fprintf(outfile, "%d.%d\n", buf[0], buf[1]);
 	else
 		fprintf(outfile, "fail.\n");
@@ -767,7 +1144,7 @@ void cmd_getversion()
 void cmd_getdeviceversion(char *optarg)
 {
 	char *devs[] = {"AZM/RA Motor", "ALT/DEC Motor", "GPS", "RTC", NULL};
-	char buf[8];
+	char buf[8], reply[3];
 	int	i;
 
 	for(i = 0; devs[i] != NULL; i++) {
@@ -779,18 +1156,8 @@ void cmd_getdeviceversion(char *optarg)
 		fprintf(outfile, "unknown device\n");
 		return;
 	}
-	buf[0] = 'P';
-	buf[1] = 1;
-	buf[2] = i + 16;
-	buf[3] = 254;
-	buf[4] = 0;
-	buf[5] = 0;
-	buf[6] = 0;
-	buf[7] = 2;
-	dev_write(buf, 8);
-	dev_read(buf, 3);
-	if( buf[2] == '#' )
-		fprintf(outfile, "%d.%d\n", buf[0], buf[1]);
+	if( dev_transact(buf, version_frame(buf, i), reply, 3) == 3 )
+		fprintf(outfile, "%d.%d\n", reply[0], reply[1]);
 	else
 		fprintf(outfile, "not connected\n");
 }
@@ -805,8 +1172,7 @@ void cmd_getmodel()
 	char *model;
 	int num_models = (sizeof(models)/sizeof(char*));
 	
-	dev_write("m", 1);
-	if( (dev_read(&buf, 2) != 2) || (buf[1] != '#' ) ) {
+	if( dev_transact("m", 1, buf, 2) != 2 ) {
 		errlog(0, "cmd_getmodel failed on read.\n");
 		return;
 	}
@@ -817,6 +1183,27 @@ void cmd_getmodel()
 	fprintf(outfile, "Telescope Model Celestron %s\n", model);
 }
 
+/*
+ * Send a 'P' slew and wait for the ack. rate is as slew_frame() takes
+ * it, except that variable rates keep quarters of an arcsecond/second.
+ * Returns 0, -1 on failure (logged under name).
+ */
+int send_slew(char *name, int fv, int azalt, double rate)
+{
+	char	buf[8], reply;
+
+	if( fv == 0 )
+		slew_frame(buf, 0, azalt, (int)rate);
+	else
+		slew_frame_quarter(buf, azalt, (int)lround(rate / FRAME_RATE_STEP));
+	if( dev_transact(buf, sizeof(buf), &reply, 1) != 1 ) {
+		errlog(0, "%s failed on read\n", name);
+		return -1;
+	}
+	estimate_command(azalt, fv, fv ? lround(rate / FRAME_RATE_STEP) * FRAME_RATE_STEP : rate);
+	return 0;
+}
+
 /*
  * Slew command
  * 	fv		fixed=0, variable=1
@@ -825,53 +1212,38 @@ void cmd_getmodel()
  * 			For fixed rate slew, value must be [-9, 9].
  * 			Value of zero means stop.
  */
- 
 void cmd_slew(int fv, int azalt, int rate)
 {
-	char	buf[8];
-	
 	if( (fv != 0 && fv != 1) || (azalt != 0 && azalt != 1) ) {
 		fprintf(errfile, "Bad value for fixed/azalt. Aborting.\n");
 		return;
 	}
-	buf[0] = 'P';
-	buf[1] = 2|fv;
-	buf[2] = 16|azalt;
-	buf[3] = (6|(rate >= 0 ? 0 : 1)) + 30*(fv == 0);
-	if( fv == 0 ) {
-		buf[4] = abs(rate);
-		buf[5] = 0;
-	} else {
-		buf[4] = abs(rate*4) >> 8;
-		buf[5] = abs(rate*4) & 0xFF;
-	}
-	buf[6] = 0;
-	buf[7] = 0;
-	dev_write(buf, sizeof(buf));
-	if( (dev_read(buf, 1) != 1) || (buf[0] != '#') ) {
-		errlog(0, "cmd_slew failed on read\n");
+	if( send_slew("cmd_slew", fv, azalt, rate) < 0 )
 		return;
-	}
 	fprintf(outfile, "Slew %s %s %d ok\n", fv == 0 ? "fixed" : "variable",
 		azalt == 0 ? "azimuth/RA" : "altitude/declination", rate);
-} 
+}
 
-void do_slew(char *optarg)
+/*
+ * parse "<fixed/variable>,<azimuth/RA/altitude/declination>,<±rate>"
+ * Returns 0 on success, -1 on error (already logged).
+ */
+int parse_slew(char *optarg, int *fvp, int *dp, int *ratep)
 {
 	int fv, d, rate;
 	char buf1[32], buf2[32], *cp;
 
-	for(cp = buf1; *optarg != ',' && *optarg != '\0'; *cp++ = *optarg++);
+	for(cp = buf1; *optarg != ',' && *optarg != '\0' && cp < &buf1[31]; *cp++ = *optarg++);
 	if( *optarg == '\0' ) {
 			errlog(0, "do_slew bad command syntax\n");
-			return;
+			return -1;
 	}
 	*cp = 0;
 	++optarg;
-	for(cp = buf2; *optarg != ',' && *optarg != '\0'; *cp++ = *optarg++);
+	for(cp = buf2; *optarg != ',' && *optarg != '\0' && cp < &buf2[31]; *cp++ = *optarg++);
 	if( *optarg == '\0' ) {
 			errlog(0, "do_slew bad command syntax\n");
-			return;
+			return -1;
 	}
 	*cp = 0;
 	optarg++;
@@ -880,29 +1252,73 @@ void do_slew(char *optarg)
 	if( strcmp(buf1, "variable") == 0 ) fv = 1;
 	else {
 		errlog(0, "do_slew arg1 must be `fixed' or `variable'\n");
-		return;
+		return -1;
 	}
 	if( strcmp(buf2, "azimuth") == 0 || strcmp(buf2, "RA") == 0 ) d = 0; else
 	if( strcmp(buf2, "altitude") == 0 || strcmp(buf2, "declination") == 0 ) d = 1;
 	else {
 		errlog(0, "do_slew arg2 must be `azimuth', `RA', `altitude' or `declination'\n");
-		return;
+		return -1;
 	}
 	if( (fv == 0) && (rate < -9 || rate > 9) ) {
 		errlog(0, "do_slew arg2 out of bounds\n");
-		return;
+		return -1;
 	}
-	cmd_slew(fv,  d, rate);
+	*fvp = fv;
+	*dp = d;
+	*ratep = rate;
+	return 0;
+}
+
+void do_slew(char *optarg)
+{
+	int fv, d, rate;
+
+	if( parse_slew(optarg, &fv, &d, &rate) == 0 )
+		cmd_slew(fv,  d, rate);
+}
+
+/*
+ * With --dry-run nothing goes to the hand control. Of the options that
+ * would use it only --poll and --run-sequence can cost what they would
+ * send instead; the few here just set things up or work offline.
+ * --plan, --ephemeris and --fit-pointing work offline once --site has
+ * been given, and otherwise would read the site from the hand control.
+ * Returns 1 if option c may run.
+ */
+static int dry_run_site(int c)
+{
+	return c == OPT_PLAN || c == OPT_EPHEMERIS || c == OPT_FITPOINT;
+}
+
+static int dry_run_ok(int c)
+{
+	switch(c) {
+	case OPT_POLL: case OPT_RUNSEQ: case OPT_DEVICE: case OPT_SLEWMODEL:
+	case OPT_SLEWHIST: case OPT_FITSLEW: case OPT_PREDICTSLEW:
+		return 1;
+	}
+	if( dry_run_site(c) )
+		return site != NULL;
+	return (c & 0x8000) == 0;
 }
 
 int main(int argc, char **argv)
 {
 	int	c;
 	char *cmd_arg, *dir;
+	long long t;
 
 	infile = stdin;
 	outfile = stdout;
 	errfile = stderr;
+	/* --dry-run covers every option, before it on the line or after */
+	opterr = 0;
+	while( (c = getopt_long(argc, argv, "", long_options, NULL)) != -1 )
+		if( c == OPT_DRYRUN )
+			dry_run = 1;
+	opterr = 1;
+	optind = 0;
 	while(1) {
 			int to_optind = optind ? optind : 1;
 			int index = 0;
@@ -911,7 +1327,17 @@ int main(int argc, char **argv)
 				break;
 			if( c == 0x3f ) /* invalid command detected */
 				continue;
+			t = TRACE_BEGIN();
+			if( dry_run && !dry_run_ok(c) ) {
+				errlog(0, dry_run_site(c) ?
+					"--%s would read the site from the hand control, give --site before it with --dry-run" :
+					"--%s talks to the hand control, not allowed with --dry-run",
+					long_options[index].name);
+				c = 0;
+			}
 			switch(c) {
+			case 0:		/* refused above */
+				break;
 			case OPT_HELP:
 				usage(errfile, basename(argv[0]), long_options);
 				exit(0);
@@ -921,12 +1347,31 @@ int main(int argc, char **argv)
 			case OPT_COPYRIGHT:
 				copyright(outfile);
 				break;
+			case OPT_METRICS:
+				metrics_file = optarg;
+				break;
+			case OPT_DRYRUN:		/* taken before the first option ran */
+				break;
+			case OPT_TRACE:
+				if( trace_start(optarg) < 0 )
+					errlog(0, "cannot write trace to %s", optarg);
+				break;
+			case OPT_COALESCE:
+				coalesce_window = atof(optarg)*1000;
+				break;
+			case OPT_REALTIME:
+				rt_enable(outfile, optarg);
+				break;
 			case OPT_ECHO:
 				cmd_arg = optarg;
 				cmd_echo(cmd_arg);
 				break;
 			case OPT_DEVICE: /* set and open device */
 				devname = optarg;
+				if( dry_run ) {
+					fprintf(outfile, "Dry run, port %s not opened\n", devname);
+					break;
+				}
 				fprintf(outfile, "Communicating over port %s\n", devname);
 				dev_control(DEV_OPEN, devname);
 				break;
@@ -999,14 +1444,126 @@ int main(int argc, char **argv)
 			case OPT_SLEW:
 				do_slew(optarg);
 				break;
+			case OPT_GOTORALIST:
+				cmd_gotolist("gotora-list", 'r', optarg);
+				break;
+			case OPT_GOTOAZLIST:
+				cmd_gotolist("gotoazalt-list", 'b', optarg);
+				break;
+			case OPT_SLEWMODEL:
+				if( load_slew_model(optarg, &slew_model) < 0 )
+					errlog(8, "slew-model wants rate1,rate2,accel1,accel2[,settle] or a model file");
+				break;
+			case OPT_SLEWHIST:
+				slew_history = optarg;
+				break;
+			case OPT_FITSLEW:
+				cmd_fitslewmodel(optarg);
+				break;
+			case OPT_PREDICTSLEW:
+				cmd_predictslew(optarg);
+				break;
+			case OPT_BRIDGE:
+				cmd_bridge(optarg);
+				break;
+			case OPT_NOTIFY:
+				cmd_notify(optarg);
+				break;
+			case OPT_COMPILESEQ:
+				cmd_compileseq(optarg);
+				break;
+			case OPT_RUNSEQ:
+				cmd_runseq(optarg);
+				break;
+			case OPT_GUIDE:
+				cmd_guide(optarg);
+				break;
+			case OPT_POLLTIME:
+				poll_time = atof(optarg);
+				break;
+			case OPT_POLL:
+				cmd_poll(optarg);
+				break;
+			case OPT_PECCAPTURE:
+				cmd_peccapture(optarg);
+				break;
+			case OPT_PECANALYZE:
+				cmd_pecanalyze(optarg);
+				break;
+			case OPT_ESTFILE:
+				estimate_file = optarg;
+				break;
+			case OPT_ESTIMATE:
+				cmd_estimate(optarg);
+				break;
+			case OPT_TLOG:
+				telemetry_log = optarg;
+				break;
+			case OPT_TLOGDUMP:
+				cmd_tlogdump(optarg);
+				break;
+			case OPT_BUILDSKY:
+				cmd_buildskyindex(optarg);
+				break;
+			case OPT_SKYINDEX:
+				sky_index = optarg;
+				break;
+			case OPT_SKYNEAR:
+				cmd_skynear(optarg, 0);
+				break;
+			case OPT_SKYCONE:
+				cmd_skynear(optarg, 1);
+				break;
+			case OPT_SITE:
+				site = optarg;
+				break;
+			case OPT_HORIZON:
+				horizon_file = optarg;
+				break;
+			case OPT_PLAN:
+				cmd_plan(optarg);
+				break;
+			case OPT_POINTLOG:
+				pointing_log = optarg;
+				break;
+			case OPT_POINTADD:
+				cmd_pointingadd(optarg);
+				break;
+			case OPT_FITPOINT:
+				cmd_fitpointing(optarg);
+				break;
+			case OPT_POINTMODEL:
+				pointing_model = optarg;
+				break;
+			case OPT_TRACKBODY:
+				cmd_trackbody(optarg);
+				break;
+			case OPT_GOTOBODY:
+				cmd_gotobody(optarg);
+				break;
+			case OPT_EPHEMERIS:
+				cmd_ephemeris(optarg);
+				break;
 			default:
 				fprintf(errfile, "Unkown code 0x%x\n", c);
 				break;
 			}
+			TRACE_END(long_options[index].name, -1, t);
 			if( syserr != 0 ) {
 				dev_control(DEV_CLOSE, NULL);
+				if( !dry_run )
+					metrics_dump(metrics_file);
+				trace_write();
+				rt_report(outfile);
 				exit(-1);
 			}
 	}
-	return dev_control(DEV_CLOSE, NULL);
+	c = dev_control(DEV_CLOSE, NULL);
+	/* a dry run measured nothing; leave the last real run's file for the cost model */
+	if( !dry_run && metrics_dump(metrics_file) < 0 )
+		fprintf(errfile, "cannot write metrics to %s\n", metrics_file);
+	if( trace_write() < 0 )
+		fprintf(errfile, "cannot write trace to %s\n", trace_file);
+	rt_report(outfile);
+	return c;
 }
@@ -0,0 +1,47 @@
+/*
+ * Scope control for Celestron NexStar hand control
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * What scope-control.c shares with the other modules.
+ */
+
+#ifndef SCOPE_CONTROL_H
+#define SCOPE_CONTROL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <time.h>
+#include <signal.h>
+
+#include "angle.h"
+
+extern char	*devname;
+extern int	devfd;
+extern int	syserr;
+
+extern FILE	*infile;
+extern FILE	*outfile;
+extern FILE	*errfile;
+
+extern char	*track_modes[];
+
+void	errlog(int type, const char *format, ...);
+void	catch_stop(void (*handler)(int), struct sigaction *old);
+void	restore_stop(struct sigaction *old);
+int		dev_write(const void *bufp, size_t len);
+int		dev_read(void *bufp, size_t rlen);
+int		dev_resync(void);
+int		dev_gone(void);
+int		dev_transact(const char *frame, int wlen, char *reply, int rlen);
+int		read_position(char *name, char cmd, int rlen, char *buf, angle_t *ab, struct timespec *stamp);
+int		wait_goto(char *name);
+long	do_goto(char *name, char cmd, angle_t *target, int wait, char *sent);
+int		send_slew(char *name, int fv, int azalt, double rate);
+int		parse_slew(char *optarg, int *fvp, int *dp, int *ratep);
+int		read_location(char *buf, double *lat, double *lon);
+int		read_targets(char *file, angle_t (**targets)[2], char ***names);
+
+#endif /* SCOPE_CONTROL_H */
@@ -0,0 +1,316 @@
+/*
+ * NexStar hand control simulator with a noisy serial link
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Answers the hand control commands scope-control uses on a pseudo
+ * terminal, whose name is printed on stdout; give it to --device.
+ * Replies are paced at FRAME_BAUD. Each reply can be made to lose a
+ * byte, gain a stray one or have one garbled, so the framing checks
+ * and resync in scope-control can be exercised without a mount.
+ */
+
+#define	_GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <errno.h>
+#include <math.h>
+
+#include "angle.h"
+#include "frame.h"
+
+#define	SIM_GOTO_RATE	20.0	/* degrees/second a goto covers */
+#define	SIM_GOTO_SETTLE	0.2		/* seconds added to every goto */
+
+/* faults: probability per reply */
+static double p_drop, p_extra, p_corrupt;
+static long n_frames, n_drop, n_extra, n_corrupt, n_junk;
+static volatile sig_atomic_t sim_stop = 0;
+
+/* the mount */
+static angle_t pos[2] = { 0x12AB0500, 0x40000000 };
+static double rates[2];			/* arcseconds/second, from 'P' slews */
+static double goto_until;
+static double last;
+static int tracking = 2;
+static unsigned char location[8] = { 45, 30, 0, 0, 75, 40, 0, 1 };
+
+static void sim_signal(int sig)
+{
+	sim_stop = 1;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int chance(double p)
+{
+	return p > 0 && drand48() < p;
+}
+
+/* move the axes on by the slew rates since the last command */
+static void sim_move(void)
+{
+	double t = now_s();
+	int i;
+
+	for(i = 0; i < 2; i++)
+		pos[i] += (angle_t)(int64_t)llround(rates[i] * (t - last) / 1296000.0 * ANGLE_FULL);
+	last = t;
+}
+
+/* degrees between two angles the short way round */
+static double sim_apart(angle_t a, angle_t b)
+{
+	return fabs((int32_t)(a - b) * 360.0 / ANGLE_FULL);
+}
+
+static int sim_hex(char *reply, int digits)
+{
+	char *cp = reply;
+
+	cp = angle2hex(cp, pos[0], digits);
+	*cp++ = ',';
+	cp = angle2hex(cp, pos[1], digits);
+	*cp++ = '#';
+	return cp - reply;
+}
+
+/*
+ * Act on one complete frame and build its reply.
+ * Returns the reply length.
+ */
+static int sim_frame(const unsigned char *f, int wlen, char *reply)
+{
+	struct tm tm;
+	time_t t;
+	angle_t target[2];
+	double d;
+	int digits, len;
+
+	sim_move();
+	switch(f[0]) {
+	case 'K':
+		reply[0] = f[1];
+		reply[1] = '#';
+		return 2;
+	case 'e': case 'z':
+		return sim_hex(reply, 8);
+	case 'E': case 'Z':
+		return sim_hex(reply, 4);
+	case 'r': case 'b': case 'R': case 'B': case 's': case 'S':
+		digits = (wlen - 2) / 2;
+		target[0] = hex2angle((const char *)&f[1], digits);
+		target[1] = hex2angle((const char *)&f[2 + digits], digits);
+		if( f[0] != 's' && f[0] != 'S' ) {
+			d = fmax(sim_apart(pos[0], target[0]), sim_apart(pos[1], target[1]));
+			goto_until = now_s() + d / SIM_GOTO_RATE + SIM_GOTO_SETTLE;
+		}
+		pos[0] = target[0];
+		pos[1] = target[1];
+		break;
+	case 'L':
+		reply[0] = (now_s() < goto_until) ? '1' : '0';
+		reply[1] = '#';
+		return 2;
+	case 'M':
+		goto_until = 0;
+		break;
+	case 't':
+		reply[0] = tracking;
+		reply[1] = '#';
+		return 2;
+	case 'T':
+		tracking = f[1];
+		break;
+	case 'J':
+		reply[0] = 1;
+		reply[1] = '#';
+		return 2;
+	case 'w':
+		memcpy(reply, location, 8);
+		reply[8] = '#';
+		return 9;
+	case 'W':
+		memcpy(location, &f[1], 8);
+		break;
+	case 'h':
+		t = time(NULL);
+		localtime_r(&t, &tm);
+		reply[0] = tm.tm_hour;
+		reply[1] = tm.tm_min;
+		reply[2] = tm.tm_sec;
+		reply[3] = tm.tm_mon + 1;
+		reply[4] = tm.tm_mday;
+		reply[5] = tm.tm_year % 100;
+		reply[6] = 0;
+		reply[7] = 0;
+		reply[8] = '#';
+		return 9;
+	case 'V':
+		reply[0] = 4;
+		reply[1] = 21;
+		reply[2] = '#';
+		return 3;
+	case 'm':
+		reply[0] = 11;
+		reply[1] = '#';
+		return 2;
+	case 'P':
+		if( f[1] == 3 && (f[2] == 16 || f[2] == 17) && (f[3] == 6 || f[3] == 7) )
+			rates[f[2] - 16] = ((f[4] << 8) | f[5]) * FRAME_RATE_STEP * (f[3] == 6 ? 1 : -1);
+		else if( f[1] == 2 && (f[2] == 16 || f[2] == 17) && (f[3] == 36 || f[3] == 37) )
+			rates[f[2] - 16] = f[4] ? pow(2, f[4]) * (f[3] == 36 ? 1 : -1) : 0;	/* roughly */
+		len = f[7];
+		if( f[3] == 254 )
+			len = 2;
+		memset(reply, 0, len);
+		if( f[3] == 254 ) {
+			reply[0] = 5;
+			reply[1] = 7;
+		}
+		reply[len] = '#';
+		return len + 1;
+	}
+	reply[0] = '#';
+	return 1;
+}
+
+/* lose, add or garble a byte of the reply as the fault options say */
+static int sim_fault(char *reply, int len)
+{
+	int i;
+
+	if( chance(p_drop) ) {
+		i = lrand48() % len;
+		memmove(&reply[i], &reply[i+1], len - i - 1);
+		len--;
+		n_drop++;
+	}
+	if( chance(p_extra) ) {
+		i = lrand48() % (len + 1);
+		memmove(&reply[i+1], &reply[i], len - i);
+		reply[i] = lrand48();
+		len++;
+		n_extra++;
+	}
+	if( len > 0 && chance(p_corrupt) ) {
+		i = lrand48() % len;
+		reply[i] ^= 1 + lrand48() % 255;
+		n_corrupt++;
+	}
+	return len;
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "usage: %s [--drop p] [--extra p] [--corrupt p] [--seed n] [--no-pacing]\n"
+		"\tfault probabilities are per reply, 0 to 1\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"drop",		required_argument,	0, 'd'},
+		{"extra",		required_argument,	0, 'x'},
+		{"corrupt",		required_argument,	0, 'c'},
+		{"seed",		required_argument,	0, 's'},
+		{"no-pacing",	no_argument,		0, 'n'},
+		{"help",		no_argument,		0, 'h'},
+		{0, 0, 0, 0}
+	};
+	const struct frame_desc *fp;
+	struct sigaction sa;
+	struct termios tio;
+	unsigned char in[256];
+	char reply[300];
+	long seed = 1;
+	int c, mfd, pacing = 1, have = 0, l, len;
+
+	while( (c = getopt_long(argc, argv, "", long_options, NULL)) != -1 ) {
+		switch(c) {
+		case 'd':
+			p_drop = atof(optarg);
+			break;
+		case 'x':
+			p_extra = atof(optarg);
+			break;
+		case 'c':
+			p_corrupt = atof(optarg);
+			break;
+		case 's':
+			seed = atol(optarg);
+			break;
+		case 'n':
+			pacing = 0;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	srand48(seed);
+	if( (mfd = posix_openpt(O_RDWR|O_NOCTTY)) < 0 || grantpt(mfd) < 0 || unlockpt(mfd) < 0 ) {
+		fprintf(stderr, "%s: cannot open a pseudo terminal: %s\n", argv[0], strerror(errno));
+		return 1;
+	}
+	tcgetattr(mfd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(mfd, TCSANOW, &tio);
+	printf("%s\n", ptsname(mfd));
+	fflush(stdout);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sim_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	last = now_s();
+	while( !sim_stop ) {
+		if( (l = read(mfd, in + have, sizeof(in) - have)) <= 0 ) {
+			if( l < 0 && errno == EIO ) {
+				usleep(10000);		/* nobody has the terminal open */
+				continue;
+			}
+			if( l < 0 && errno == EINTR )
+				continue;
+			break;
+		}
+		have += l;
+		while( have > 0 ) {
+			if( (fp = frame_lookup(in[0])) == NULL ) {
+				memmove(in, in + 1, --have);
+				n_junk++;
+				continue;
+			}
+			if( have < fp->wlen )
+				break;
+			len = sim_frame(in, fp->wlen, reply);
+			n_frames++;
+			if( pacing )
+				usleep((fp->wlen + len) * 10 * 1000000L / FRAME_BAUD + FRAME_TURNAROUND);
+			len = sim_fault(reply, len);
+			if( len > 0 && write(mfd, reply, len) != len )
+				sim_stop = 1;
+			have -= fp->wlen;
+			memmove(in, in + fp->wlen, have);
+		}
+	}
+	fprintf(stderr, "%ld frames, %ld replies lost a byte, %ld gained one, %ld garbled, %ld stray bytes skipped\n",
+		n_frames, n_drop, n_extra, n_corrupt, n_junk);
+	return 0;
+}
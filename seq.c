@@ -0,0 +1,312 @@
+/*
+ * Precompiled observing sequences
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * A sequence source has one step per line:
+ *	goto ra <position>		precise goto, then wait for it to finish
+ *	goto azalt <position>
+ *	sync <position>			precise sync
+ *	track <mode>			Off, Alt-Azimuth, EQNorth or EQSouth
+ *	slew <fixed/variable>,<axis>,<rate>		as --slew
+ *	cancel					cancel goto
+ *	wait <seconds>
+ * '#' starts a comment. --compile-sequence turns this into ready made
+ * protocol frames; --run-sequence maps the result and writes the frames
+ * out as they are, with no parsing or formatting at run time.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "scope-control.h"
+#include "frame.h"
+#include "rt.h"
+#include "cost.h"
+#include "seq.h"
+
+/* fill in a frame step from an already built frame */
+static void seq_frame(struct seq_step *sp, char *frame, int wlen)
+{
+	sp->op = SEQ_FRAME;
+	sp->wlen = wlen;
+	sp->rlen = frame_reply_len(frame);
+	memcpy(sp->frame, frame, wlen);
+}
+
+/*
+ * Compile one source line into up to two steps.
+ * Returns steps made, 0 for a blank line, -1 on error.
+ */
+static int seq_line(char *line, struct seq_step *sp)
+{
+	char *word, *rest, frame[32];
+	angle_t a1, a2;
+	int i, fv, d, rate;
+	double secs;
+
+	line[strcspn(line, "#\r\n")] = '\0';
+	for(word = line; isspace(*word); word++)
+		;
+	if( *word == '\0' )
+		return 0;
+	for(rest = word; *rest && !isspace(*rest); rest++)
+		;
+	if( *rest )
+		*rest++ = '\0';
+	while( isspace(*rest) )
+		rest++;
+	if( strcmp(word, "goto") == 0 ) {
+		char cmd = 0;
+		if( strncmp(rest, "ra", 2) == 0 && isspace(rest[2]) )
+			cmd = 'r';
+		else if( strncmp(rest, "azalt", 5) == 0 && isspace(rest[5]) )
+			cmd = 'b';
+		if( cmd == 0 || convert2position(rest + (cmd == 'r' ? 2 : 5),
+				ANGLE_DEG, &a1, &a2) < 0 )
+			return -1;
+		seq_frame(sp, frame, position_frame(frame, cmd, a1, a2));
+		sp[1].op = SEQ_WAITGOTO;
+		return 2;
+	}
+	if( strcmp(word, "sync") == 0 ) {
+		if( convert2position(rest, ANGLE_HOUR, &a1, &a2) < 0 )
+			return -1;
+		seq_frame(sp, frame, position_frame(frame, 's', a1, a2));
+		return 1;
+	}
+	if( strcmp(word, "track") == 0 ) {
+		for(i = 0; i < 4 && strcmp(track_modes[i], rest) != 0; i++)
+			;
+		if( i == 4 )
+			return -1;
+		frame[0] = 'T';
+		frame[1] = i;
+		seq_frame(sp, frame, 2);
+		return 1;
+	}
+	if( strcmp(word, "slew") == 0 ) {
+		if( parse_slew(rest, &fv, &d, &rate) < 0 )
+			return -1;
+		seq_frame(sp, frame, slew_frame(frame, fv, d, rate));
+		return 1;
+	}
+	if( strcmp(word, "cancel") == 0 ) {
+		seq_frame(sp, "M", 1);
+		return 1;
+	}
+	if( strcmp(word, "wait") == 0 ) {
+		if( sscanf(rest, "%lf", &secs) != 1 || secs < 0 || secs > 86400 )
+			return -1;
+		sp->op = SEQ_WAIT;
+		sp->arg = secs*1000 + 0.5;
+		return 1;
+	}
+	return -1;
+}
+
+/*
+ * --compile-sequence <source>,<output>
+ */
+void cmd_compileseq(char *arg)
+{
+	struct seq_header hdr;
+	struct seq_step step[2];
+	char src[1024], *out, line[256];
+	FILE *in, *f;
+	int n, i, lineno = 0;
+
+	if( (out = strchr(arg, ',')) == NULL || out - arg >= sizeof(src) ) {
+		errlog(10, "compile-sequence wants <source>,<output>");
+		return;
+	}
+	snprintf(src, sizeof(src), "%.*s", (int)(out - arg), arg);
+	out++;
+	if( (in = fopen(src, "r")) == NULL ) {
+		errlog(10, "cannot open %s: %s", src, strerror(errno));
+		return;
+	}
+	if( (f = fopen(out, "w")) == NULL ) {
+		errlog(10, "cannot create %s: %s", out, strerror(errno));
+		fclose(in);
+		return;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SEQ_MAGIC, 4);
+	hdr.version = SEQ_VERSION;
+	hdr.step_size = sizeof(struct seq_step);
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	while( fgets(line, sizeof(line), in) != NULL ) {
+		lineno++;
+		memset(step, 0, sizeof(step));
+		if( (n = seq_line(line, step)) < 0 ) {
+			errlog(10, "%s:%d cannot compile `%s'", src, lineno, line);
+			break;
+		}
+		for(i = 0; i < n; i++) {
+			if( step[i].op != SEQ_WAIT )
+				step[i].arg = lineno;
+			fwrite(&step[i], sizeof(step[i]), 1, f);
+		}
+		hdr.count += n;
+	}
+	fclose(in);
+	rewind(f);
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	if( fclose(f) != 0 || syserr ) {
+		unlink(out);
+		if( !syserr )
+			errlog(10, "cannot write %s", out);
+		return;
+	}
+	fprintf(outfile, "compile-sequence %s: %u steps, %lu bytes\n", out,
+		hdr.count, sizeof(hdr) + hdr.count*sizeof(struct seq_step));
+}
+
+/*
+ * Every step of a mapped sequence must be one the executor can run as
+ * it stands: a known op, and for a frame a known command of its own
+ * length that fits the step, expecting the reply that command gives.
+ * Returns 0, -1 (reported) for the first bad step.
+ */
+static int seq_check(char *file, struct seq_header *hdr)
+{
+	const struct frame_desc *fp;
+	struct seq_step *sp, *end;
+
+	sp = (struct seq_step *)(hdr + 1);
+	for(end = sp + hdr->count; sp < end; sp++) {
+		if( sp->op == SEQ_WAIT || sp->op == SEQ_WAITGOTO )
+			continue;
+		if( sp->op != SEQ_FRAME ) {
+			errlog(10, "%s step %ld: bad op %u", file, (long)(sp - (struct seq_step *)(hdr + 1)), sp->op);
+			return -1;
+		}
+		if( sp->wlen > sizeof(sp->frame) || (fp = frame_lookup((unsigned char)sp->frame[0])) == NULL ||
+				sp->wlen != fp->wlen || sp->rlen != frame_reply_len(sp->frame) ) {
+			errlog(10, "%s line %u: bad frame step", file, sp->arg);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * --dry-run: the link time a sequence's frames take and what is left
+ * of the run for its waits. Goto waits are of unknown length and only
+ * counted.
+ */
+static void seq_dryrun(char *file, struct seq_header *hdr)
+{
+	struct seq_step *sp, *end, *first[128];
+	long count[128], frames = 0, gotos = 0;
+	double link = 0, wait = 0;
+	int c;
+
+	memset(count, 0, sizeof(count));
+	sp = (struct seq_step *)(hdr + 1);
+	for(end = sp + hdr->count; sp < end; sp++) {
+		switch(sp->op) {
+		case SEQ_FRAME:
+			c = sp->frame[0] & 127;
+			if( count[c]++ == 0 )
+				first[c] = sp;
+			link += cost_us(sp->frame) / 1e3;
+			frames++;
+			break;
+		case SEQ_WAIT:
+			wait += sp->arg;
+			break;
+		case SEQ_WAITGOTO:
+			gotos++;
+			break;
+		}
+	}
+	fprintf(outfile, "dry run, sequence %s (nothing sent):\n", file);
+	for(c = 0; c < 128; c++)
+		if( count[c] > 0 ) {
+			fprintf(outfile, "%5ld x", count[c]);
+			cost_print(first[c]->frame, 0);
+		}
+	fprintf(outfile, "%ld frames hold the link %.1fms, waits %.1fms, %ld gotos of unknown length\n",
+		frames, link, wait, gotos);
+	if( frames > 0 )
+		fprintf(outfile, "link utilization %.1f%% not counting gotos; back to back at most %.1f frames/s, %.2f runs/s\n",
+			100 * link / (link + wait), frames * 1e3 / link, 1e3 / link);
+}
+
+/*
+ * --run-sequence <file>: map a compiled sequence and replay it.
+ * With --dry-run only report what it would cost.
+ */
+void cmd_runseq(char *file)
+{
+	struct seq_header *hdr;
+	struct seq_step *sp, *end;
+	struct stat st;
+	char reply[260];
+	void *map;
+	int fd;
+
+	if( (fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0 ) {
+		errlog(10, "cannot open sequence %s: %s", file, strerror(errno));
+		return;
+	}
+	map = (st.st_size >= sizeof(*hdr)) ?
+		mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if( map == MAP_FAILED ) {
+		errlog(10, "cannot map sequence %s", file);
+		return;
+	}
+	hdr = map;
+	if( memcmp(hdr->magic, SEQ_MAGIC, 4) != 0 || hdr->version != SEQ_VERSION ||
+			hdr->step_size != sizeof(struct seq_step) ||
+			st.st_size < sizeof(*hdr) + (off_t)hdr->count*sizeof(struct seq_step) ) {
+		errlog(10, "%s is not a compiled sequence", file);
+		munmap(map, st.st_size);
+		return;
+	}
+	if( seq_check(file, hdr) < 0 )
+		goto done;
+	if( dry_run ) {
+		seq_dryrun(file, hdr);
+		goto done;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	sp = (struct seq_step *)(hdr + 1);
+	for(end = sp + hdr->count; sp < end; sp++) {
+		switch(sp->op) {
+		case SEQ_FRAME:
+			if( dev_transact(sp->frame, sp->wlen, reply, sp->rlen) != sp->rlen ) {
+				errlog(10, "run-sequence %s line %u `%c' failed", file, sp->arg, sp->frame[0]);
+				goto done;
+			}
+			break;
+		case SEQ_WAIT:
+			rt_sleep(sp->arg * 1000000LL);
+			break;
+		case SEQ_WAITGOTO:
+			if( wait_goto("run-sequence") < 0 )
+				goto done;
+			break;
+		default:
+			errlog(10, "run-sequence %s bad step %u", file, sp->op);
+			goto done;
+		}
+	}
+	fprintf(outfile, "run-sequence %s: %u steps done\n", file, hdr->count);
+done:
+	munmap(map, st.st_size);
+}
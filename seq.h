@@ -0,0 +1,46 @@
+/*
+ * Precompiled observing sequences
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef SEQ_H
+#define SEQ_H
+
+#include <stdint.h>
+
+#define	SEQ_MAGIC		"NXSQ"
+#define	SEQ_VERSION		1
+
+/* step ops */
+#define	SEQ_FRAME		1	/* send frame, read rlen bytes ending in '#' */
+#define	SEQ_WAIT		2	/* sleep arg milliseconds */
+#define	SEQ_WAITGOTO	3	/* poll 'L' until the goto is done */
+
+/*
+ * File is a header followed by count fixed size steps, host byte
+ * order. Steps are 32 bytes so the executor indexes them in place.
+ */
+struct seq_header {
+	char		magic[4];
+	uint16_t	version;
+	uint16_t	step_size;
+	uint32_t	count;
+	uint32_t	pad;
+};
+
+struct seq_step {
+	uint8_t		op;
+	uint8_t		wlen;		/* frame bytes */
+	uint8_t		rlen;		/* reply bytes, '#' included */
+	uint8_t		pad;
+	uint32_t	arg;		/* SEQ_WAIT milliseconds, else source line */
+	char		frame[24];
+};
+
+void	cmd_compileseq(char *arg);
+void	cmd_runseq(char *file);
+
+#endif /* SEQ_H */
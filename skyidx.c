@@ -0,0 +1,343 @@
+/*
+ * Sky catalog spatial index
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * --build-sky-index catalog,index turns a target list (as read by
+ * --gotora-list) into a kd-tree over unit vectors, laid out implicitly
+ * so the file is the tree: it is mapped and searched in place with no
+ * loading. Distances are compared as squared chords, which order the
+ * same as angles and need no trig in the search.
+ *
+ * --sky-near k[,position] and --sky-cone degrees[,position] search
+ * around a position, or around where the mount points ('e') if none.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+#include "scope-control.h"
+#include "skyidx.h"
+
+#define	SKY_MAXK		1000	/* most neighbours asked for */
+#define	SKY_MAXHITS		10000	/* most cone results listed */
+
+char	*sky_index = NULL;
+
+/* query state, threaded through the recursion */
+struct sky_query {
+	const struct sky_point *pts;
+	float	q[3];
+	float	r2;				/* squared chord bound */
+	int		k, n;			/* kNN: wanted, held */
+	int		*hit;			/* kNN: max-heap on distance; cone: list */
+	float	*d2;
+	int		max;
+	int		bad;			/* a node with no such axis: not an index we wrote */
+};
+
+/* a hit for sorting by distance */
+struct sky_hit {
+	float	d2;
+	int		idx;
+};
+
+static void sky_vector(angle_t ra, angle_t dec, float *v)
+{
+	double a = ra * (2*M_PI / ANGLE_FULL), d = (int32_t)dec * (2*M_PI / ANGLE_FULL);
+
+	v[0] = cos(d) * cos(a);
+	v[1] = cos(d) * sin(a);
+	v[2] = sin(d);
+}
+
+static float dist2(const float *a, const float *b)
+{
+	float x = a[0] - b[0], y = a[1] - b[1], z = a[2] - b[2];
+
+	return x*x + y*y + z*z;
+}
+
+/* angle in degrees from a squared chord */
+static double chord2deg(float d2)
+{
+	return 2 * asin(sqrt(d2) / 2) * 180 / M_PI;
+}
+
+static struct sky_point *build_pts;
+
+static int axis_cmp;
+static int cmp_axis(const void *a, const void *b)
+{
+	float x = ((const struct sky_point *)a)->v[axis_cmp], y = ((const struct sky_point *)b)->v[axis_cmp];
+
+	return (x > y) - (x < y);
+}
+
+/* order [lo, hi) as an implicit kd-tree, splitting on the widest axis */
+static void sky_build(long lo, long hi)
+{
+	float mn[3] = { 2, 2, 2 }, mx[3] = { -2, -2, -2 };
+	long i, mid = (lo + hi) / 2;
+	int a, axis = 0;
+
+	if( hi - lo <= 0 )
+		return;
+	for(i = lo; i < hi; i++)
+		for(a = 0; a < 3; a++) {
+			if( build_pts[i].v[a] < mn[a] ) mn[a] = build_pts[i].v[a];
+			if( build_pts[i].v[a] > mx[a] ) mx[a] = build_pts[i].v[a];
+		}
+	for(a = 1; a < 3; a++)
+		if( mx[a] - mn[a] > mx[axis] - mn[axis] )
+			axis = a;
+	/* a full sort per level keeps it simple; n log^2 n is seconds for Hipparcos */
+	axis_cmp = axis;
+	qsort(build_pts + lo, hi - lo, sizeof(struct sky_point), cmp_axis);
+	build_pts[mid].axis = axis;
+	sky_build(lo, mid);
+	sky_build(mid + 1, hi);
+}
+
+/*
+ * --build-sky-index catalog,index
+ */
+void cmd_buildskyindex(char *arg)
+{
+	struct sky_header hdr;
+	angle_t (*t)[2];
+	char **names, catalog[1024], *out;
+	uint32_t off = 0;
+	long n, i;
+	FILE *f;
+
+	if( (out = strchr(arg, ',')) == NULL || out - arg >= sizeof(catalog) ) {
+		errlog(16, "build-sky-index wants <catalog>,<index>");
+		return;
+	}
+	snprintf(catalog, sizeof(catalog), "%.*s", (int)(out - arg), arg);
+	out++;
+	if( (n = read_targets(catalog, &t, &names)) < 0 )
+		return;
+	if( (build_pts = calloc(n + 1, sizeof(struct sky_point))) == NULL ) {
+		errlog(16, "build-sky-index out of memory");
+		return;
+	}
+	for(i = 0; i < n; i++) {
+		sky_vector(t[i][0], t[i][1], build_pts[i].v);
+		build_pts[i].ra = t[i][0];
+		build_pts[i].dec = t[i][1];
+		build_pts[i].name = off;
+		off += strlen(names[i]) + 1;
+	}
+	sky_build(0, n);
+	if( (f = fopen(out, "w")) == NULL ) {
+		errlog(16, "cannot create %s: %s", out, strerror(errno));
+		goto done;
+	}
+	memcpy(hdr.magic, SKY_MAGIC, 4);
+	hdr.version = SKY_VERSION;
+	hdr.count = n;
+	hdr.names = off;
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	fwrite(build_pts, sizeof(struct sky_point), n, f);
+	for(i = 0; i < n; i++)
+		fwrite(names[i], strlen(names[i]) + 1, 1, f);
+	if( fclose(f) != 0 ) {
+		errlog(16, "cannot write %s", out);
+		unlink(out);
+		goto done;
+	}
+	fprintf(outfile, "build-sky-index %s: %ld objects\n", out, n);
+done:
+	for(i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+	free(t);
+	free(build_pts);
+}
+
+/* push onto the k-nearest max-heap, dropping the farthest when full */
+static void knn_push(struct sky_query *sq, int idx, float d2)
+{
+	int i, c;
+
+	if( sq->n < sq->k ) {
+		/* sift up */
+		for(i = sq->n++; i > 0 && sq->d2[(i-1)/2] < d2; i = (i-1)/2) {
+			sq->hit[i] = sq->hit[(i-1)/2];
+			sq->d2[i] = sq->d2[(i-1)/2];
+		}
+		sq->hit[i] = idx;
+		sq->d2[i] = d2;
+		if( sq->n == sq->k )
+			sq->r2 = sq->d2[0];
+		return;
+	}
+	if( d2 >= sq->d2[0] )
+		return;
+	/* replace the root and sift down */
+	for(i = 0; (c = 2*i + 1) < sq->n; i = c) {
+		if( c + 1 < sq->n && sq->d2[c+1] > sq->d2[c] )
+			c++;
+		if( sq->d2[c] <= d2 )
+			break;
+		sq->hit[i] = sq->hit[c];
+		sq->d2[i] = sq->d2[c];
+	}
+	sq->hit[i] = idx;
+	sq->d2[i] = d2;
+	sq->r2 = sq->d2[0];
+}
+
+/* visit [lo, hi); cone when hit list is not a heap (k == 0) */
+static void sky_search(struct sky_query *sq, long lo, long hi)
+{
+	const struct sky_point *p;
+	long mid;
+	float d, d2;
+
+	while( hi > lo ) {
+		mid = (lo + hi) / 2;
+		p = &sq->pts[mid];
+		d2 = dist2(p->v, sq->q);
+		if( d2 <= sq->r2 ) {
+			if( sq->k )
+				knn_push(sq, mid, d2);
+			else if( sq->n < sq->max ) {
+				sq->hit[sq->n] = mid;
+				sq->d2[sq->n++] = d2;
+			}
+		}
+		if( p->axis > 2 ) {
+			sq->bad = 1;
+			return;
+		}
+		d = sq->q[p->axis] - p->v[p->axis];
+		/* near side first, far side only if the split plane is in reach */
+		if( d < 0 ) {
+			sky_search(sq, lo, mid);
+			if( d*d > sq->r2 )
+				return;
+			lo = mid + 1;
+		} else {
+			sky_search(sq, mid + 1, hi);
+			if( d*d > sq->r2 )
+				return;
+			hi = mid;
+		}
+	}
+}
+
+static int cmp_hit(const void *a, const void *b)
+{
+	float x = ((const struct sky_hit *)a)->d2, y = ((const struct sky_hit *)b)->d2;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * --sky-near k[,position] (cone 0) or --sky-cone degrees[,position] (cone 1)
+ */
+void cmd_skynear(char *arg, int cone)
+{
+	struct sky_header *hdr;
+	struct sky_query sq;
+	struct stat st;
+	struct timespec t0, t1;
+	char buf[20], b1[32], b2[32], *cp;
+	const char *names;
+	angle_t at[2];
+	double value;
+	struct sky_hit *sorted;
+	void *map;
+	int fd, i;
+
+	if( sky_index == NULL ) {
+		errlog(16, "sky-near/sky-cone want --sky-index first");
+		return;
+	}
+	value = atof(arg);
+	if( cone ? (value <= 0 || value > 180) : (value < 1 || value > SKY_MAXK) ) {
+		errlog(16, cone ? "sky-cone radius out of range" : "sky-near wants 1 to %d", SKY_MAXK);
+		return;
+	}
+	if( (cp = strchr(arg, ',')) != NULL ) {
+		if( convert2position(cp + 1, ANGLE_HOUR, &at[0], &at[1]) < 0 ) {
+			errlog(16, "sky-near bad position %s", cp + 1);
+			return;
+		}
+	} else if( read_position("sky-near", 'e', 18, buf, at, NULL) < 0 )
+		return;
+	if( (fd = open(sky_index, O_RDONLY)) < 0 || fstat(fd, &st) < 0 ) {
+		errlog(16, "cannot open sky index %s: %s", sky_index, strerror(errno));
+		return;
+	}
+	map = (st.st_size >= sizeof(*hdr)) ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	hdr = map;
+	if( map == MAP_FAILED || memcmp(hdr->magic, SKY_MAGIC, 4) != 0 || hdr->version != SKY_VERSION ||
+			sizeof(*hdr) + (off_t)hdr->count * sizeof(struct sky_point) + hdr->names > st.st_size ) {
+		errlog(16, "%s is not a sky index", sky_index);
+		if( map != MAP_FAILED )
+			munmap(map, st.st_size);
+		return;
+	}
+	memset(&sq, 0, sizeof(sq));
+	sq.pts = (const struct sky_point *)(hdr + 1);
+	names = (const char *)(sq.pts + hdr->count);
+	sky_vector(at[0], at[1], sq.q);
+	if( cone ) {
+		sq.r2 = 2 - 2*cos(value * M_PI / 180) + 1e-7;
+		sq.max = SKY_MAXHITS;
+	} else {
+		sq.k = sq.max = value;
+		sq.r2 = 5;		/* more than any chord until the heap fills */
+	}
+	sq.hit = malloc(sq.max * sizeof(int));
+	sq.d2 = malloc(sq.max * sizeof(float));
+	sorted = malloc(sq.max * sizeof(*sorted));
+	if( sq.hit == NULL || sq.d2 == NULL || sorted == NULL ) {
+		errlog(16, "sky-near out of memory");
+		goto done;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	sky_search(&sq, 0, hdr->count);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if( sq.bad ) {
+		errlog(16, "%s is not a sky index", sky_index);
+		goto done;
+	}
+	for(i = 0; i < sq.n; i++) {
+		sorted[i].d2 = sq.d2[i];
+		sorted[i].idx = sq.hit[i];
+	}
+	qsort(sorted, sq.n, sizeof(*sorted), cmp_hit);
+	for(i = 0; i < sq.n; i++) {
+		const struct sky_point *p = &sq.pts[sorted[i].idx];
+
+		convert2hhmmss(b1, p->ra, ANGLE_HOUR, 0);
+		convert2hhmmss(b2, p->dec, ANGLE_DEG, 1);
+		fprintf(outfile, "%8.4fd %s %s %s\n", chord2deg(sorted[i].d2), b1, b2,
+			p->name < hdr->names ? names + p->name : "?");
+	}
+	fprintf(outfile, "# %d of %u objects in %.1fus%s\n", sq.n, hdr->count,
+		(t1.tv_sec - t0.tv_sec)*1e6 + (t1.tv_nsec - t0.tv_nsec)/1e3,
+		(cone && sq.n == sq.max) ? ", list cut short" : "");
+done:
+	free(sorted);
+	free(sq.d2);
+	free(sq.hit);
+	munmap(map, st.st_size);
+}
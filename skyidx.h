@@ -0,0 +1,43 @@
+/*
+ * Sky catalog spatial index
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef SKYIDX_H
+#define SKYIDX_H
+
+#include <stdint.h>
+
+#include "angle.h"
+
+#define	SKY_MAGIC		"NXSK"
+#define	SKY_VERSION		1
+
+struct sky_header {
+	char		magic[4];
+	uint32_t	version;
+	uint32_t	count;
+	uint32_t	names;		/* bytes of name text after the points */
+};
+
+/*
+ * Points in implicit kd-tree order: the node for [lo, hi) is at
+ * (lo+hi)/2 and splits its range on axis.
+ */
+struct sky_point {
+	float		v[3];		/* unit vector */
+	uint8_t		axis;
+	uint8_t		pad[3];
+	angle_t		ra, dec;
+	uint32_t	name;		/* offset into the name text */
+};
+
+extern char	*sky_index;
+
+void	cmd_buildskyindex(char *arg);
+void	cmd_skynear(char *arg, int cone);
+
+#endif /* SKYIDX_H */
@@ -0,0 +1,213 @@
+/*
+ * Measured goto history and slew model fitting
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Every goto made with --slew-history set is appended to the history
+ * as a slew_record. --fit-slew-model fits the slew_model of slewplan.c
+ * (per-axis rate and acceleration plus settle time) to the history by
+ * least squares on goto duration, using Nelder-Mead in log space so all
+ * parameters stay positive and the max() over axes needs no derivative.
+ * One history, and so one model, per mount.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "slewhist.h"
+
+#define	NPARAM		5		/* rate0, rate1, accel0, accel1, settle */
+#define	FIT_ITER	2000	/* Nelder-Mead iterations */
+#define	FIT_TOL		1e-10	/* stop when the simplex is this flat */
+
+char *slew_history = NULL;
+
+/*
+ * Append one record; O_APPEND keeps concurrent writers whole.
+ * Returns 0 on success, -1 on failure.
+ */
+int slew_history_append(const char *file, struct slew_record *rp)
+{
+	int fd, l;
+
+	if( (fd = open(file, O_WRONLY|O_CREAT|O_APPEND, 0644)) < 0 )
+		return -1;
+	l = write(fd, rp, sizeof(*rp));
+	close(fd);
+	return (l == sizeof(*rp)) ? 0 : -1;
+}
+
+/* Returns number of records, -1 on error. *recs is malloc'ed. */
+int slew_history_load(const char *file, struct slew_record **recs)
+{
+	struct stat st;
+	int fd, n;
+
+	if( (fd = open(file, O_RDONLY)) < 0 )
+		return -1;
+	if( fstat(fd, &st) < 0 ) {
+		close(fd);
+		return -1;
+	}
+	n = st.st_size / sizeof(struct slew_record);
+	if( (*recs = malloc(n ? n*sizeof(struct slew_record) : 1)) == NULL ||
+			read(fd, *recs, n*sizeof(struct slew_record)) != n*sizeof(struct slew_record) ) {
+		free(*recs);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return n;
+}
+
+static void param2model(double *x, struct slew_model *m)
+{
+	m->rate[0] = exp(x[0]);
+	m->rate[1] = exp(x[1]);
+	m->accel[0] = exp(x[2]);
+	m->accel[1] = exp(x[3]);
+	m->settle = exp(x[4]);
+}
+
+/* sum of squared duration error in seconds */
+static double fit_cost(double *x, struct slew_record *recs, int n, struct slew_model *m)
+{
+	double e, sum = 0;
+	int i;
+
+	param2model(x, m);
+	for(i = 0; i < n; i++) {
+		e = slew_time(m, recs[i].from, recs[i].to) - recs[i].duration_ms/1000.0;
+		sum += e*e;
+	}
+	return sum;
+}
+
+/*
+ * Fit m to the records made in frame cmd ('e' or 'z'), starting from m
+ * as given. RA/Dec and azimuth/altitude distances are not the same
+ * slew, so the other frame's records are dropped; recs[] is compacted
+ * and *n set to the number used.
+ * Returns rms error in seconds, or -1 when there is too little data.
+ */
+double slew_fit(struct slew_record *recs, int *n, int cmd, struct slew_model *m)
+{
+	double x[NPARAM+1][NPARAM], f[NPARAM+1], c[NPARAM], xr[NPARAM], xe[NPARAM];
+	double fr, fe, t;
+	struct slew_model work = *m;
+	int i, j, k, lo, hi, nh, iter;
+
+	for(i = j = 0; i < *n; i++)
+		if( recs[i].cmd == cmd )
+			recs[j++] = recs[i];
+	if( (*n = j) < NPARAM )
+		return -1;
+	x[0][0] = log(m->rate[0]);
+	x[0][1] = log(m->rate[1]);
+	x[0][2] = log(m->accel[0]);
+	x[0][3] = log(m->accel[1]);
+	x[0][4] = log(m->settle > 0.01 ? m->settle : 0.01);
+	for(i = 1; i <= NPARAM; i++) {
+		memcpy(x[i], x[0], sizeof(x[0]));
+		x[i][i-1] += 0.5;	/* ~65% step in each parameter */
+	}
+	for(i = 0; i <= NPARAM; i++)
+		f[i] = fit_cost(x[i], recs, *n, &work);
+	for(iter = 0; iter < FIT_ITER; iter++) {
+		for(lo = hi = 0, i = 1; i <= NPARAM; i++) {
+			if( f[i] < f[lo] ) lo = i;
+			if( f[i] > f[hi] ) hi = i;
+		}
+		for(nh = lo, i = 0; i <= NPARAM; i++)
+			if( i != hi && f[i] > f[nh] ) nh = i;
+		if( f[hi] - f[lo] <= FIT_TOL*(f[lo] + FIT_TOL) )
+			break;
+		/* centroid of all but the worst */
+		for(j = 0; j < NPARAM; j++) {
+			for(c[j] = 0, i = 0; i <= NPARAM; i++)
+				if( i != hi ) c[j] += x[i][j];
+			c[j] /= NPARAM;
+		}
+		for(j = 0; j < NPARAM; j++)
+			xr[j] = c[j] + (c[j] - x[hi][j]);
+		fr = fit_cost(xr, recs, *n, &work);
+		if( fr < f[lo] ) {
+			for(j = 0; j < NPARAM; j++)
+				xe[j] = c[j] + 2*(c[j] - x[hi][j]);
+			fe = fit_cost(xe, recs, *n, &work);
+			if( fe < fr ) {
+				memcpy(x[hi], xe, sizeof(xe));
+				f[hi] = fe;
+			} else {
+				memcpy(x[hi], xr, sizeof(xr));
+				f[hi] = fr;
+			}
+		} else if( fr < f[nh] ) {
+			memcpy(x[hi], xr, sizeof(xr));
+			f[hi] = fr;
+		} else {
+			/* contract toward the centroid, shrink if that fails too */
+			for(j = 0; j < NPARAM; j++)
+				xr[j] = c[j] + 0.5*(x[hi][j] - c[j]);
+			fr = fit_cost(xr, recs, *n, &work);
+			if( fr < f[hi] ) {
+				memcpy(x[hi], xr, sizeof(xr));
+				f[hi] = fr;
+			} else {
+				for(i = 0; i <= NPARAM; i++) {
+					if( i == lo )
+						continue;
+					for(k = 0; k < NPARAM; k++)
+						x[i][k] = x[lo][k] + 0.5*(x[i][k] - x[lo][k]);
+					f[i] = fit_cost(x[i], recs, *n, &work);
+				}
+			}
+		}
+	}
+	for(lo = 0, i = 1; i <= NPARAM; i++)
+		if( f[i] < f[lo] ) lo = i;
+	param2model(x[lo], m);
+	t = f[lo] / *n;
+	return sqrt(t);
+}
+
+/*
+ * str is either "rate1,rate2,accel1,accel2[,settle]" or the name of a
+ * file holding that on its first line, as written by save_slew_model().
+ * Returns 0 on success, -1 on bad input.
+ */
+int load_slew_model(char *str, struct slew_model *m)
+{
+	char line[256];
+	FILE *f;
+
+	if( parse_slew_model(str, m) == 0 )
+		return 0;
+	if( (f = fopen(str, "r")) == NULL )
+		return -1;
+	if( fgets(line, sizeof(line), f) == NULL ) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return parse_slew_model(line, m);
+}
+
+int save_slew_model(const char *file, struct slew_model *m)
+{
+	FILE *f;
+
+	if( (f = fopen(file, "w")) == NULL )
+		return -1;
+	fprintf(f, "%.6g,%.6g,%.6g,%.6g,%.6g\n", m->rate[0], m->rate[1],
+		m->accel[0], m->accel[1], m->settle);
+	return fclose(f);
+}
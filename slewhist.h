@@ -0,0 +1,35 @@
+/*
+ * Measured goto history and slew model fitting
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef SLEWHIST_H
+#define SLEWHIST_H
+
+#include <stdint.h>
+
+#include "angle.h"
+#include "slewplan.h"
+
+/* one goto, fixed size, appended to the history file as is */
+struct slew_record {
+	uint32_t	when;			/* unix time the goto was sent */
+	uint8_t		cmd;			/* 'e' or 'z': the mount's axes, frame of from/to */
+	uint8_t		pad[3];
+	angle_t		from[2];		/* position before the goto */
+	angle_t		to[2];			/* position after 'L' reports done */
+	uint32_t	duration_ms;	/* goto sent to 'L' reporting done */
+};
+
+extern char *slew_history;
+
+int		slew_history_append(const char *file, struct slew_record *rp);
+int		slew_history_load(const char *file, struct slew_record **recs);
+double	slew_fit(struct slew_record *recs, int *n, int cmd, struct slew_model *m);
+int		load_slew_model(char *str, struct slew_model *m);
+int		save_slew_model(const char *file, struct slew_model *m);
+
+#endif /* SLEWHIST_H */
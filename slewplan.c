@@ -0,0 +1,190 @@
+/*
+ * Slew time model and goto ordering for Celestron NexStar hand control
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Ordering a target list is an open travelling salesman path from the
+ * current position: nearest neighbour to get going, then 2-opt and
+ * Or-opt passes until neither finds an improvement.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "slewplan.h"
+
+#define	IMPROVE_EPS		1e-9	/* seconds; ignore noise when comparing */
+#define	MAX_PASSES		1000	/* bound on improvement passes */
+
+/* NexStar SE class mount at full rate; override with --slew-model */
+struct slew_model slew_model = {
+	{ 4.0, 4.0 }, { 2.0, 2.0 }, 1.0, { 1, 0 }
+};
+
+/*
+ * parse "rate1,rate2,accel1,accel2[,settle]" in degrees and seconds
+ * Returns 0 on success, -1 on bad input.
+ */
+int parse_slew_model(char *str, struct slew_model *m)
+{
+	struct slew_model n = *m;
+	int c;
+
+	c = sscanf(str, "%lf,%lf,%lf,%lf,%lf", &n.rate[0], &n.rate[1],
+			&n.accel[0], &n.accel[1], &n.settle);
+	if( c < 4 || n.rate[0] <= 0 || n.rate[1] <= 0 ||
+			n.accel[0] <= 0 || n.accel[1] <= 0 || n.settle < 0 )
+		return -1;
+	*m = n;
+	return 0;
+}
+
+/* time for one axis to move deg degrees from rest to rest */
+double axis_time(struct slew_model *m, int axis, double deg)
+{
+	double v = m->rate[axis], a = m->accel[axis];
+
+	if( deg <= 0 )
+		return 0;
+	if( deg >= v*v/a )
+		return deg/v + v/a;
+	return 2*sqrt(deg/a);
+}
+
+/* degrees an axis travels; a wrapping axis goes the short way round */
+double axis_distance(struct slew_model *m, int axis, angle_t from, angle_t to)
+{
+	int32_t d;
+
+	if( m->wrap[axis] )
+		d = (int32_t)(to - from);
+	else	/* signed axis, -90..+90 never crosses the seam */
+		d = (int32_t)to - (int32_t)from;
+	return fabs((double)d) * (360.0/ANGLE_FULL);
+}
+
+double slew_time(struct slew_model *m, angle_t *from, angle_t *to)
+{
+	double t0, t1;
+
+	t0 = axis_time(m, 0, axis_distance(m, 0, from[0], to[0]));
+	t1 = axis_time(m, 1, axis_distance(m, 1, from[1], to[1]));
+	return (t0 > t1 ? t0 : t1) + m->settle;
+}
+
+/* cost of path[i] -> path[j]; past the end of the path costs nothing */
+#define	COST(i, j)	(((j) > n) ? 0.0 : cost[path[i]*(n+1) + path[j]])
+
+/* reverse path[i..j] when that shortens the path */
+static int two_opt(double *cost, int *path, int n)
+{
+	int i, j, t, improved = 0;
+	double delta;
+
+	for(i = 1; i < n; i++) {
+		for(j = i + 1; j <= n; j++) {
+			delta = COST(i-1, j) + COST(i, j+1) - COST(i-1, i) - COST(j, j+1);
+			if( delta < -IMPROVE_EPS ) {
+				int a = i, b = j;
+				while( a < b ) {
+					t = path[a]; path[a++] = path[b]; path[b--] = t;
+				}
+				improved = 1;
+			}
+		}
+	}
+	return improved;
+}
+
+/* move runs of 1 to 3 stops to a better place on the path */
+static int or_opt(double *cost, int *path, int n)
+{
+	int len, i, k, improved = 0;
+	double gain, add;
+	int seg[3];
+
+	for(len = 1; len <= 3; len++) {
+		for(i = 1; i + len - 1 <= n; i++) {
+			int j = i + len - 1;
+			/* removing path[i..j] saves this much */
+			gain = COST(i-1, i) + COST(j, j+1) - ((j+1 > n) ? 0.0 : COST(i-1, j+1));
+			for(k = 0; k <= n; k++) {
+				if( k >= i-1 && k <= j )
+					continue;
+				/* insert between path[k] and path[k+1] */
+				add = COST(k, i) + COST(j, k+1) - COST(k, k+1);
+				if( add < gain - IMPROVE_EPS ) {
+					memcpy(seg, &path[i], len*sizeof(int));
+					if( k > j ) {
+						memmove(&path[i], &path[j+1], (k - j)*sizeof(int));
+						memcpy(&path[k - len + 1], seg, len*sizeof(int));
+					} else {
+						memmove(&path[k + 1 + len], &path[k + 1], (i - k - 1)*sizeof(int));
+						memcpy(&path[k + 1], seg, len*sizeof(int));
+					}
+					improved = 1;
+					break;
+				}
+			}
+		}
+	}
+	return improved;
+}
+
+/*
+ * Order n targets to minimise total slew time starting at start.
+ * order[] receives target indices in visiting order.
+ * Returns predicted total time in seconds, or -1 if out of memory.
+ */
+double slew_order(struct slew_model *m, angle_t *start, angle_t (*target)[2], int n, int *order)
+{
+	double *cost, best, total;
+	int *path, *used, i, j, k, pass;
+	angle_t *p, *q;
+
+	if( n <= 0 )
+		return 0;
+	cost = malloc((size_t)(n+1)*(n+1)*sizeof(double));
+	path = malloc((n+1)*sizeof(int));
+	used = calloc(n+1, sizeof(int));
+	if( cost == NULL || path == NULL || used == NULL ) {
+		free(cost); free(path); free(used);
+		return -1;
+	}
+	/* node 0 is the start position, node i is target i-1 */
+	for(i = 0; i <= n; i++) {
+		p = (i == 0) ? start : target[i-1];
+		for(j = 0; j <= n; j++) {
+			q = (j == 0) ? start : target[j-1];
+			cost[i*(n+1) + j] = (i == j) ? 0 : slew_time(m, p, q);
+		}
+	}
+	/* nearest neighbour */
+	path[0] = 0;
+	used[0] = 1;
+	for(i = 1; i <= n; i++) {
+		best = HUGE_VAL;
+		for(j = 1, k = 0; j <= n; j++) {
+			if( !used[j] && cost[path[i-1]*(n+1) + j] < best ) {
+				best = cost[path[i-1]*(n+1) + j];
+				k = j;
+			}
+		}
+		path[i] = k;
+		used[k] = 1;
+	}
+	for(pass = 0; pass < MAX_PASSES; pass++) {
+		if( !two_opt(cost, path, n) && !or_opt(cost, path, n) )
+			break;
+	}
+	for(i = 1, total = 0; i <= n; i++) {
+		total += cost[path[i-1]*(n+1) + path[i]];
+		order[i-1] = path[i] - 1;
+	}
+	free(cost); free(path); free(used);
+	return total;
+}
@@ -0,0 +1,36 @@
+/*
+ * Slew time model and goto ordering for Celestron NexStar hand control
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef SLEWPLAN_H
+#define SLEWPLAN_H
+
+#include "angle.h"
+
+/*
+ * Both axes slew at once with a trapezoidal speed profile: accelerate,
+ * coast at rate, decelerate. A goto takes as long as its slower axis
+ * plus settle time. Positions are the mount's own axes: RA/Dec on an
+ * EQ mount, azimuth/altitude on an Alt-Azimuth one. A wrapping axis is
+ * taken to turn freely; cable wrap limits are not modelled.
+ */
+struct slew_model {
+	double	rate[2];	/* top speed, degrees/second */
+	double	accel[2];	/* degrees/second^2 */
+	double	settle;		/* seconds added to every goto */
+	int		wrap[2];	/* axis goes round (azimuth/RA), takes short way */
+};
+
+extern struct slew_model slew_model;
+
+int		parse_slew_model(char *str, struct slew_model *m);
+double	axis_time(struct slew_model *m, int axis, double deg);
+double	axis_distance(struct slew_model *m, int axis, angle_t from, angle_t to);
+double	slew_time(struct slew_model *m, angle_t *from, angle_t *to);
+double	slew_order(struct slew_model *m, angle_t *start, angle_t (*target)[2], int n, int *order);
+
+#endif /* SLEWPLAN_H */
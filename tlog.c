@@ -0,0 +1,528 @@
+/*
+ * Columnar telemetry log
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * Samples are kept in blocks of up to TLOG_ROWS rows, each column of a
+ * block stored on its own as zigzag varints of the difference from the
+ * row before: time from the previous row, values from the previous row
+ * of the same command, so interleaved RA/Dec and Az/Alt samples each
+ * delta against their own kind. A position sample at a few Hz costs
+ * about 6 bytes against 40 raw or 80 as text.
+ *
+ * The file is a header, the blocks, then an index (time range, offset,
+ * size per block) and a footer pointing at it. Reopening for append
+ * drops the index and writes a new one at close; if a run died before
+ * writing it the blocks are rescanned, so nothing but the last partial
+ * block is lost. Readers binary search the index for the time range
+ * and decode the selected blocks in parallel.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "scope-control.h"
+#include "frame.h"
+#include "trace.h"
+#include "tlog.h"
+
+#define	TLOG_VERSION	1
+#define	TLOG_HEADER		8		/* magic and version */
+#define	TLOG_BATCH		64		/* blocks decoded per parallel pass */
+#define	TLOG_THREADS	16
+
+#define	ZIGZAG(x)		(((uint64_t)(x) << 1) ^ (uint64_t)((int64_t)(x) >> 63))
+#define	UNZIGZAG(u)		((int64_t)((u) >> 1) ^ -(int64_t)((u) & 1))
+
+char	*telemetry_log = NULL;
+
+static int tlog_fd = -1;
+static struct tlog_row rows[TLOG_ROWS];
+static int nrows;
+static struct tlog_index *tlog_idx;
+static uint32_t tlog_nidx, tlog_cap;
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+	while( v >= 0x80 ) {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	uint64_t r = 0;
+	int s;
+
+	for(s = 0; p < end && s < 64; s += 7) {
+		r |= (uint64_t)(*p & 0x7F) << s;
+		if( !(*p++ & 0x80) ) {
+			*v = r;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Index of a mapped log: the footer's if there is one, otherwise found
+ * by walking the block headers. *end gets the offset just past the last
+ * block. Returns the number of blocks, -1 if this is not a log.
+ */
+static long tlog_load_index(const uint8_t *base, uint64_t size, struct tlog_index **idx, uint64_t *end)
+{
+	struct tlog_footer ft;
+	struct tlog_block bh;
+	struct tlog_index *ip;
+	uint64_t off, len;
+	long n = 0, cap = 0;
+	int i;
+
+	*idx = NULL;
+	if( size < TLOG_HEADER || memcmp(base, TLOG_MAGIC, 4) != 0 )
+		return -1;
+	if( size >= TLOG_HEADER + sizeof(ft) ) {
+		memcpy(&ft, base + size - sizeof(ft), sizeof(ft));
+		if( memcmp(ft.magic, TLOG_IMAGIC, 4) == 0 &&
+				ft.index_offset + (uint64_t)ft.count * sizeof(*ip) + sizeof(ft) == size ) {
+			if( (*idx = malloc(ft.count * sizeof(*ip) + 1)) == NULL )
+				return -1;
+			memcpy(*idx, base + ft.index_offset, ft.count * sizeof(*ip));
+			*end = ft.index_offset;
+			return ft.count;
+		}
+	}
+	for(off = TLOG_HEADER; off + sizeof(bh) <= size; off += len) {
+		memcpy(&bh, base + off, sizeof(bh));
+		if( memcmp(bh.magic, TLOG_BMAGIC, 4) != 0 || bh.rows == 0 || bh.rows > TLOG_ROWS )
+			break;
+		for(len = sizeof(bh), i = 0; i < TLOG_COLS; i++)
+			len += bh.len[i];
+		if( off + len > size )
+			break;
+		if( n == cap ) {
+			cap = cap ? cap*2 : 64;
+			if( (ip = realloc(*idx, cap * sizeof(*ip))) == NULL )
+				return -1;
+			*idx = ip;
+		}
+		ip = &(*idx)[n++];
+		ip->t_first = bh.t_first;
+		ip->t_last = bh.t_last;
+		ip->offset = off;
+		ip->rows = bh.rows;
+		ip->len = len;
+	}
+	*end = off;
+	return n;
+}
+
+/*
+ * Open (or create) the log for appending. Returns 0 or -1 (logged).
+ */
+int tlog_open(char *path)
+{
+	struct stat st;
+	uint64_t end = TLOG_HEADER;
+	void *map;
+	long n = 0;
+
+	if( (tlog_fd = open(path, O_RDWR|O_CREAT, 0644)) < 0 || fstat(tlog_fd, &st) < 0 ) {
+		errlog(15, "cannot open telemetry log %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if( st.st_size == 0 ) {
+		char hdr[TLOG_HEADER] = TLOG_MAGIC;
+		hdr[4] = TLOG_VERSION;
+		if( write(tlog_fd, hdr, sizeof(hdr)) != sizeof(hdr) )
+			n = -1;
+	} else {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, tlog_fd, 0);
+		if( map == MAP_FAILED )
+			n = -1;
+		else {
+			n = tlog_load_index(map, st.st_size, &tlog_idx, &end);
+			munmap(map, st.st_size);
+		}
+		if( n >= 0 && (ftruncate(tlog_fd, end) < 0 || lseek(tlog_fd, end, SEEK_SET) < 0) )
+			n = -1;
+	}
+	if( n < 0 ) {
+		errlog(15, "%s is not a telemetry log", path);
+		close(tlog_fd);
+		tlog_fd = -1;
+		return -1;
+	}
+	tlog_nidx = tlog_cap = n;
+	nrows = 0;
+	return 0;
+}
+
+/* encode and write the rows held; returns 0 or -1 */
+static int tlog_flush()
+{
+	static uint8_t col[TLOG_COLS][TLOG_ROWS*10];
+	static uint32_t last_a[256], last_b[256];
+	struct tlog_block bh;
+	struct tlog_index *ip;
+	struct tlog_row *r;
+	uint8_t *cp[TLOG_COLS], kind = 0;
+	int64_t t;
+	off_t off;
+	int i;
+
+	if( nrows == 0 )
+		return 0;
+	memset(last_a, 0, sizeof(last_a));
+	memset(last_b, 0, sizeof(last_b));
+	memcpy(bh.magic, TLOG_BMAGIC, 4);
+	bh.rows = nrows;
+	bh.t_first = bh.t_last = t = rows[0].t;
+	for(i = 0; i < TLOG_COLS; i++)
+		cp[i] = col[i];
+	for(r = rows; r < &rows[nrows]; r++) {
+		cp[0] = put_varint(cp[0], ZIGZAG(r->t - t));
+		cp[1] = put_varint(cp[1], ZIGZAG((int8_t)(r->kind - kind)));
+		cp[2] = put_varint(cp[2], ZIGZAG((int32_t)(r->a - last_a[r->kind])));
+		cp[3] = put_varint(cp[3], ZIGZAG((int32_t)(r->b - last_b[r->kind])));
+		t = r->t;
+		kind = r->kind;
+		last_a[kind] = r->a;
+		last_b[kind] = r->b;
+		if( t > bh.t_last )
+			bh.t_last = t;
+	}
+	for(i = 0; i < TLOG_COLS; i++)
+		bh.len[i] = cp[i] - col[i];
+	if( tlog_nidx == tlog_cap ) {
+		tlog_cap = tlog_cap ? tlog_cap*2 : 64;
+		if( (ip = realloc(tlog_idx, tlog_cap * sizeof(*ip))) == NULL )
+			return -1;
+		tlog_idx = ip;
+	}
+	if( (off = lseek(tlog_fd, 0, SEEK_END)) < 0 || write(tlog_fd, &bh, sizeof(bh)) != sizeof(bh) )
+		return -1;
+	for(i = 0; i < TLOG_COLS; i++)
+		if( write(tlog_fd, col[i], bh.len[i]) != bh.len[i] )
+			return -1;
+	ip = &tlog_idx[tlog_nidx++];
+	ip->t_first = bh.t_first;
+	ip->t_last = bh.t_last;
+	ip->offset = off;
+	ip->rows = nrows;
+	ip->len = lseek(tlog_fd, 0, SEEK_CUR) - off;
+	nrows = 0;
+	return 0;
+}
+
+/* log one reply: position pairs as angles, anything else as raw bytes */
+void tlog_reply(char cmd, struct timespec *stamp, const char *reply, int rlen)
+{
+	struct tlog_row *r;
+	int i, digits;
+
+	if( tlog_fd < 0 )
+		return;
+	r = &rows[nrows];
+	r->t = (int64_t)stamp->tv_sec * 1000000 + stamp->tv_nsec / 1000;
+	r->kind = cmd;
+	r->a = r->b = 0;
+	if( strchr("eEzZ", cmd) != NULL ) {
+		digits = islower(cmd) ? 8 : 4;
+		r->a = hex2angle(reply, digits);
+		r->b = hex2angle(reply + digits + 1, digits);
+	} else {
+		for(i = 0; i < rlen - 1 && i < 8; i++) {
+			if( i < 4 )
+				r->a |= (uint32_t)(unsigned char)reply[i] << (24 - 8*i);
+			else
+				r->b |= (uint32_t)(unsigned char)reply[i] << (56 - 8*i);
+		}
+	}
+	if( ++nrows == TLOG_ROWS && tlog_flush() < 0 ) {
+		errlog(15, "cannot write telemetry log: %s", strerror(errno));
+		close(tlog_fd);
+		tlog_fd = -1;
+	}
+}
+
+/* flush, write index and footer. Returns 0 or -1 (logged). */
+int tlog_close()
+{
+	struct tlog_footer ft;
+	off_t off;
+	int err;
+
+	if( tlog_fd < 0 )
+		return 0;
+	err = tlog_flush() < 0 || (off = lseek(tlog_fd, 0, SEEK_END)) < 0;
+	if( !err ) {
+		ft.index_offset = off;
+		ft.count = tlog_nidx;
+		memcpy(ft.magic, TLOG_IMAGIC, 4);
+		err = write(tlog_fd, tlog_idx, tlog_nidx * sizeof(*tlog_idx)) != tlog_nidx * sizeof(*tlog_idx) ||
+			write(tlog_fd, &ft, sizeof(ft)) != sizeof(ft);
+	}
+	err |= close(tlog_fd) < 0;
+	tlog_fd = -1;
+	free(tlog_idx);
+	tlog_idx = NULL;
+	tlog_nidx = tlog_cap = 0;
+	if( err ) {
+		errlog(15, "cannot write telemetry log: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Decode one block into out. Returns rows, -1 if the block is damaged.
+ */
+static long tlog_decode(const uint8_t *base, uint64_t size, struct tlog_index *ip, struct tlog_row *out)
+{
+	uint32_t last_a[256], last_b[256];
+	const uint8_t *p, *end;
+	struct tlog_block bh;
+	uint64_t v, off;
+	int64_t t;
+	uint8_t kind = 0;
+	long i;
+	int c;
+
+	if( ip->offset + sizeof(bh) > size )
+		return -1;
+	memcpy(&bh, base + ip->offset, sizeof(bh));
+	if( memcmp(bh.magic, TLOG_BMAGIC, 4) != 0 || bh.rows > TLOG_ROWS || ip->offset + ip->len > size )
+		return -1;
+	memset(last_a, 0, sizeof(last_a));
+	memset(last_b, 0, sizeof(last_b));
+	off = ip->offset + sizeof(bh);
+	/* a column at a time: each is one tight loop over contiguous bytes */
+	for(c = 0; c < TLOG_COLS; off += bh.len[c++]) {
+		p = base + off;
+		end = p + bh.len[c];
+		if( end > base + ip->offset + ip->len )
+			return -1;
+		for(t = bh.t_first, i = 0; i < bh.rows; i++) {
+			if( (p = get_varint(p, end, &v)) == NULL )
+				return -1;
+			switch(c) {
+			case 0:
+				out[i].t = t += UNZIGZAG(v);
+				break;
+			case 1:
+				out[i].kind = kind += (int8_t)UNZIGZAG(v);
+				break;
+			case 2:
+				out[i].a = last_a[out[i].kind] += (int32_t)UNZIGZAG(v);
+				break;
+			case 3:
+				out[i].b = last_b[out[i].kind] += (int32_t)UNZIGZAG(v);
+				break;
+			}
+		}
+	}
+	return bh.rows;
+}
+
+/*
+ * Every row of the log at path, in file order, into *out (malloc'ed).
+ * Returns the number of rows, -1 if it cannot be read or a block is
+ * damaged.
+ */
+long tlog_load(char *path, struct tlog_row **out)
+{
+	struct tlog_index *idx = NULL;
+	struct stat st;
+	uint64_t end;
+	long n = -1, rows = 0, i, got;
+	int fd;
+	void *map = MAP_FAILED;
+
+	*out = NULL;
+	if( (fd = open(path, O_RDONLY)) < 0 )
+		return -1;
+	if( fstat(fd, &st) == 0 && st.st_size > 0 )
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if( map == MAP_FAILED )
+		return -1;
+	if( (n = tlog_load_index(map, st.st_size, &idx, &end)) < 0 )
+		goto done;
+	for(i = 0; i < n; i++)
+		rows += idx[i].rows;
+	/* room for a block that says it has more rows than its index entry */
+	if( (*out = malloc((rows + TLOG_ROWS) * sizeof(struct tlog_row))) == NULL ) {
+		n = -1;
+		goto done;
+	}
+	for(rows = 0, i = 0; i < n; i++, rows += got)
+		if( (got = tlog_decode(map, end, &idx[i], *out + rows)) != idx[i].rows ) {
+			n = -1;
+			goto done;
+		}
+done:
+	free(idx);
+	munmap(map, st.st_size);
+	if( n < 0 ) {
+		free(*out);
+		*out = NULL;
+		return -1;
+	}
+	return rows;
+}
+
+struct tlog_job {
+	const uint8_t		*base;
+	uint64_t			size;
+	struct tlog_index	*idx;
+	long				first, count;
+	long				next;		/* next block to take, shared */
+	struct tlog_row		*out;		/* TLOG_ROWS per block */
+	long				*got;		/* rows per block, -1 damaged */
+};
+
+static void *tlog_worker(void *arg)
+{
+	struct tlog_job *jp = arg;
+	long long t0 = TRACE_BEGIN();
+	long i;
+
+	while( (i = __atomic_fetch_add(&jp->next, 1, __ATOMIC_RELAXED)) < jp->count )
+		jp->got[i] = tlog_decode(jp->base, jp->size, &jp->idx[jp->first + i],
+			jp->out + i*TLOG_ROWS);
+	TRACE_END("telemetry worker", -1, t0);
+	return NULL;
+}
+
+static void tlog_print(struct tlog_row *r)
+{
+	const struct frame_desc *fp;
+	char b1[32], b2[32];
+	int i, l;
+
+	fprintf(outfile, "%lld.%06lld %c ", (long long)(r->t / 1000000), (long long)(r->t % 1000000), r->kind);
+	if( strchr("eEzZ", r->kind) != NULL ) {
+		convert2hhmmss(b1, r->a, tolower(r->kind) == 'e' ? ANGLE_HOUR : ANGLE_DEG, 0);
+		convert2hhmmss(b2, r->b, ANGLE_DEG, 1);
+		fprintf(outfile, "%s %s\n", b1, b2);
+		return;
+	}
+	l = ((fp = frame_lookup(r->kind)) != NULL && fp->rlen > 0) ? fp->rlen - 1 : 8;
+	for(i = 0; i < l && i < 8; i++)
+		fprintf(outfile, "%02X", (i < 4 ? r->a >> (24 - 8*i) : r->b >> (56 - 8*i)) & 0xFF);
+	fprintf(outfile, "\n");
+}
+
+/*
+ * --telemetry-dump file[,from[,to]]: rows with from <= time <= to,
+ * times in realtime seconds.
+ */
+void cmd_tlogdump(char *arg)
+{
+	struct tlog_index *idx = NULL;
+	struct tlog_job job;
+	struct timespec t0, t1;
+	struct stat st;
+	pthread_t tid[TLOG_THREADS];
+	char file[1024], *cp;
+	int64_t ufrom = INT64_MIN, uto = INT64_MAX;
+	uint64_t end;
+	long n, lo, hi, mid, i, j, printed = 0, decoded = 0;
+	int fd, nthreads, k;
+	void *map;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	snprintf(file, sizeof(file), "%s", arg);
+	if( (cp = strchr(file, ',')) != NULL ) {
+		*cp++ = '\0';
+		ufrom = strtod(cp, &cp) * 1e6;
+		if( *cp == ',' )
+			uto = strtod(cp + 1, NULL) * 1e6;
+	}
+	if( (fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0 ) {
+		errlog(15, "cannot open telemetry log %s: %s", file, strerror(errno));
+		return;
+	}
+	map = (st.st_size > 0) ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if( map == MAP_FAILED || (n = tlog_load_index(map, st.st_size, &idx, &end)) < 0 ) {
+		errlog(15, "%s is not a telemetry log", file);
+		if( map != MAP_FAILED )
+			munmap(map, st.st_size);
+		return;
+	}
+	/* blocks are in time order: first whose end reaches from, last whose start is before to */
+	for(lo = 0, hi = n; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if( idx[mid].t_last < ufrom )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for(hi = lo; hi < n && idx[hi].t_first <= uto; hi++)
+		;
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if( nthreads > TLOG_THREADS )
+		nthreads = TLOG_THREADS;
+	if( nthreads < 1 )
+		nthreads = 1;
+	job.base = map;
+	job.size = end;
+	job.idx = idx;
+	job.out = malloc(TLOG_BATCH * TLOG_ROWS * sizeof(struct tlog_row));
+	job.got = malloc(TLOG_BATCH * sizeof(long));
+	if( job.out == NULL || job.got == NULL ) {
+		errlog(15, "telemetry-dump out of memory");
+		goto done;
+	}
+	for(job.first = lo; job.first < hi; job.first += job.count) {
+		job.count = (hi - job.first < TLOG_BATCH) ? hi - job.first : TLOG_BATCH;
+		job.next = 0;
+		for(k = 1; k < nthreads && k < job.count; k++)
+			if( pthread_create(&tid[k], NULL, tlog_worker, &job) != 0 )
+				break;
+		tlog_worker(&job);
+		while( --k > 0 )
+			pthread_join(tid[k], NULL);
+		for(i = 0; i < job.count; i++) {
+			if( job.got[i] < 0 ) {
+				fprintf(errfile, "telemetry-dump: block at %llu damaged, skipped\n",
+					(unsigned long long)idx[job.first + i].offset);
+				continue;
+			}
+			decoded += job.got[i];
+			for(j = 0; j < job.got[i]; j++) {
+				struct tlog_row *r = &job.out[i*TLOG_ROWS + j];
+				if( r->t >= ufrom && r->t <= uto ) {
+					tlog_print(r);
+					printed++;
+				}
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(outfile, "# telemetry %ld rows of %ld decoded from %ld of %ld blocks, %d threads, %.1fms\n",
+		printed, decoded, hi - lo, n, nthreads,
+		(t1.tv_sec - t0.tv_sec)*1e3 + (t1.tv_nsec - t0.tv_nsec)/1e6);
+done:
+	free(job.out);
+	free(job.got);
+	free(idx);
+	munmap(map, st.st_size);
+}
@@ -0,0 +1,58 @@
+/*
+ * Columnar telemetry log
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef TLOG_H
+#define TLOG_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define	TLOG_MAGIC		"NXTL"	/* file header */
+#define	TLOG_BMAGIC		"TLBK"	/* block header */
+#define	TLOG_IMAGIC		"NXTI"	/* footer, after the index */
+#define	TLOG_ROWS		4096	/* rows per block */
+#define	TLOG_COLS		4
+
+/* one sample: a position pair, or up to 8 reply bytes for anything else */
+struct tlog_row {
+	int64_t		t;			/* realtime microseconds */
+	uint8_t		kind;		/* command letter */
+	uint32_t	a, b;
+};
+
+/* block header; column bytes follow in order time, kind, a, b */
+struct tlog_block {
+	char		magic[4];
+	uint32_t	rows;
+	int64_t		t_first;	/* time deltas start here */
+	int64_t		t_last;
+	uint32_t	len[TLOG_COLS];
+};
+
+/* index entry, one per block, written at close */
+struct tlog_index {
+	int64_t		t_first, t_last;
+	uint64_t	offset;
+	uint32_t	rows, len;	/* len includes the block header */
+};
+
+struct tlog_footer {
+	uint64_t	index_offset;
+	uint32_t	count;
+	char		magic[4];
+};
+
+extern char	*telemetry_log;
+
+int		tlog_open(char *path);
+void	tlog_reply(char cmd, struct timespec *stamp, const char *reply, int rlen);
+int		tlog_close();
+long	tlog_load(char *path, struct tlog_row **out);
+void	cmd_tlogdump(char *arg);
+
+#endif /* TLOG_H */
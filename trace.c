@@ -0,0 +1,316 @@
+/*
+ * Span tracing in Chrome trace-event format
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * With --trace-file set, TRACE_BEGIN()/TRACE_END() mark spans: each
+ * command line option, opening the port, every write, every wait for a
+ * reply, resyncs and the formatting of results. Spans go into a block
+ * owned by the thread that made them, so recording takes no lock, and
+ * when tracing is off a span costs one test of trace_on. A full block
+ * is queued for a writer thread and swapped for an empty one, the only
+ * locked step and a few pointer moves, so formatting and file writes
+ * never hold up the thread being traced. At most TRACE_MAXBLOCKS blocks
+ * exist; if the writer falls that far behind, spans are dropped and
+ * counted rather than stall anyone. A run that is killed or crashes
+ * keeps what the writer got to, missing the blocks still being filled
+ * and the closing "]}". At exit, including exit() from any option, the
+ * rest is written as Chrome trace-event JSON, which chrome://tracing
+ * and ui.perfetto.dev both open. Time is CLOCK_MONOTONIC from the start
+ * of the process; the wall clock at that moment is kept in otherData.
+ */
+
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+#define	TRACE_BLOCK		4096	/* spans per block */
+#define	TRACE_MAXBLOCKS	64		/* blocks in all, filling, queued or free */
+
+struct trace_span {
+	const char	*name;		/* static string */
+	long long	ts;			/* ns */
+	long long	dur;		/* ns */
+	int			cmd;		/* command character, -1 for none */
+};
+
+struct trace_thread;
+
+struct trace_block {
+	struct trace_span	span[TRACE_BLOCK];
+	int					n;
+	struct trace_thread	*owner;
+	struct trace_block	*next;		/* on the write queue or the free list */
+};
+
+/* one per thread; only the owner fills its block */
+struct trace_thread {
+	struct trace_block	*block;
+	int					id;
+	int					named;		/* thread_name written; the writer's */
+	struct trace_thread	*next;
+};
+
+int		trace_on = 0;
+char	*trace_file = NULL;
+
+/* trace_lock covers the queue, the free list, the thread list and trace_out going away */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trace_wake = PTHREAD_COND_INITIALIZER;
+static struct trace_block *queue = NULL, **queue_tail = &queue, *free_blocks = NULL;
+static int trace_blocks = 0, trace_quit = 0;
+static long trace_dropped = 0;
+static pthread_t trace_writer;
+static FILE *trace_out = NULL;		/* the writer's until trace_write() joins it */
+static struct trace_thread *trace_list = NULL;
+static __thread struct trace_thread *mine = NULL;
+static int trace_threads = 0;
+static long long trace_origin;		/* ns monotonic of process start */
+static struct timespec trace_wall;	/* wall clock at trace_origin */
+
+long long trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+static void trace_event(struct trace_span *sp, int tid)
+{
+	fprintf(trace_out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+		sp->name, tid, (sp->ts - trace_origin) / 1e3, sp->dur / 1e3);
+	if( sp->cmd > ' ' && sp->cmd < 0x7F && sp->cmd != '"' && sp->cmd != '\\' )
+		fprintf(trace_out, ",\"args\":{\"cmd\":\"%c\"}", sp->cmd);
+	else if( sp->cmd >= 0 )
+		fprintf(trace_out, ",\"args\":{\"cmd\":\"0x%02x\"}", sp->cmd);
+	fprintf(trace_out, "}");
+}
+
+/* write out a block, naming its thread the first time */
+static void trace_emit(struct trace_block *bp)
+{
+	struct trace_thread *tp = bp->owner;
+	int i;
+
+	if( !tp->named ) {
+		fprintf(trace_out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+			tp->id, tp->id == 0 ? "main" : "worker", tp->id);
+		tp->named = 1;
+	}
+	for(i = 0; i < bp->n; i++)
+		trace_event(&bp->span[i], tp->id);
+	fflush(trace_out);
+}
+
+/* write queued blocks as they come, until trace_write() says to finish */
+static void *trace_write_loop(void *arg)
+{
+	struct trace_block *bp;
+
+	pthread_mutex_lock(&trace_lock);
+	for(;;) {
+		while( queue == NULL && !trace_quit )
+			pthread_cond_wait(&trace_wake, &trace_lock);
+		if( (bp = queue) == NULL )
+			break;
+		if( (queue = bp->next) == NULL )
+			queue_tail = &queue;
+		pthread_mutex_unlock(&trace_lock);
+		trace_emit(bp);
+		pthread_mutex_lock(&trace_lock);
+		bp->n = 0;
+		bp->next = free_blocks;
+		free_blocks = bp;
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return NULL;
+}
+
+/*
+ * Queue tp's full block, if any, and give it an empty one. Once the
+ * file is closed the block is just emptied. Returns the block to fill,
+ * NULL if there is none to be had.
+ */
+static struct trace_block *trace_swap(struct trace_thread *tp)
+{
+	struct trace_block *bp = tp->block;
+
+	pthread_mutex_lock(&trace_lock);
+	if( bp != NULL && trace_out == NULL ) {
+		bp->n = 0;
+		pthread_mutex_unlock(&trace_lock);
+		return bp;
+	}
+	if( bp != NULL ) {
+		bp->next = NULL;
+		*queue_tail = bp;
+		queue_tail = &bp->next;
+		pthread_cond_signal(&trace_wake);
+	}
+	if( (bp = free_blocks) != NULL )
+		free_blocks = bp->next;
+	else if( trace_blocks < TRACE_MAXBLOCKS && (bp = malloc(sizeof(*bp))) != NULL )
+		trace_blocks++;
+	if( bp != NULL ) {
+		bp->n = 0;
+		bp->owner = tp;
+	}
+	tp->block = bp;
+	pthread_mutex_unlock(&trace_lock);
+	return bp;
+}
+
+/* first span on a thread: allocate and list it */
+static struct trace_thread *trace_self(void)
+{
+	struct trace_thread *tp;
+
+	if( (tp = mine) != NULL )
+		return tp;
+	if( (tp = calloc(1, sizeof(*tp))) == NULL )
+		return NULL;
+	pthread_mutex_lock(&trace_lock);
+	tp->id = trace_threads++;
+	tp->next = trace_list;
+	trace_list = tp;
+	pthread_mutex_unlock(&trace_lock);
+	return mine = tp;
+}
+
+void trace_span(const char *name, int cmd, long long start)
+{
+	struct trace_thread *tp;
+	struct trace_block *bp;
+	struct trace_span *sp;
+
+	if( (tp = trace_self()) == NULL )
+		return;
+	if( ((bp = tp->block) == NULL || bp->n == TRACE_BLOCK) && (bp = trace_swap(tp)) == NULL ) {
+		__atomic_fetch_add(&trace_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	sp = &bp->span[bp->n++];
+	sp->name = name;
+	sp->cmd = cmd;
+	sp->ts = start;
+	sp->dur = trace_now() - start;
+}
+
+/*
+ * Process start, from /proc/self/stat in clock ticks since boot, moved
+ * onto CLOCK_MONOTONIC. 0 if it cannot be had.
+ */
+static long long trace_process_start(void)
+{
+	struct timespec boot, mono;
+	unsigned long long ticks;
+	char buf[1024], *cp;
+	FILE *f;
+	int i;
+
+	if( (f = fopen("/proc/self/stat", "r")) == NULL )
+		return 0;
+	cp = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	/* the name in field 2 may hold spaces; count from its ')' */
+	if( cp == NULL || (cp = strrchr(buf, ')')) == NULL )
+		return 0;
+	for(i = 2; i < 22 && cp != NULL; i++)
+		cp = strchr(cp + 1, ' ');
+	if( cp == NULL || sscanf(cp, "%llu", &ticks) != 1 )
+		return 0;
+	clock_gettime(CLOCK_BOOTTIME, &boot);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	return (long long)(ticks * 1000000000ULL / sysconf(_SC_CLK_TCK)) -
+		((long long)(boot.tv_sec - mono.tv_sec)*1000000000LL + boot.tv_nsec - mono.tv_nsec);
+}
+
+static void trace_atexit(void)
+{
+	trace_write();
+}
+
+/*
+ * --trace-file path: create the file, start the writer and start
+ * recording, with a span for the process getting this far.
+ * Returns 0, -1 if path cannot be written.
+ */
+int trace_start(char *path)
+{
+	long long now = trace_now(), start;
+
+	if( trace_out != NULL )
+		return 0;
+	if( (trace_out = fopen(path, "w")) == NULL )
+		return -1;
+	trace_file = path;
+	clock_gettime(CLOCK_REALTIME, &trace_wall);
+	start = trace_process_start();
+	if( start <= 0 || start > now )
+		start = now;
+	trace_origin = start;
+	trace_wall.tv_sec -= (now - start) / 1000000000LL;
+	trace_wall.tv_nsec -= (now - start) % 1000000000LL;
+	if( trace_wall.tv_nsec < 0 ) {
+		trace_wall.tv_nsec += 1000000000L;
+		trace_wall.tv_sec--;
+	}
+	fprintf(trace_out, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"start_unix\":\"%ld.%06ld\"},\"traceEvents\":[",
+		(long)trace_wall.tv_sec, trace_wall.tv_nsec / 1000);
+	fprintf(trace_out, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"scope-control\"}}");
+	fflush(trace_out);
+	if( pthread_create(&trace_writer, NULL, trace_write_loop, NULL) != 0 ) {
+		fclose(trace_out);
+		trace_out = NULL;
+		return -1;
+	}
+	atexit(trace_atexit);
+	trace_on = 1;
+	trace_span("startup", -1, start);
+	return 0;
+}
+
+/*
+ * Let the writer finish the queue, then write what is left of every
+ * thread's spans and close trace_file. Called at exit, when the other
+ * threads are done; once is enough.
+ * Returns 0, -1 if the file could not be written.
+ */
+int trace_write(void)
+{
+	struct trace_thread *tp;
+	int err;
+
+	if( trace_out == NULL )
+		return 0;
+	trace_on = 0;
+	pthread_mutex_lock(&trace_lock);
+	trace_quit = 1;
+	pthread_cond_signal(&trace_wake);
+	pthread_mutex_unlock(&trace_lock);
+	pthread_join(trace_writer, NULL);
+	for(tp = trace_list; tp != NULL; tp = tp->next)
+		if( tp->block != NULL && tp->block->n > 0 ) {
+			trace_emit(tp->block);
+			tp->block->n = 0;
+		}
+	if( trace_dropped > 0 )
+		fprintf(trace_out, ",\n{\"name\":\"dropped spans\",\"ph\":\"M\",\"pid\":1,\"args\":{\"count\":%ld}}",
+			trace_dropped);
+	fprintf(trace_out, "\n]}\n");
+	err = ferror(trace_out);
+	pthread_mutex_lock(&trace_lock);
+	if( fclose(trace_out) != 0 )
+		err = 1;
+	trace_out = NULL;
+	pthread_mutex_unlock(&trace_lock);
+	return err ? -1 : 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Span tracing in Chrome trace-event format
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+extern int	trace_on;
+extern char	*trace_file;
+
+/*
+ *	long long t = TRACE_BEGIN();
+ *	...
+ *	TRACE_END("name", cmd, t);
+ * name must be a static string; cmd is a command character or -1.
+ */
+#define	TRACE_BEGIN()			(trace_on ? trace_now() : 0)
+#define	TRACE_END(name, cmd, t)	do { if( (t) != 0 ) trace_span((name), (cmd), (t)); } while(0)
+
+long long	trace_now(void);
+void	trace_span(const char *name, int cmd, long long start);
+int		trace_start(char *path);
+int		trace_write(void);
+
+#endif /* TRACE_H */
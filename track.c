@@ -0,0 +1,191 @@
+/*
+ * Non-sidereal tracking
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ *
+ * --track-body body[@seconds] follows the Moon, the Sun or a body given
+ * by orbital elements (see ephem.c). The hand control's own tracking
+ * is turned off and each axis is driven by variable rate 'P' slews at
+ * the body's rate, worked out every so many seconds (TRACK_INTERVAL by
+ * default) off a timerfd. In EQNorth/EQSouth the axes are RA and Dec,
+ * in Alt-Azimuth azimuth and altitude. A rate goes out only when it
+ * has moved by the hand control's resolution, FRAME_RATE_STEP, so a
+ * slowly changing rate costs no link time at all. On SIGINT/SIGTERM
+ * the axes are stopped and the original tracking mode put back.
+ */
+
+#include <sys/types.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+
+#include "scope-control.h"
+#include "frame.h"
+#include "astro.h"
+#include "ephem.h"
+#include "estimate.h"
+#include "plan.h"
+#include "rt.h"
+#include "track.h"
+
+#define	TRACK_INTERVAL	5.0			/* seconds between rate updates */
+#define	TRACK_DT		30.0		/* seconds either side for the rate */
+#define	SIDEREAL_RATE	(1296000.0 / 86164.0905)	/* arcseconds/second */
+
+static volatile sig_atomic_t track_stop = 0;
+static char *axis_names[2][2] = { { "azimuth", "altitude" }, { "RA", "Dec" } };
+
+static void track_signal(int sig)
+{
+	track_stop = 1;
+}
+
+/* signed difference b - a of two angles in radians, as arcseconds */
+static double arcsec_diff(double a, double b)
+{
+	return RAD2DEG(remainder(b - a, 2*M_PI)) * 3600;
+}
+
+/*
+ * Axis rates in arcseconds/second at a unix time: mode 1 azimuth and
+ * altitude, 2 or 3 RA and Dec axes.
+ */
+static void track_rates(const struct ephem_body *bp, int mode, double lat, double lon, double when, double *rate)
+{
+	double ra[2], dec[2], alt[2], az[2], jd, lst;
+	int i;
+
+	for(i = 0; i < 2; i++) {
+		jd = astro_jd(when + (i ? TRACK_DT : -TRACK_DT));
+		ephem_position(bp, jd, lat, lon, &ra[i], &dec[i]);
+		if( mode == 1 ) {
+			lst = astro_gmst(jd) + DEG2RAD(lon);
+			astro_altaz(lst, DEG2RAD(lat), ra[i], dec[i], &alt[i], &az[i]);
+		}
+	}
+	if( mode == 1 ) {
+		rate[0] = arcsec_diff(az[0], az[1]) / (2*TRACK_DT);
+		rate[1] = arcsec_diff(alt[0], alt[1]) / (2*TRACK_DT);
+	} else {
+		/* the RA axis turns with the sky less the body's own motion */
+		rate[0] = SIDEREAL_RATE - arcsec_diff(ra[0], ra[1]) / (2*TRACK_DT);
+		rate[1] = arcsec_diff(dec[0], dec[1]) / (2*TRACK_DT);
+		if( mode == 3 )
+			rate[0] = -rate[0];
+	}
+}
+
+static int track_mode(char *name, int mode)
+{
+	char buf[2] = { 'T', mode }, reply;
+
+	if( dev_transact(buf, 2, &reply, 1) != 1 ) {
+		errlog(20, "%s cannot set tracking mode %s", name, track_modes[mode]);
+		return -1;
+	}
+	estimate_tracking(mode);
+	return 0;
+}
+
+void cmd_trackbody(char *arg)
+{
+	struct ephem_body body;
+	struct itimerspec its;
+	struct sigaction old[2];
+	struct timespec ts;
+	char spec[128], buf[2], *cp;
+	double interval = TRACK_INTERVAL, lat, lon, rate[2];
+	long long next, period;
+	long updates = 0, sent = 0, held = 0;
+	long quarters[2] = { LONG_MIN, LONG_MIN }, q;
+	uint64_t ticks;
+	int mode, tfd, axis, eq;
+
+	snprintf(spec, sizeof(spec), "%s", arg);
+	if( (cp = strrchr(spec, '@')) != NULL ) {
+		*cp++ = '\0';
+		interval = atof(cp);
+		if( interval < 0.1 || interval > 600 ) {
+			errlog(20, "track-body interval %s out of range", cp);
+			return;
+		}
+	}
+	if( ephem_parse(spec, &body) < 0 || site_location(&lat, &lon) < 0 )
+		return;
+	if( dev_transact("t", 1, buf, 2) != 2 ) {
+		errlog(20, "track-body cannot read tracking mode");
+		return;
+	}
+	if( (mode = buf[0]) < 1 || mode > 3 ) {
+		errlog(20, "track-body needs the mount set to Alt-Azimuth, EQNorth or EQSouth");
+		return;
+	}
+	eq = (mode != 1);
+	if( (tfd = timerfd_create(CLOCK_MONOTONIC, 0)) < 0 ) {
+		errlog(20, "track-body timerfd: %s", strerror(errno));
+		return;
+	}
+	if( track_mode("track-body", 0) < 0 ) {
+		close(tfd);
+		return;
+	}
+	track_stop = 0;
+	catch_stop(track_signal, old);
+	fprintf(outfile, "track-body %s in %s, rates every %.1fs\n", body.name, track_modes[mode], interval);
+	fflush(outfile);
+	period = (long long)(interval * 1e9);
+	next = rt_now();
+	while( !track_stop ) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		track_rates(&body, mode, lat, lon, ts.tv_sec + ts.tv_nsec/1e9, rate);
+		updates++;
+		for(axis = 0; axis < 2; axis++) {
+			if( fabs(rate[axis]) > FRAME_RATE_MAX ) {
+				errlog(20, "track-body %s rate %.0f\"/s is past what the mount can do",
+					axis_names[eq][axis], rate[axis]);
+				goto done;
+			}
+			q = lround(rate[axis] / FRAME_RATE_STEP);
+			if( q == quarters[axis] ) {
+				held++;
+				continue;
+			}
+			if( send_slew("track-body", 1, axis, q * FRAME_RATE_STEP) < 0 )
+				goto done;
+			quarters[axis] = q;
+			sent++;
+			fprintf(outfile, "track-body %s %+.2f\"/s\n", axis_names[eq][axis], q * FRAME_RATE_STEP);
+		}
+		fflush(outfile);
+		next += period;
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = next / 1000000000LL;
+		its.it_value.tv_nsec = next % 1000000000LL;
+		timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+		if( read(tfd, &ticks, sizeof(ticks)) < 0 ) {
+			if( errno == EINTR )
+				continue;
+			errlog(20, "track-body timerfd: %s", strerror(errno));
+			break;
+		}
+		rt_late(rt_now() - next);
+	}
+done:
+	close(tfd);
+	for(axis = 0; axis < 2; axis++)
+		send_slew("track-body", 1, axis, 0);
+	track_mode("track-body", mode);
+	/* only now, so a second ^C cannot leave the axes moving */
+	restore_stop(old);
+	fprintf(outfile, "track-body %s stopped: %ld updates, %ld rate frames sent, %ld not needed\n",
+		body.name, updates, sent, held);
+}
@@ -0,0 +1,14 @@
+/*
+ * Non-sidereal tracking
+ * Copyright (c) 2015, Francis J. A. Pinteric
+ * All Rights Reserved.
+ * This software is licensed under the GNU General Public License Version 2.
+ * Please see http://www.gnu.org//licenses/old-licenses/gpl-2.0.html for details.
+ */
+
+#ifndef TRACK_H
+#define TRACK_H
+
+void	cmd_trackbody(char *arg);
+
+#endif /* TRACK_H */